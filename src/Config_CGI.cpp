@@ -3,12 +3,24 @@
 // Forward declarations of internal helper functions used in parse_CGI
 static bool is_CGI(const std::string &line);
 static bool is_timeout(const std::string &line);
-static int  parse_timeout(const std::string &line);
+static double parse_timeout(std::string line);
+static bool is_pool(const std::string &line);
+static bool is_queue(const std::string &line);
+static bool is_cache(const std::string &line);
 
 Config_CGI::Config_CGI(FileDescriptor &fd, std::string line) {
   err = "";
   timeout = 3;
+  max_body_kb = 1;
   err = parse_CGI(fd, line);
+  // A pooled script never runs more requests than it has workers
+  if (queue.concurrency == 0)
+    queue.concurrency = pool.max_workers;
+  for (std::map<std::string, std::string>::const_iterator it = env.begin();
+       it != env.end(); ++it) {
+    env_block += it->first + "=" + it->second;
+    env_block += '\0';
+  }
 }
 
 std::string Config_CGI::parse_CGI(FileDescriptor &fd, std::string line) {
@@ -41,11 +53,28 @@ std::string Config_CGI::parse_CGI(FileDescriptor &fd, std::string line) {
     file_line = trim_space(file_line);
     if (is_timeout(file_line))
       timeout = parse_timeout(file_line);
-    else if (std::string::npos != file_line.find("=")) {
+    else if (file_line.compare(0, 5, "->{} ") == 0) {
+      max_body_kb = maxBodyKB_parse(file_line.substr(5));
+      if (max_body_kb == -1)
+        return "Error: \"" + file_line + "\" Invalid body size";
+    } else if (is_pool(file_line)) {
+      err_msg = parse_pool(file_line);
+      if (err_msg != "")
+        return err_msg;
+    } else if (is_queue(file_line)) {
+      err_msg = parse_queue(file_line);
+      if (err_msg != "")
+        return err_msg;
+    } else if (is_cache(file_line)) {
+      err_msg = parse_cache(file_line);
+      if (err_msg != "")
+        return err_msg;
+    } else if (std::string::npos != file_line.find("=")) {
       err_msg = parse_env(file_line);
       if (err_msg != "")
         return err_msg;
-    }
+    } else
+      return "Error: \"" + file_line + "\" Invalid CGI option";
   }
 }
 
@@ -71,7 +100,14 @@ static bool is_CGI(const std::string &line) {
     return false;
 
   std::size_t pos = line.find(".cgi");
-  if (std::string::npos != pos) {
+  if (line.compare(1, 6, "unix:/") == 0) {
+    // A uWSGI backend on a Unix socket, up to the variables
+    i = line.find('(');
+    if (i == std::string::npos)
+      i = line.length();
+    if (i == 7)
+      return false;
+  } else if (std::string::npos != pos) {
     i = pos + 4;
     if (!isExecutableFile(line.substr(1, pos + 3)))
       return false;
@@ -122,6 +158,85 @@ static double parse_timeout(std::string line) {
   return time;
 }
 
+static bool is_pool(const std::string &line) {
+  std::string name = line.substr(0, line.find(' '));
+  return name == "workers" || name == "max_requests" || name == "idle_timeout";
+}
+
+static bool parse_count(const std::string &value, unsigned int &out) {
+  if (value.empty() || value.length() > 9 ||
+      value.find_first_not_of("0123456789") != std::string::npos)
+    return false;
+  out = static_cast<unsigned int>(std::strtoul(value.c_str(), NULL, 10));
+  return true;
+}
+
+// `workers MIN-MAX` (or `workers N` for a fixed size), `max_requests N` and
+// `idle_timeout SECONDS`
+std::string Config_CGI::parse_pool(const std::string &line) {
+  std::vector<std::string> data = string_split(line, " ");
+  bool ok = data.size() == 2;
+
+  if (ok && data[0] == "workers") {
+    std::size_t dash = data[1].find('-');
+    ok = parse_count(data[1].substr(0, dash), pool.min_workers);
+    pool.max_workers = pool.min_workers;
+    if (ok && dash != std::string::npos)
+      ok = parse_count(data[1].substr(dash + 1), pool.max_workers);
+    ok = ok && pool.max_workers > 0 && pool.min_workers <= pool.max_workers;
+  } else if (ok && data[0] == "max_requests")
+    ok = parse_count(data[1], pool.max_requests);
+  else if (ok)
+    ok = parse_count(data[1], pool.idle_timeout);
+  if (!ok)
+    return "Error: \"" + line + "\" Invalid CGI pool option";
+  return "";
+}
+
+static bool is_queue(const std::string &line) {
+  std::string name = line.substr(0, line.find(' '));
+  return name == "concurrency" || name == "queue" || name == "queue_timeout";
+}
+
+// `concurrency N`, `queue N` (requests waiting for a slot) and
+// `queue_timeout SECONDS`
+std::string Config_CGI::parse_queue(const std::string &line) {
+  std::vector<std::string> data = string_split(line, " ");
+  bool ok = data.size() == 2;
+  unsigned int seconds;
+
+  if (ok && data[0] == "concurrency")
+    ok = parse_count(data[1], queue.concurrency) && queue.concurrency > 0;
+  else if (ok && data[0] == "queue")
+    ok = parse_count(data[1], queue.max_waiting);
+  else if (ok) {
+    ok = parse_count(data[1], seconds) && seconds > 0;
+    queue.timeout_ms = static_cast<long long>(seconds) * 1000;
+  }
+  if (!ok)
+    return "Error: \"" + line + "\" Invalid CGI queue option";
+  return "";
+}
+
+static bool is_cache(const std::string &line) {
+  std::string name = line.substr(0, line.find(' '));
+  return name == "cache" || name == "cache_stale";
+}
+
+// `cache SECONDS` and `cache_stale SECONDS`
+std::string Config_CGI::parse_cache(const std::string &line) {
+  std::vector<std::string> data = string_split(line, " ");
+  bool ok = data.size() == 2;
+
+  if (ok && data[0] == "cache")
+    ok = parse_count(data[1], cache.ttl);
+  else if (ok)
+    ok = parse_count(data[1], cache.stale);
+  if (!ok)
+    return "Error: \"" + line + "\" Invalid CGI cache option";
+  return "";
+}
+
 static bool is_key(const std::string &key) {
   if (key.empty())
     return false;
@@ -4,23 +4,85 @@
 #include "ParsingUtils.hpp"
 #include "file_descriptor.h"
 #include "http_1_1.h"
+#include <cstdlib>
 #include <sstream>
 #include <sys/stat.h>
 #include <unistd.h>
 
+// Pooled mode: long-lived workers instead of one process per request
+struct CgiPoolOptions {
+  unsigned int min_workers;  // started up front and kept while idle
+  unsigned int max_workers;  // 0 runs the script as plain CGI/1.1
+  unsigned int max_requests; // requests before a worker is replaced, 0: never
+  unsigned int idle_timeout; // seconds before an idle worker above min exits
+
+  CgiPoolOptions()
+      : min_workers(0), max_workers(0), max_requests(0), idle_timeout(60) {}
+  bool operator==(const CgiPoolOptions &other) const {
+    return min_workers == other.min_workers &&
+           max_workers == other.max_workers &&
+           max_requests == other.max_requests &&
+           idle_timeout == other.idle_timeout;
+  }
+};
+
+// Admission control: requests over `concurrency` wait in a FIFO queue
+struct CgiQueueOptions {
+  unsigned int concurrency; // requests running at once, 0: only max_cgi
+  unsigned int max_waiting; // queued requests, then 503
+  long long timeout_ms;     // time in the queue before a 503
+
+  CgiQueueOptions() : concurrency(0), max_waiting(64), timeout_ms(5000) {}
+  bool operator==(const CgiQueueOptions &other) const {
+    return concurrency == other.concurrency &&
+           max_waiting == other.max_waiting && timeout_ms == other.timeout_ms;
+  }
+};
+
+// Micro-cache of GET responses: used for responses that carry no freshness of
+// their own (Cache-Control, Expires); a route without `cache` is never cached
+struct CgiCacheOptions {
+  unsigned int ttl;   // seconds a response stays fresh, 0: no caching
+  unsigned int stale; // seconds it may then be served while it is refreshed
+
+  CgiCacheOptions() : ttl(0), stale(0) {}
+};
+
 class Config_CGI {
 private:
   std::string executable;
   std::map<std::string, std::string> env;
+  std::string env_block;
   double timeout;
+  int max_body_kb; // `->{} SIZE`, like the option of a static route
+  CgiPoolOptions pool;
+  CgiQueueOptions queue;
+  CgiCacheOptions cache;
   std::string err;
 
   std::string parse_env(const std::string &);
+  std::string parse_pool(const std::string &);
+  std::string parse_queue(const std::string &);
+  std::string parse_cache(const std::string &);
   std::string parse_CGI(FileDescriptor &fd, std::string line);
 
 public:
-  Config_CGI() : executable(""), timeout(-1), err("No parse"){};
+  Config_CGI() : executable(""), timeout(-1), max_body_kb(1), err("No parse"){};
   Config_CGI(FileDescriptor &fd, std::string);
+
+  const std::string &Get_executable(void) const { return executable; }
+  const std::map<std::string, std::string> &Get_env(void) const { return env; }
+  // env as NAME=VALUE entries each ending in '\0', serialized once so that
+  // requests only copy it (EnvBlock::add_block())
+  const std::string &Get_env_block(void) const { return env_block; }
+  // Seconds the script may run before it is killed
+  double Get_timeout(void) const { return timeout; }
+  // Largest request body taken, in KB (1 by default)
+  int Get_maxBodyKB(void) const { return max_body_kb; }
+  const CgiPoolOptions &Get_pool(void) const { return pool; }
+  const CgiQueueOptions &Get_queue(void) const { return queue; }
+  const CgiCacheOptions &Get_cache(void) const { return cache; }
+  const std::string &Get_err(void) const { return err; }
 };
 
 #endif
\ No newline at end of file
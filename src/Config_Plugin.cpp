@@ -0,0 +1,56 @@
+#include "Config_Plugin.hpp"
+
+Config_Plugin::Config_Plugin(FileDescriptor &fd, const std::string &line)
+    : library(), config(), offload(false), max_body_kb(1), err() {
+  err = parse_Plugin(fd, line);
+}
+
+static bool is_library(const std::string &path) {
+  struct stat st;
+
+  if (path.length() <= 3 || path.substr(path.length() - 3) != ".so")
+    return false;
+  return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+         access(path.c_str(), R_OK) == 0;
+}
+
+std::string Config_Plugin::parse_Plugin(FileDescriptor &fd,
+                                        const std::string &line) {
+  if (line.length() < 2 || line[0] != '&' || is_have_space(line) ||
+      !is_library(line.substr(1)))
+    return "Plugin Error: \"" + line + "\" shared object not found";
+  library = line.substr(1);
+  while (true) {
+    Result<std::string> temp = fd.read_file_line();
+    if (temp.error() != "")
+      return "FileDescriptor Error: " + temp.error();
+    else if (temp.value() == "\n" || temp.value() == "")
+      return "";
+    std::string file_line = trim_char(temp.value(), '\n');
+    if (is_tab_or_space(file_line, 2) == false ||
+        (file_line.empty() || file_line[file_line.length() - 1] == ' ' ||
+         file_line[file_line.length() - 1] == '\t'))
+      return "Error: \"" + file_line + "\" Indentation or space error";
+    file_line = trim_space(file_line);
+    if (file_line == "offload")
+      offload = true;
+    else if (file_line.compare(0, 5, "->{} ") == 0) {
+      max_body_kb = maxBodyKB_parse(file_line.substr(5));
+      if (max_body_kb == -1)
+        return "Error: \"" + file_line + "\" Invalid body size";
+    } else if (file_line.find('=') != std::string::npos &&
+             file_line.find('=') > 0 && !is_have_space(file_line))
+      config.push_back(file_line);
+    else
+      return "Error: \"" + file_line + "\" Invalid plugin option";
+  }
+}
+
+std::string Config_Plugin::Get_key(void) const {
+  std::string key = library;
+  for (size_t i = 0; i < config.size(); ++i) {
+    key += '\0';
+    key += config[i];
+  }
+  return key;
+}
@@ -0,0 +1,39 @@
+#ifndef CONFIG_PLUGIN_HPP
+#define CONFIG_PLUGIN_HPP
+
+#include "ParsingUtils.hpp"
+#include "file_descriptor.h"
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// `METHOD PATH &library.so`, followed by `offload`, `->{} SIZE` and KEY=VALUE
+// lines
+class Config_Plugin {
+private:
+  std::string library;
+  std::vector<std::string> config; // KEY=VALUE, in the order given
+  bool offload;
+  int max_body_kb; // `->{} SIZE`, like the option of a static route
+  std::string err;
+
+  std::string parse_Plugin(FileDescriptor &fd, const std::string &line);
+
+public:
+  Config_Plugin()
+      : library(), config(), offload(false), max_body_kb(1), err("No parse") {}
+  Config_Plugin(FileDescriptor &fd, const std::string &line);
+
+  const std::string &Get_library(void) const { return library; }
+  const std::vector<std::string> &Get_config(void) const { return config; }
+  // handle() runs on the plugin worker threads instead of the event loop
+  bool Get_offload(void) const { return offload; }
+  // Largest request body taken, in KB (1 by default)
+  int Get_maxBodyKB(void) const { return max_body_kb; }
+  // Routes with the same library and config share one plugin instance
+  std::string Get_key(void) const;
+  const std::string &Get_err(void) const { return err; }
+};
+
+#endif
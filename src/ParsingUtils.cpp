@@ -85,3 +85,61 @@ std::string trim_char(std::string s, char ch) {
 
   return (s);
 }
+
+// Parses a count with an optional KB/MB/GB (or KiB/MiB/GiB) suffix, both
+// meaning powers of 1024
+bool size_parse(const std::string &value, size_t &out) {
+  size_t i = 0;
+  size_t number = 0;
+
+  for (; i < value.size(); ++i) {
+    if (!std::isdigit(static_cast<unsigned char>(value[i])))
+      break;
+    if (number > (static_cast<size_t>(-1) - 9) / 10)
+      return (false);
+    number = number * 10 + static_cast<size_t>(value[i] - '0');
+  }
+  if (i == 0)
+    return (false);
+  std::string unit = value.substr(i);
+  size_t scale = 1;
+  if (unit.empty())
+    scale = 1;
+  else if (unit == "KB" || unit == "KiB")
+    scale = 1024;
+  else if (unit == "MB" || unit == "MiB")
+    scale = 1024 * 1024;
+  else if (unit == "GB" || unit == "GiB")
+    scale = 1024 * 1024 * 1024;
+  else
+    return (false);
+  if (number > static_cast<size_t>(-1) / scale)
+    return (false);
+  out = number * scale;
+  return (true);
+}
+
+// Body size of a `->{} SIZE` line in KB (MB meaning 1000 KB), or -1
+int maxBodyKB_parse(std::string line) {
+  size_t i = 0;
+  int maxbody = 0;
+  for (; i < line.size(); ++i) {
+    if (!std::isdigit(static_cast<unsigned char>(line[i])))
+      break;
+    if (maxbody > (INT_MAX - 9) / 10)
+      return (-1);
+    maxbody = maxbody * 10 + (line[i] - '0');
+  }
+  if (i <= 0)
+    return (-1);
+  line = line.substr(i);
+  if (line != "" && line != "KB" && line != "KiB" && maxbody > INT_MAX / 1024)
+    return (-1);
+  if (line.empty() || line == "KB" || line == "KiB")
+    return (maxbody);
+  else if (line == "MB")
+    return (maxbody * 1000);
+  else if (line == "MiB")
+    return (maxbody * 1024);
+  return (-1);
+}
@@ -12,5 +12,7 @@ std::vector<std::string> string_split(const std::string &line,
 bool is_have_special(const std::string &line, const std::string &allowed);
 int number_of_delim(const std::string &line, const std::string &delim);
 std::string trim_char(std::string s, char ch);
+bool size_parse(const std::string &value, size_t &out);
+int maxBodyKB_parse(std::string line);
 
 #endif
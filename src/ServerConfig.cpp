@@ -132,7 +132,8 @@ std::string PathPattern::toString() const {
   return result;
 }
 
-ServerConfig::ServerConfig(FileDescriptor &file) {
+ServerConfig::ServerConfig(FileDescriptor &file, bool unix_socket)
+    : unix_socket(unix_socket) {
   err_line = "";
   serverResponseTime = 3;
   end_flag = 0;
@@ -168,7 +169,16 @@ bool ServerConfig::set_ServerConfig(FileDescriptor &fd) {
         }
       } else if (is_serverResponseTime(line))
         parse_serverResponseTime(line);
-      else if (is_RouteRule(line)) {
+      else if (is_ListenOption(line)) {
+        if (!applies_ListenOption(line)) {
+          err_line = "Listen option misplaced Error: " + line;
+          return (false);
+        }
+        if (!parse_ListenOption(line)) {
+          err_line = "Listen option syntax Error: " + line;
+          return (false);
+        }
+      } else if (is_RouteRule(line)) {
         if (!parse_RouteRule(line, fd)) {
           err_line = "RouteRule syntax Error: " + err_line;
           return (false);
@@ -291,6 +301,87 @@ void ServerConfig::parse_serverResponseTime(std::string line) {
   oss >> serverResponseTime;
 }
 
+// ListenOptions method
+static const char *const listen_option_names[] = {
+    "listen", "backlog", "tcp_nodelay", "tcp_defer_accept",
+    "tcp_fastopen", "rcvbuf", "sndbuf", "reuseport", "mode", NULL};
+
+bool ServerConfig::is_ListenOption(const std::string &line) {
+  std::vector<std::string> split = string_split(line, " ");
+
+  if (split.empty())
+    return (false);
+  for (size_t i = 0; listen_option_names[i] != NULL; ++i) {
+    if (split[0] == listen_option_names[i])
+      return (true);
+  }
+  return (false);
+}
+
+// A unix socket takes backlog, the buffer sizes and mode; a TCP one takes
+// everything but mode
+bool ServerConfig::applies_ListenOption(const std::string &line) const {
+  std::string name = string_split(line, " ")[0];
+
+  if (name == "backlog" || name == "rcvbuf" || name == "sndbuf")
+    return (true);
+  return ((name == "mode") == unix_socket);
+}
+
+static bool switch_parse(const std::string &value, bool &out) {
+  if (value == "on")
+    out = true;
+  else if (value == "off")
+    out = false;
+  else
+    return (false);
+  return (true);
+}
+
+bool ServerConfig::parse_ListenOption(const std::string &line) {
+  std::vector<std::string> split = string_split(line, " ");
+  const std::string &name = split[0];
+  size_t value = 0;
+
+  if (split.size() != 2)
+    return (false);
+  if (name == "listen")
+    return (inet_pton(AF_INET, split[1].c_str(), &listen.address) == 1);
+  if (name == "tcp_nodelay")
+    return (switch_parse(split[1], listen.tcp_nodelay));
+  if (name == "reuseport")
+    return (switch_parse(split[1], listen.reuseport));
+  if (name == "mode") {
+    // octal permission bits, e.g. 0660
+    const std::string &digits = split[1];
+    listen.mode = 0;
+    if (digits.size() > 4)
+      return (false);
+    for (size_t i = 0; i < digits.size(); ++i) {
+      if (digits[i] < '0' || digits[i] > '7')
+        return (false);
+      listen.mode =
+          listen.mode * 8 + static_cast<unsigned int>(digits[i] - '0');
+    }
+    return (listen.mode > 0 && listen.mode <= 0777);
+  }
+  if (!size_parse(split[1], value) || value > INT_MAX)
+    return (false);
+  if (name == "backlog" && value > 0 && value <= USHRT_MAX)
+    listen.backlog = static_cast<int>(value);
+  else if (name == "tcp_defer_accept")
+    listen.tcp_defer_accept = static_cast<int>(value);
+  else if (name == "tcp_fastopen")
+    listen.tcp_fastopen = static_cast<int>(value);
+  else if (name == "rcvbuf")
+    listen.rcvbuf = static_cast<int>(value);
+  else if (name == "sndbuf")
+    listen.sndbuf = static_cast<int>(value);
+  else
+    return (false);
+  return (true);
+}
+
 // RouteRule method
 
 static bool is_pattern(std::string line) {
@@ -404,8 +495,12 @@ bool ServerConfig::is_RouteRule(std::string line) {
   if (std::isspace(static_cast<unsigned char>(line[line.size() - 1])))
     return (false);
   std::vector<std::string> split = string_split(line, " ");
-  if (split.size() != 4 || parse_RuleOperator(split[2]) == UNDEFINED ||
-      !is_url(split[1]) || !is_url(split[3])) // 크기 확인, op확인
+  if (split.size() == 3 && (split[2][0] == '$' || split[2][0] == '&')) {
+    // METHOD PATH $script, METHOD PATH &library.so
+    if (!is_url(split[1]))
+      return (false);
+  } else if (split.size() != 4 || parse_RuleOperator(split[2]) == UNDEFINED ||
+             !is_url(split[1]) || !is_url(split[3])) // 크기 확인, op확인
     return (false);
 
   std::vector<std::string> method = string_split(split[0], "|");
@@ -422,26 +517,6 @@ bool ServerConfig::is_RouteRule(std::string line) {
   return (true);
 }
 
-static int maxBodyKB_parse(std::string line) {
-  size_t i = 0;
-  int maxbody = 0;
-  for (; i < line.size(); ++i) {
-    if (!std::isdigit(static_cast<unsigned char>(line[i])))
-      break;
-    maxbody = maxbody * 10 + (line[i] - '0');
-  }
-  if (i <= 0)
-    return (-1);
-  line = line.substr(i);
-  if (line.empty() || line == "KB" || line == "KiB")
-    return (maxbody);
-  else if (line == "MB")
-    return (maxbody * 1000);
-  else if (line == "MiB")
-    return (maxbody * 1024);
-  return (-1);
-}
-
 static std::string index_parse(std::string line) {
   size_t i = 0;
   for (; i < line.size(); ++i) {
@@ -682,6 +757,10 @@ bool ServerConfig::parse_RouteRule(std::string method_line,
       return (false);
   }
 
+  if (method_line_data.size() == 3 && method_line_data[2][0] == '&')
+    return (parse_PluginRule(method_line_data, mets, fd));
+  if (method_line_data.size() == 3)
+    return (parse_CgiRule(method_line_data, mets, fd));
   if (!parse_Httpmethod(method_line_data, mets))
     return (false);
 
@@ -708,6 +787,67 @@ bool ServerConfig::parse_RouteRule(std::string method_line,
   return (true);
 }
 
+// `METHOD PATH $script(KEY=VALUE)`, followed by the Config_CGI option lines
+bool ServerConfig::parse_CgiRule(std::vector<std::string> data,
+                                 std::vector<Http::Method> mets,
+                                 FileDescriptor &fd) {
+  Config_CGI cgi(fd, data[2]);
+
+  // Config_CGI reads its options up to and including the blank line
+  end_flag += 1;
+  if (cgi.Get_err() != "") {
+    err_line = cgi.Get_err();
+    return (false);
+  }
+  // `$PORT` or `$unix:/path` names a backend of the uwsgi block instead of a
+  // script
+  const std::string &exe = cgi.Get_executable();
+  bool uwsgi = exe.find_first_not_of("0123456789") == std::string::npos ||
+               exe.compare(0, 6, "unix:/") == 0;
+  if (uwsgi && cgi.Get_pool().max_workers > 0) {
+    err_line = data[2] + " workers don't apply to uWSGI routes";
+    return (false);
+  }
+  for (size_t i = 0; i < mets.size(); ++i) {
+    RouteRule route;
+    route.method = mets[i];
+    route.path = PathPattern(data[1]);
+    route.status_code = 200;
+    route.op = uwsgi ? UWSGI : CGI;
+    route.maxBodyKB = cgi.Get_maxBodyKB();
+    route.cgi = cgi;
+    routes.push_back(route);
+  }
+  err_line = "";
+  return (true);
+}
+
+// `METHOD PATH &library.so`, followed by the Config_Plugin option lines
+bool ServerConfig::parse_PluginRule(std::vector<std::string> data,
+                                    std::vector<Http::Method> mets,
+                                    FileDescriptor &fd) {
+  Config_Plugin plugin(fd, data[2]);
+
+  // Config_Plugin reads its options up to and including the blank line
+  end_flag += 1;
+  if (plugin.Get_err() != "") {
+    err_line = plugin.Get_err();
+    return (false);
+  }
+  for (size_t i = 0; i < mets.size(); ++i) {
+    RouteRule route;
+    route.method = mets[i];
+    route.path = PathPattern(data[1]);
+    route.status_code = 200;
+    route.op = PLUGIN;
+    route.maxBodyKB = plugin.Get_maxBodyKB();
+    route.plugin = plugin;
+    routes.push_back(route);
+  }
+  err_line = "";
+  return (true);
+}
+
 // Find a route that matches the given method and path
 RouteRule const *ServerConfig::findRoute(Http::Method method,
                                          const std::string &path) const {
@@ -750,6 +890,12 @@ static std::string what_RuleOperator(RuleOperator op) {
     return ("AUTOINDEX (<i-)");
   else if (op == POINT)
     return ("POINT (->)");
+  else if (op == CGI)
+    return ("CGI ($)");
+  else if (op == UWSGI)
+    return ("UWSGI ($PORT, $unix:/path)");
+  else if (op == PLUGIN)
+    return ("PLUGIN (&)");
   else
     return ("SERVEFROM (<-)");
 }
@@ -758,6 +904,18 @@ std::ostream &operator<<(std::ostream &os, const ServerConfig &data) {
   os << "Server Response Time(s): " << data.Get_ServerResponseTime()
      << std::endl;
 
+  const ListenOptions &listen = data.Get_Listen();
+  os << "\nListen" << std::endl;
+  os << "\taddress: " << inet_ntoa(listen.address) << std::endl;
+  os << "\tbacklog: " << listen.backlog << std::endl;
+  os << "\ttcp_nodelay: " << listen.tcp_nodelay << std::endl;
+  os << "\ttcp_defer_accept: " << listen.tcp_defer_accept << std::endl;
+  os << "\ttcp_fastopen: " << listen.tcp_fastopen << std::endl;
+  os << "\trcvbuf: " << listen.rcvbuf << std::endl;
+  os << "\tsndbuf: " << listen.sndbuf << std::endl;
+  os << "\treuseport: " << listen.reuseport << std::endl;
+  os << "\tmode: " << std::oct << listen.mode << std::dec << std::endl;
+
   const Header &header = data.Get_Header();
   Header::const_iterator header_it;
   os << "\nHeader";
@@ -803,6 +961,21 @@ std::ostream &operator<<(std::ostream &os, const ServerConfig &data) {
            ++err_it)
         os << "\n\tError Page: " << err_it->first << " " << err_it->second;
     }
+    if (route.op == CGI || route.op == UWSGI) {
+      os << "\n\tCGI: " << route.cgi.Get_executable()
+         << "\n\tCGI Timeout(s): " << route.cgi.Get_timeout();
+      const std::map<std::string, std::string> &env = route.cgi.Get_env();
+      std::map<std::string, std::string>::const_iterator env_it;
+      for (env_it = env.begin(); env_it != env.end(); ++env_it)
+        os << "\n\tCGI Env: " << env_it->first << "=" << env_it->second;
+    }
+    if (route.op == PLUGIN) {
+      os << "\n\tPlugin: " << route.plugin.Get_library()
+         << (route.plugin.Get_offload() ? " (offload)" : "");
+      const std::vector<std::string> &conf = route.plugin.Get_config();
+      for (size_t i = 0; i < conf.size(); ++i)
+        os << "\n\tPlugin Config: " << conf[i];
+    }
   }
   os << "\n========================================================";
   return (os);
@@ -1,10 +1,13 @@
 #ifndef SERVERCONFIG_HPP
 #define SERVERCONFIG_HPP
 
+#include "Config_CGI.hpp"
+#include "Config_Plugin.hpp"
 #include "ParsingUtils.hpp"
 #include "file_descriptor.h"
 #include "http_1_1.h"
 #include <iosfwd>
+#include <netinet/in.h>
 #include <unistd.h>
 
 typedef std::map<std::string, std::map<std::string, std::string> > Header;
@@ -21,6 +24,9 @@ enum RuleOperator {
   AUTOINDEX,         // <i-
   POINT,             // ->
   SERVEFROM,         // <-
+  CGI,               // $script.cgi
+  UWSGI,             // $PORT or $unix:/path, a backend of the uwsgi block
+  PLUGIN,            // &library.so
   UNDEFINED,
 };
 
@@ -55,12 +61,36 @@ struct RouteRule {
   std::string authInfo;
   int maxBodyKB;
   std::map<int, std::string> errorPages;
+
+  Config_CGI cgi;       // script of a CGI route, backend of a uWSGI route
+  Config_Plugin plugin; // shared object of a plugin route
+};
+
+// Listening socket tuning of one server block; 0 keeps the system default
+struct ListenOptions {
+  struct in_addr address; // bind address, INADDR_ANY by default
+  int backlog;            // listen() queue length, SOMAXCONN by default
+  bool tcp_nodelay;       // inherited by accepted sockets
+  int tcp_defer_accept;   // seconds to wait for the first request bytes
+  int tcp_fastopen;       // TFO pending queue length
+  int rcvbuf;             // SO_RCVBUF bytes
+  int sndbuf;             // SO_SNDBUF bytes
+  bool reuseport;
+  unsigned int mode; // permissions of a unix socket file, 0 keeps the umask
+
+  ListenOptions()
+      : backlog(0), tcp_nodelay(false), tcp_defer_accept(0), tcp_fastopen(0),
+        rcvbuf(0), sndbuf(0), reuseport(false), mode(0) {
+    address.s_addr = htonl(INADDR_ANY);
+  }
 };
 
 class ServerConfig {
 private:
   Header header;
   int serverResponseTime;
+  ListenOptions listen;
+  bool unix_socket; // the block is a `unix:/path =` listener
   std::vector<RouteRule> routes;
   std::string err_line;
   int end_flag;
@@ -74,10 +104,18 @@ private:
   // serverResponseTime method
   bool is_serverResponseTime(std::string &line);
   void parse_serverResponseTime(std::string line);
+  // ListenOptions method
+  bool is_ListenOption(const std::string &line);
+  bool applies_ListenOption(const std::string &line) const;
+  bool parse_ListenOption(const std::string &line);
   // RouteRule method
   bool is_RouteRule(std::string line);
   bool is_matching(PathPattern path, PathPattern root);
   bool parse_RouteRule(std::string line, FileDescriptor &fd);
+  bool parse_CgiRule(std::vector<std::string> data,
+                     std::vector<Http::Method> mets, FileDescriptor &fd);
+  bool parse_PluginRule(std::vector<std::string> data,
+                        std::vector<Http::Method> mets, FileDescriptor &fd);
   bool parse_Httpmethod(std::vector<std::string> data,
                         std::vector<Http::Method> mets);
   bool parse_Rule(std::vector<Http::Method> met, std::string key,
@@ -87,11 +125,13 @@ private:
                          PathPattern to) const;
 
 public:
-  ServerConfig(FileDescriptor &);
+  ServerConfig(FileDescriptor &, bool unix_socket = false);
   ServerConfig()
-      : header(), serverResponseTime(-1), routes(), err_line(), end_flag(0) {}
+      : header(), serverResponseTime(-1), listen(), unix_socket(false),
+        routes(), err_line(), end_flag(0) {}
   const Header &Get_Header(void) const { return header; }
   int Get_ServerResponseTime(void) const { return (serverResponseTime); }
+  const ListenOptions &Get_Listen(void) const { return listen; }
   const std::vector<RouteRule> &Get_Routes(void) const { return routes; }
   RouteRule const *findRoute(Http::Method method,
                              const std::string &path) const;
@@ -27,9 +27,18 @@ bool WebserverConfig::file_parsing(FileDescriptor &file) {
     if (line == "types =" || line == "types=") {
       if (!set_type_map(file))
         return (false);
+    } else if (line == "limits =" || line == "limits=") {
+      if (!set_limits(file))
+        return (false);
+    } else if (line == "uwsgi =" || line == "uwsgi=") {
+      if (!set_uwsgi_map(file))
+        return (false);
     } else if (is_ServerConfig(line)) {
       if (!set_ServerConfig_map(file, line))
         return (false);
+    } else if (is_UnixServerConfig(line)) {
+      if (!set_UnixServerConfig_map(file, line))
+        return (false);
     } else {
       err_meg = "Invalid line Error: " + line;
       return (false);
@@ -37,6 +46,16 @@ bool WebserverConfig::file_parsing(FileDescriptor &file) {
   }
   if (this->type_map.empty() || this->default_mime.length() == 0)
     return (false);
+  for (std::map<unsigned int, ServerConfig>::const_iterator it =
+           ServerConfig_map.begin();
+       it != ServerConfig_map.end(); ++it)
+    if (!check_uwsgi_routes(it->second))
+      return (false);
+  for (std::map<std::string, ServerConfig>::const_iterator it =
+           UnixServerConfig_map.begin();
+       it != UnixServerConfig_map.end(); ++it)
+    if (!check_uwsgi_routes(it->second))
+      return (false);
   return (true);
 }
 
@@ -145,6 +164,217 @@ bool WebserverConfig::set_type_map(FileDescriptor &file) {
   return (true);
 }
 
+// limits method
+bool WebserverConfig::parse_limit_line(const std::string &line) {
+  std::vector<std::string> data = string_split(trim_space(line), " ");
+  size_t value;
+
+  if (data.size() == 2 && data[0] == "metrics") {
+    limits.metrics = data[1];
+    return (data[1][0] == '/');
+  }
+  if (data.size() != 2 || !size_parse(data[1], value))
+    return (false);
+  if (data[0] == "max_buffered") {
+    limits.max_buffered = value;
+    return (true);
+  }
+  if (data[0] == "cgi_cache") {
+    limits.cgi_cache = value;
+    return (true);
+  }
+  // The remaining limits are plain counts without a size unit
+  if (!std::isdigit(static_cast<unsigned char>(data[1][data[1].size() - 1])) ||
+      value > UINT_MAX)
+    return (false);
+  unsigned int count = static_cast<unsigned int>(value);
+  if (data[0] == "accept_batch" && count > 0)
+    limits.accept_batch = count;
+  else if (data[0] == "max_connections" && count > 0)
+    limits.max_connections = count;
+  else if (data[0] == "retry_after")
+    limits.retry_after = count;
+  else if (data[0] == "max_cgi")
+    limits.max_cgi = count;
+  else if (data[0] == "max_cgi_queued")
+    limits.max_cgi_queued = count;
+  else if (data[0] == "plugin_threads" && count > 0)
+    limits.plugin_threads = count;
+  else
+    return (false);
+  return (true);
+}
+
+bool WebserverConfig::set_limits(FileDescriptor &file) {
+  std::string line;
+
+  while (true) {
+    Result<std::string> temp = file.read_file_line();
+    if (temp.error() != "") {
+      err_meg = "FileDescriptor Error: " + temp.error();
+      return (false);
+    }
+    if (temp.value() == "\n" || temp.value() == "")
+      break;
+    line = trim_char(temp.value(), '\n');
+    if (!is_tab_or_space(temp.value(), 1) || !parse_limit_line(line)) {
+      err_meg = "Limits syntax Error: " + trim_space(line);
+      return (false);
+    }
+  }
+  return (true);
+}
+
+// uwsgi method
+// PORT (on the loopback), HOST:PORT or unix:/path.sock. The address is
+// resolved here, once, rather than for every request; a socket file may only
+// appear once the backend is started.
+static bool parse_uwsgi_address(const std::string &address,
+                                UwsgiAddress &instance) {
+  instance.address = address;
+  if (address.compare(0, 6, "unix:/") == 0) {
+    std::string path = address.substr(5);
+    struct sockaddr_un *addr =
+        reinterpret_cast<struct sockaddr_un *>(&instance.addr);
+    if (path.length() >= sizeof(addr->sun_path) ||
+        path.find_first_of("()") != std::string::npos)
+      return (false);
+    addr->sun_family = AF_UNIX;
+    std::memcpy(addr->sun_path, path.c_str(), path.length());
+    instance.addr_len = sizeof(struct sockaddr_un);
+    return (true);
+  }
+  std::string host = "127.0.0.1";
+  std::string port = address;
+  if (port.find(':') != std::string::npos) {
+    host = port.substr(0, port.rfind(':'));
+    port = port.substr(port.rfind(':') + 1);
+    if (host.length() > 2 && host[0] == '[' && host[host.length() - 1] == ']')
+      host = host.substr(1, host.length() - 2);
+  }
+  if (host.empty() || port.empty() || port.length() > 5 ||
+      port.find_first_not_of("0123456789") != std::string::npos ||
+      std::atoi(port.c_str()) == 0 || std::atoi(port.c_str()) > 65535)
+    return (false);
+
+  struct addrinfo hints, *res = NULL;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0)
+    return (false);
+  std::memcpy(&instance.addr, res->ai_addr, res->ai_addrlen);
+  instance.addr_len = res->ai_addrlen;
+  freeaddrinfo(res);
+  return (true);
+}
+
+// `/script.py:ADDRESS`. Returns the new backend, NULL on error.
+UwsgiBackend *WebserverConfig::parse_uwsgi_line(const std::string &line) {
+  std::string data = trim_space(line);
+  size_t colon = data.find(':');
+  if (colon == std::string::npos || colon == 0 || is_have_space(data))
+    return (NULL);
+  UwsgiBackend backend;
+  UwsgiAddress instance;
+  backend.script = data.substr(0, colon);
+  backend.address = data.substr(colon + 1);
+  if (!parse_uwsgi_address(backend.address, instance) ||
+      uwsgi_map.find(backend.address) != uwsgi_map.end())
+    return (NULL);
+  backend.instances.push_back(instance);
+  return (&(uwsgi_map[backend.address] = backend));
+}
+
+// The pool and balancing options under a backend line: `keepalive N`,
+// `keepalive_timeout S`, `instance ADDRESS`, `balance p2c|least`,
+// `max_fails N`, `fail_timeout S` and `health_interval S`
+bool WebserverConfig::parse_uwsgi_option(const std::string &line,
+                                         UwsgiBackend &backend) {
+  std::vector<std::string> data = string_split(trim_space(line), " ");
+  if (data.size() != 2)
+    return (false);
+  if (data[0] == "instance") {
+    UwsgiAddress instance;
+    for (size_t i = 0; i < backend.instances.size(); ++i)
+      if (backend.instances[i].address == data[1])
+        return (false);
+    if (!parse_uwsgi_address(data[1], instance))
+      return (false);
+    backend.instances.push_back(instance);
+    return (true);
+  }
+  if (data[0] == "balance") {
+    if (data[1] == "p2c")
+      backend.balance = UwsgiBackend::POWER_OF_TWO;
+    else if (data[1] == "least")
+      backend.balance = UwsgiBackend::LEAST_OUTSTANDING;
+    else
+      return (false);
+    return (true);
+  }
+  if (data[1].length() > 9 ||
+      data[1].find_first_not_of("0123456789") != std::string::npos)
+    return (false);
+  unsigned int value =
+      static_cast<unsigned int>(std::strtoul(data[1].c_str(), NULL, 10));
+  if (data[0] == "keepalive")
+    backend.keepalive = value;
+  else if (data[0] == "keepalive_timeout" && value > 0)
+    backend.keepalive_timeout = value;
+  else if (data[0] == "max_fails")
+    backend.max_fails = value;
+  else if (data[0] == "fail_timeout" && value > 0)
+    backend.fail_timeout = value;
+  else if (data[0] == "health_interval")
+    backend.health_interval = value;
+  else
+    return (false);
+  return (true);
+}
+
+bool WebserverConfig::set_uwsgi_map(FileDescriptor &file) {
+  std::string line;
+  UwsgiBackend *last = NULL;
+
+  while (true) {
+    Result<std::string> temp = file.read_file_line();
+    if (temp.error() != "") {
+      err_meg = "FileDescriptor Error: " + temp.error();
+      return (false);
+    }
+    if (temp.value() == "\n" || temp.value() == "")
+      break;
+    line = trim_char(temp.value(), '\n');
+    bool ok;
+    if (is_tab_or_space(line, 1))
+      ok = (last = parse_uwsgi_line(line)) != NULL;
+    else
+      ok = last != NULL && is_tab_or_space(line, 2) &&
+           parse_uwsgi_option(line, *last);
+    if (!ok) {
+      err_meg = "uwsgi syntax Error: " + trim_space(line);
+      return (false);
+    }
+  }
+  return (true);
+}
+
+// Every `$PORT` and `$unix:/path` route must name a backend of the uwsgi
+// block, which may come after the server blocks
+bool WebserverConfig::check_uwsgi_routes(const ServerConfig &server) {
+  const std::vector<RouteRule> &routes = server.Get_Routes();
+  for (size_t i = 0; i < routes.size(); ++i) {
+    if (routes[i].op == UWSGI &&
+        uwsgi_map.find(routes[i].cgi.Get_executable()) == uwsgi_map.end()) {
+      err_meg = "uwsgi syntax Error: $" + routes[i].cgi.Get_executable() +
+                " is not in the uwsgi block";
+      return (false);
+    }
+  }
+  return (true);
+}
+
 // ServerConfig method
 bool WebserverConfig::is_ServerConfig(const std::string &line) {
   std::size_t i = 1;
@@ -197,6 +427,35 @@ unsigned int WebserverConfig::parse_ServerConfig_key(std::string &key) {
       std::atoi(key.substr(start, i - start).c_str()));
 }
 
+// `unix:/absolute/path.sock =`
+bool WebserverConfig::is_UnixServerConfig(const std::string &line) {
+  if (line.compare(0, 6, "unix:/") != 0)
+    return (false);
+  std::string path = line.substr(5);
+  if (path.length() < 2 || path[path.length() - 1] != '=')
+    return (false);
+  path = trim_space(path.substr(0, path.length() - 1));
+  return (!path.empty() && !is_have_space(path) &&
+          line.length() - 5 - path.length() <= 2);
+}
+
+bool WebserverConfig::set_UnixServerConfig_map(FileDescriptor &file,
+                                               const std::string &line) {
+  std::string path = trim_space(line.substr(5, line.length() - 6));
+  ServerConfig config(file, true);
+
+  if (config.Geterr_line() != "") {
+    err_meg = line + " " + config.Geterr_line();
+    return (false);
+  }
+  if (UnixServerConfig_map.find(path) != UnixServerConfig_map.end()) {
+    err_meg = "Server block declared Error: " + line;
+    return (false);
+  }
+  UnixServerConfig_map[path] = config;
+  return (true);
+}
+
 std::ostream &operator<<(std::ostream &os, const WebserverConfig &data) {
   const std::map<std::string, std::string> &ty = data.Get_Type_map();
   std::map<std::string, std::string>::const_iterator ty_it;
@@ -209,6 +468,37 @@ std::ostream &operator<<(std::ostream &os, const WebserverConfig &data) {
   }
   os << "default_mime: " << data.Get_default_mime() << std::endl;
   os << "========================================================" << std::endl;
+  const ServerLimits &limits = data.Get_Limits();
+  os << "Limits\n" << std::endl;
+  os << "accept_batch: " << limits.accept_batch << std::endl;
+  os << "max_connections: " << limits.max_connections << std::endl;
+  os << "max_buffered: " << limits.max_buffered << std::endl;
+  os << "retry_after: " << limits.retry_after << std::endl;
+  os << "max_cgi: " << limits.max_cgi << std::endl;
+  os << "max_cgi_queued: " << limits.max_cgi_queued << std::endl;
+  os << "cgi_cache: " << limits.cgi_cache << std::endl;
+  os << "plugin_threads: " << limits.plugin_threads << std::endl;
+  os << "metrics: " << limits.metrics << std::endl;
+  os << "========================================================" << std::endl;
+  const std::map<std::string, UwsgiBackend> &uwsgi = data.Get_Uwsgi_map();
+  os << "uwsgi\n" << std::endl;
+  for (std::map<std::string, UwsgiBackend>::const_iterator it = uwsgi.begin();
+       it != uwsgi.end(); ++it) {
+    const UwsgiBackend &backend = it->second;
+    os << backend.script << " -> " << it->first
+       << " (keepalive: " << backend.keepalive << ", "
+       << backend.keepalive_timeout << "s)" << std::endl;
+    for (size_t i = 1; i < backend.instances.size(); ++i)
+      os << "    instance " << backend.instances[i].address << std::endl;
+    if (backend.instances.size() > 1)
+      os << "    balance: "
+         << (backend.balance == UwsgiBackend::POWER_OF_TWO ? "p2c" : "least")
+         << ", max_fails: " << backend.max_fails
+         << ", fail_timeout: " << backend.fail_timeout << "s" << std::endl;
+    os << "    health_interval: " << backend.health_interval << "s"
+       << std::endl;
+  }
+  os << "========================================================" << std::endl;
   const std::map<unsigned int, ServerConfig> &Server_map =
       data.Get_ServerConfig_map();
   std::map<unsigned int, ServerConfig>::const_iterator Server_map_it;
@@ -218,5 +508,13 @@ std::ostream &operator<<(std::ostream &os, const WebserverConfig &data) {
     os << "\nServer key: " << Server_map_it->first << std::endl;
     os << Server_map_it->second;
   }
+  const std::map<std::string, ServerConfig> &Unix_map =
+      data.Get_UnixServerConfig_map();
+  std::map<std::string, ServerConfig>::const_iterator Unix_map_it;
+  for (Unix_map_it = Unix_map.begin(); Unix_map_it != Unix_map.end();
+       ++Unix_map_it) {
+    os << "\nServer key: unix:" << Unix_map_it->first << std::endl;
+    os << Unix_map_it->second;
+  }
   return (os);
 }
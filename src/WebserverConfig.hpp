@@ -3,6 +3,60 @@
 
 #include "ServerConfig.hpp"
 #include <iosfwd>
+#include <sys/socket.h>
+
+// Global admission limits, set in the `limits =` block
+struct ServerLimits {
+  unsigned int accept_batch;    // accepts per listener wakeup
+  unsigned int max_connections; // open client connections
+  size_t max_buffered;          // bytes pending in all sessions
+  unsigned int retry_after;     // Retry-After seconds of the overload 503
+  unsigned int max_cgi;         // CGI requests running at once, 0: no cap
+  unsigned int max_cgi_queued;  // CGI requests waiting for a slot
+  size_t cgi_cache;             // bytes of cached CGI responses
+  unsigned int plugin_threads;  // workers of `offload` plugin routes
+  std::string metrics;          // path of the metrics page, empty: none
+
+  ServerLimits()
+      : accept_batch(64), max_connections(10000),
+        max_buffered(256 * 1024 * 1024), retry_after(1), max_cgi(256),
+        max_cgi_queued(1024), cgi_cache(32 * 1024 * 1024), plugin_threads(4),
+        metrics() {}
+};
+
+// One instance of a uWSGI backend, resolved once when the config is loaded
+struct UwsgiAddress {
+  std::string address; // PORT, HOST:PORT or unix:/path, as written
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+
+  UwsgiAddress() : address(), addr(), addr_len(0) {}
+};
+
+// Backend of the `uwsgi =` block (`/script.py:PORT`, `/script.py:HOST:PORT`
+// or `/script.py:unix:/path.sock`). `instance ADDRESS` option lines make it
+// a group of instances running the same script, balanced by UwsgiGroup.
+struct UwsgiBackend {
+  enum Balance {
+    POWER_OF_TWO,      // the less loaded of two instances picked at random
+    LEAST_OUTSTANDING, // the instance with the fewest requests in flight
+  };
+
+  std::string script;  // WSGI script the backend runs, as listed
+  std::string address; // of the first instance, the name routes use
+  std::vector<UwsgiAddress> instances; // the address of the line first
+  unsigned int keepalive;         // idle connections kept open, 0: none
+  unsigned int keepalive_timeout; // seconds an idle connection is kept
+  Balance balance;
+  unsigned int max_fails;       // failures in a row that eject, 0: never
+  unsigned int fail_timeout;    // seconds an ejected instance sits out
+  unsigned int health_interval; // seconds between probes, 0: none
+
+  UwsgiBackend()
+      : script(), address(), instances(), keepalive(8), keepalive_timeout(4),
+        balance(POWER_OF_TWO), max_fails(3), fail_timeout(10),
+        health_interval(5) {}
+};
 
 class WebserverConfig {
 private:
@@ -10,6 +64,11 @@ private:
   std::string default_mime;
   std::map<std::string, std::string> type_map;
   std::map<unsigned int, ServerConfig> ServerConfig_map;
+  // key: unix socket path of a `unix:/path.sock =` block
+  std::map<std::string, ServerConfig> UnixServerConfig_map;
+  ServerLimits limits;
+  // key: UwsgiBackend::address
+  std::map<std::string, UwsgiBackend> uwsgi_map;
 
   bool file_parsing(FileDescriptor &file);
   // type_map method
@@ -19,23 +78,38 @@ private:
                        std::string &value_out);
   std::vector<std::string> is_typeKey(const std::string &key);
   bool is_typeValue(const std::string &value);
+  // limits method
+  bool set_limits(FileDescriptor &file);
+  bool parse_limit_line(const std::string &line);
+  // uwsgi method
+  bool set_uwsgi_map(FileDescriptor &file);
+  UwsgiBackend *parse_uwsgi_line(const std::string &line);
+  bool parse_uwsgi_option(const std::string &line, UwsgiBackend &backend);
+  bool check_uwsgi_routes(const ServerConfig &server);
   // ServerConfig method
   bool is_ServerConfig(const std::string &line);
   bool set_ServerConfig_map(FileDescriptor &file, const std::string &line);
   unsigned int parse_ServerConfig_key(std::string &key);
+  bool is_UnixServerConfig(const std::string &line);
+  bool set_UnixServerConfig_map(FileDescriptor &file, const std::string &line);
 
   WebserverConfig(FileDescriptor &file);
 
 public:
   WebserverConfig(const WebserverConfig &other)
       : default_mime(other.default_mime), type_map(other.type_map),
-        ServerConfig_map(other.ServerConfig_map){};
+        ServerConfig_map(other.ServerConfig_map),
+        UnixServerConfig_map(other.UnixServerConfig_map),
+        limits(other.limits), uwsgi_map(other.uwsgi_map){};
 
   WebserverConfig &operator=(const WebserverConfig &other) {
     if (this != &other) {
       this->default_mime = other.default_mime;
       this->type_map = other.type_map;
       this->ServerConfig_map = other.ServerConfig_map;
+      this->UnixServerConfig_map = other.UnixServerConfig_map;
+      this->limits = other.limits;
+      this->uwsgi_map = other.uwsgi_map;
       this->err_meg.clear();
     }
     return *this;
@@ -48,6 +122,14 @@ public:
   const std::map<unsigned int, ServerConfig> &Get_ServerConfig_map(void) const {
     return ServerConfig_map;
   }
+  const std::map<std::string, ServerConfig> &
+  Get_UnixServerConfig_map(void) const {
+    return UnixServerConfig_map;
+  }
+  const ServerLimits &Get_Limits(void) const { return limits; }
+  const std::map<std::string, UwsgiBackend> &Get_Uwsgi_map(void) const {
+    return uwsgi_map;
+  }
   static Result<WebserverConfig> parse(FileDescriptor &file) {
     WebserverConfig temp(file);
     // OK
@@ -4,11 +4,15 @@
 // the web server then constructs the HTTP response that is sent to the client.
 //
 // Compile:  use the project's Makefile (target `cgi`) to build this program.
-// Usage:    executed by the webserver as a CGI script
+// Usage:    executed by the webserver as a CGI script, or as a long-lived
+//           worker of a pooled CGI route (WEBSERV_POOL=1 in the environment)
+//
+// src/plugin/html_gen.cpp serves the same page as an in-process plugin.
+
+#include "html_page.hpp"
 
 #include <cstdlib>
 #include <cstring>
-#include <ctime>
 #include <iostream>
 #include <map>
 #include <string>
@@ -16,96 +20,15 @@
 // environ is declared in <unistd.h> on POSIX systems.
 #include <unistd.h>
 
-static std::string env_or_empty(const char *name) {
-  const char *val = std::getenv(name);
-  return val ? std::string(val) : std::string();
-}
-
-static std::string html_escape(const std::string &s) {
-  std::string out;
-  out.reserve(s.size());
-  for (std::size_t i = 0; i < s.size(); ++i) {
-    switch (s[i]) {
-    case '&':
-      out += "&amp;";
-      break;
-    case '<':
-      out += "&lt;";
-      break;
-    case '>':
-      out += "&gt;";
-      break;
-    case '"':
-      out += "&quot;";
-      break;
-    case '\'':
-      out += "&#39;";
-      break;
-    default:
-      out += s[i];
-      break;
-    }
-  }
-  return out;
-}
-
-static std::string tr(const std::string &name, const std::string &value) {
-  return "    <tr><td>" + html_escape(name) + "</td><td>" + html_escape(value) +
-         "</td></tr>\n";
-}
-
-int main() {
-  // --- get current UTC time ---
-  char time_buf[64];
-  std::time_t now = std::time(NULL);
-  std::tm utc_tm;
-  if (gmtime_r(&now, &utc_tm)) {
-    std::strftime(time_buf, sizeof(time_buf), "%Y-%m-%dT%H:%M:%SZ", &utc_tm);
-  } else {
-    time_buf[0] = '\0';
-  }
-
-  // --- build HTML body ---
-  std::string body;
-  body += "<!DOCTYPE html>\n";
-  body += "<html lang=\"en\">\n";
-  body += "<head>\n";
-  body += "  <meta charset=\"UTF-8\">\n";
-  body += "  <title>CGI Dynamic Page</title>\n";
-  body += "  <style>\n";
-  body += "    body { font-family: monospace; margin: 2em; }\n";
-  body += "    table { border-collapse: collapse; }\n";
-  body += "    th, td { border: 1px solid #ccc; padding: 4px 8px; text-align: "
-          "left; }\n";
-  body += "    th { background: #eee; }\n";
-  body += "  </style>\n";
-  body += "</head>\n";
-  body += "<body>\n";
-  body += "  <h1>CGI/1.1 Dynamic Response</h1>\n";
-  body +=
-      "  <p>Generated at: <strong>" + std::string(time_buf) + "</strong></p>\n";
-
-  // --- section 1: all 17 standard CGI/1.1 meta-variables (RFC 3875 §4.1) ---
-  body += "  <h2>Standard CGI/1.1 Meta-Variables</h2>\n";
-  body += "  <table>\n";
-  body += "    <tr><th>Variable</th><th>Value</th></tr>\n";
-
-  // The fixed set defined by RFC 3875 §4.1
-  static const char *const STANDARD_VARS[] = {
-      "AUTH_TYPE",         "CONTENT_LENGTH",  "CONTENT_TYPE",
-      "GATEWAY_INTERFACE", "PATH_INFO",       "PATH_TRANSLATED",
-      "QUERY_STRING",      "REMOTE_ADDR",     "REMOTE_HOST",
-      "REMOTE_IDENT",      "REMOTE_USER",     "REQUEST_METHOD",
-      "SCRIPT_NAME",       "SERVER_NAME",     "SERVER_PORT",
-      "SERVER_PROTOCOL",   "SERVER_SOFTWARE", NULL};
-
+// Builds the complete CGI response (headers + body) from the environment
+static std::string render() {
+  std::map<std::string, std::string> standard_vars;
   for (int i = 0; STANDARD_VARS[i] != NULL; ++i) {
-    body += tr(STANDARD_VARS[i], env_or_empty(STANDARD_VARS[i]));
+    const char *val = std::getenv(STANDARD_VARS[i]);
+    if (val)
+      standard_vars[STANDARD_VARS[i]] = val;
   }
 
-  body += "  </table>\n";
-
-  // --- section 2: HTTP_* request-header variables ---
   // Iterate the process environment to capture every HTTP_* variable the
   // server forwarded, regardless of which headers the client sent.
   std::map<std::string, std::string> http_vars;
@@ -120,29 +43,78 @@ int main() {
     }
   }
 
-  body += "  <h2>HTTP Request-Header Variables (HTTP_*)</h2>\n";
-  body += "  <table>\n";
-  body += "    <tr><th>Variable</th><th>Value</th></tr>\n";
-  if (http_vars.empty()) {
-    body += "    <tr><td colspan=\"2\">(none)</td></tr>\n";
-  } else {
-    for (std::map<std::string, std::string>::const_iterator it =
-             http_vars.begin();
-         it != http_vars.end(); ++it) {
-      body += tr(it->first, it->second);
-    }
+  // --- CGI response headers, then the body ---
+  // Per RFC 3875 §6.2.1 a CGI script MUST send at least a Content-Type header.
+  std::string response;
+  response += "Content-Type: text/html; charset=UTF-8\r\n";
+  response += "Status: 200 OK\r\n";
+  response += "\r\n";
+  response += render_page(standard_vars, http_vars);
+  return response;
+}
+
+static bool read_all(char *buf, std::size_t size) {
+  while (size > 0) {
+    ssize_t n = read(STDIN_FILENO, buf, size);
+    if (n <= 0)
+      return false;
+    buf += n;
+    size -= static_cast<std::size_t>(n);
   }
-  body += "  </table>\n";
+  return true;
+}
+
+// Pooled mode frame: 4-byte big-endian length, then the payload
+static bool read_frame(std::string &out) {
+  unsigned char len[4];
+  if (!read_all(reinterpret_cast<char *>(len), 4))
+    return false;
+  std::size_t size = (static_cast<std::size_t>(len[0]) << 24) |
+                     (static_cast<std::size_t>(len[1]) << 16) |
+                     (static_cast<std::size_t>(len[2]) << 8) | len[3];
+  out.assign(size, '\0');
+  return size == 0 || read_all(&out[0], size);
+}
 
-  body += "</body>\n";
-  body += "</html>\n";
+static bool write_frame(const std::string &payload) {
+  std::string frame;
+  frame += static_cast<char>((payload.size() >> 24) & 0xff);
+  frame += static_cast<char>((payload.size() >> 16) & 0xff);
+  frame += static_cast<char>((payload.size() >> 8) & 0xff);
+  frame += static_cast<char>(payload.size() & 0xff);
+  frame += payload;
+  std::size_t sent = 0;
+  while (sent < frame.size()) {
+    ssize_t n = write(STDOUT_FILENO, frame.data() + sent, frame.size() - sent);
+    if (n <= 0)
+      return false;
+    sent += static_cast<std::size_t>(n);
+  }
+  return true;
+}
 
-  // --- emit CGI response headers, then the body ---
-  // Per RFC 3875 §6.2.1 a CGI script MUST send at least a Content-Type header.
-  std::cout << "Content-Type: text/html; charset=UTF-8\r\n";
-  std::cout << "Status: 200 OK\r\n";
-  std::cout << "\r\n";
-  std::cout << body;
+int main() {
+  if (std::getenv("WEBSERV_POOL") == NULL) {
+    std::cout << render();
+    return 0;
+  }
 
+  // Pooled worker: each request is an environment frame (NAME=VALUE entries
+  // separated by NUL) and a body frame; the body is not used by this page
+  std::string vars;
+  std::string body;
+  while (read_frame(vars) && read_frame(body)) {
+    clearenv();
+    std::size_t pos = 0;
+    while (pos < vars.size()) {
+      std::string entry = vars.c_str() + pos;
+      pos += entry.size() + 1;
+      std::size_t eq = entry.find('=');
+      if (eq != std::string::npos)
+        setenv(entry.substr(0, eq).c_str(), entry.c_str() + eq + 1, 1);
+    }
+    if (!write_frame(render()))
+      break;
+  }
   return 0;
 }
@@ -0,0 +1,125 @@
+// Dynamic HTML page shared by the gen_html CGI program and the gen_html
+// handler plugin, so that both paths serve the same bytes when benchmarked
+// against each other. Each side only gathers the variables: the CGI program
+// from its environment, the plugin from the request view.
+#ifndef HTML_PAGE_HPP
+#define HTML_PAGE_HPP
+
+#include <cstddef>
+#include <ctime>
+#include <map>
+#include <string>
+
+// The fixed set defined by RFC 3875 §4.1
+static const char *const STANDARD_VARS[] = {
+    "AUTH_TYPE",         "CONTENT_LENGTH",  "CONTENT_TYPE",
+    "GATEWAY_INTERFACE", "PATH_INFO",       "PATH_TRANSLATED",
+    "QUERY_STRING",      "REMOTE_ADDR",     "REMOTE_HOST",
+    "REMOTE_IDENT",      "REMOTE_USER",     "REQUEST_METHOD",
+    "SCRIPT_NAME",       "SERVER_NAME",     "SERVER_PORT",
+    "SERVER_PROTOCOL",   "SERVER_SOFTWARE", NULL};
+
+static inline std::string html_escape(const std::string &s) {
+  std::string out;
+  out.reserve(s.size());
+  for (std::size_t i = 0; i < s.size(); ++i) {
+    switch (s[i]) {
+    case '&':
+      out += "&amp;";
+      break;
+    case '<':
+      out += "&lt;";
+      break;
+    case '>':
+      out += "&gt;";
+      break;
+    case '"':
+      out += "&quot;";
+      break;
+    case '\'':
+      out += "&#39;";
+      break;
+    default:
+      out += s[i];
+      break;
+    }
+  }
+  return out;
+}
+
+static inline std::string tr(const std::string &name,
+                             const std::string &value) {
+  return "    <tr><td>" + html_escape(name) + "</td><td>" + html_escape(value) +
+         "</td></tr>\n";
+}
+
+// Builds the HTML body from the STANDARD_VARS (missing ones are empty) and
+// the HTTP_* request-header variables
+static inline std::string
+render_page(const std::map<std::string, std::string> &standard_vars,
+            const std::map<std::string, std::string> &http_vars) {
+  // --- get current UTC time ---
+  char time_buf[64];
+  std::time_t now = std::time(NULL);
+  std::tm utc_tm;
+  if (gmtime_r(&now, &utc_tm)) {
+    std::strftime(time_buf, sizeof(time_buf), "%Y-%m-%dT%H:%M:%SZ", &utc_tm);
+  } else {
+    time_buf[0] = '\0';
+  }
+
+  // --- build HTML body ---
+  std::string body;
+  body += "<!DOCTYPE html>\n";
+  body += "<html lang=\"en\">\n";
+  body += "<head>\n";
+  body += "  <meta charset=\"UTF-8\">\n";
+  body += "  <title>CGI Dynamic Page</title>\n";
+  body += "  <style>\n";
+  body += "    body { font-family: monospace; margin: 2em; }\n";
+  body += "    table { border-collapse: collapse; }\n";
+  body += "    th, td { border: 1px solid #ccc; padding: 4px 8px; text-align: "
+          "left; }\n";
+  body += "    th { background: #eee; }\n";
+  body += "  </style>\n";
+  body += "</head>\n";
+  body += "<body>\n";
+  body += "  <h1>CGI/1.1 Dynamic Response</h1>\n";
+  body +=
+      "  <p>Generated at: <strong>" + std::string(time_buf) + "</strong></p>\n";
+
+  // --- section 1: all 17 standard CGI/1.1 meta-variables (RFC 3875 §4.1) ---
+  body += "  <h2>Standard CGI/1.1 Meta-Variables</h2>\n";
+  body += "  <table>\n";
+  body += "    <tr><th>Variable</th><th>Value</th></tr>\n";
+
+  for (int i = 0; STANDARD_VARS[i] != NULL; ++i) {
+    std::map<std::string, std::string>::const_iterator it =
+        standard_vars.find(STANDARD_VARS[i]);
+    body += tr(STANDARD_VARS[i],
+               it != standard_vars.end() ? it->second : std::string());
+  }
+
+  body += "  </table>\n";
+
+  // --- section 2: HTTP_* request-header variables ---
+  body += "  <h2>HTTP Request-Header Variables (HTTP_*)</h2>\n";
+  body += "  <table>\n";
+  body += "    <tr><th>Variable</th><th>Value</th></tr>\n";
+  if (http_vars.empty()) {
+    body += "    <tr><td colspan=\"2\">(none)</td></tr>\n";
+  } else {
+    for (std::map<std::string, std::string>::const_iterator it =
+             http_vars.begin();
+         it != http_vars.end(); ++it) {
+      body += tr(it->first, it->second);
+    }
+  }
+  body += "  </table>\n";
+
+  body += "</body>\n";
+  body += "</html>\n";
+  return body;
+}
+
+#endif
@@ -1,574 +1,115 @@
 #ifndef CGI_1_1_H
 #define CGI_1_1_H
 
+#include "file_descriptor.h"
 #include "http_1_1.h"
+#include "response_parser.h"
 #include "result.h"
 #include <list>
 #include <map>
 #include <string>
-
-// Forward declarations
-class CgiInput;
-class EPoll;
-
-class CgiAuthType {
-public:
-  enum Type {
-    Basic,
-    Digest,
-    CgiAuthOther,
-  };
-  explicit CgiAuthType(Type type) : _type(type), _other(NULL) {}
-  explicit CgiAuthType(Type type, std::string other)
-      : _type(type), _other(new std::string(other)) {}
-  CgiAuthType(const CgiAuthType &other) : _type(other._type) {
-    if (other._other != NULL) {
-      _other = new std::string(*other._other);
-    } else {
-      _other = NULL;
-    }
-  }
-  CgiAuthType &operator=(const CgiAuthType &other) {
-    if (this != &other) {
-      delete _other;
-      _type = other._type;
-      if (other._other != NULL) {
-        _other = new std::string(*other._other);
-      } else {
-        _other = NULL;
-      }
-    }
-    return *this;
-  }
-  ~CgiAuthType() { delete _other; }
-  Type const &type() { return _type; }
-  std::string const *other() { return _other; }
-
-private:
-  Type _type;
-  std::string *_other;
-};
-
-class ContentType {
-public:
-  enum Type {
-    application,
-    audio,
-    example,
-    font,
-    haptics,
-    image,
-    message,
-    model,
-    multipart,
-    text,
-    video
-  };
-  ContentType(Type ty, std::string subty)
-      : type(ty), subtype(subty), params() {}
-  ContentType(ContentType const &other)
-      : type(other.type), subtype(other.subtype), params(other.params) {}
-  ContentType &operator=(const ContentType &other) {
-    if (this != &other) {
-      type = other.type;
-      subtype = other.subtype;
-      params = other.params;
-    }
-    return *this;
-  }
-  Result<Void> add_param(std::string, std::string);
-
-public:
-  Type type;
-  std::string subtype;
-  std::map<std::string, std::string> params;
-};
-
-enum GatewayInterface { Cgi_1_1 };
-
-class ServerName {
-public:
-  class Parser {
-    virtual void phantom() = 0;
-    static Result<std::pair<ServerName, size_t> > parse_host(std::string);
-    static Result<std::pair<ServerName, size_t> > parse_ipv4(std::string);
-
-  public:
-    static Result<std::pair<ServerName, size_t> > parse(std::string);
-  };
-
-  enum Type {
-    Host,
-    Ipv4,
-  };
-
-  union Val {
-    std::list<std::string> *host_name;
-    unsigned char ipv4[4];
-  };
-
-public:
-  ServerName(const ServerName &other) : type(other.type) {
-    if (type == Host) {
-      val.host_name = new std::list<std::string>(*other.val.host_name);
-    } else {
-      val.ipv4[0] = other.val.ipv4[0];
-      val.ipv4[1] = other.val.ipv4[1];
-      val.ipv4[2] = other.val.ipv4[2];
-      val.ipv4[3] = other.val.ipv4[3];
-    }
-  }
-
-  ServerName &operator=(const ServerName &other) {
-    if (this != &other) {
-      // Clean up existing value
-      if (type == Host) {
-        delete val.host_name;
-      }
-
-      // Copy new value
-      type = other.type;
-      if (type == Host) {
-        val.host_name = new std::list<std::string>(*other.val.host_name);
-      } else {
-        val.ipv4[0] = other.val.ipv4[0];
-        val.ipv4[1] = other.val.ipv4[1];
-        val.ipv4[2] = other.val.ipv4[2];
-        val.ipv4[3] = other.val.ipv4[3];
-      }
-    }
-    return *this;
-  }
-
-  ~ServerName() {
-    if (type == Host) {
-      delete val.host_name;
-    }
-  }
-
-  std::string to_string() const;
-
-private:
-  Type type;
-  Val val;
-
-  explicit ServerName(Type ty, Val v) : type(ty), val(v) {}
-
-  static ServerName host(std::list<std::string>);
-  static ServerName ipv4(unsigned char, unsigned char, unsigned char,
-                         unsigned char);
-};
-
-enum ServerProtocol { Http_1_1 };
-
-enum ServerSoftware { Webserv };
-
-class EtcMetaVar {
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * @class EnvBlock
+ * @brief An environment for execve(), built in the parent before spawning.
+ *
+ * The NAME=VALUE strings are stored back to back, NUL-terminated, in one
+ * buffer and envp() points into it, so building an environment costs two
+ * allocations instead of one per variable. The same bytes are the variable
+ * frame sent to pooled workers.
+ */
+class EnvBlock {
+  std::string data;
+  std::vector<size_t> offsets;
+  std::vector<char *> ptrs;
 
 public:
-  enum Type { Http, Custom };
-  EtcMetaVar(Type ty, std::string n, std::string v)
-      : type(ty), name(n), value(v) {}
-  EtcMetaVar(EtcMetaVar const &other)
-      : type(other.type), name(other.name), value(other.value) {}
-  EtcMetaVar &operator=(const EtcMetaVar &other) {
-    if (this != &other) {
-      type = other.type;
-      name = other.name;
-      value = other.value;
-    }
-    return *this;
-  }
+  EnvBlock() : data(), offsets(), ptrs() {}
 
-  Type const &get_type() const { return type; }
-  std::string const &get_name() const { return name; }
-  std::string const &get_value() const { return value; }
+  void reserve(size_t bytes, size_t count);
+  void add(const std::string &entry);
+  void add(const std::string &name, const std::string &value);
+  void add_block(const std::string &entries);
 
-private:
-  Type type;
-  std::string name;
-  std::string value;
-};
-
-class CgiMetaVar {
-public:
-  enum Name {
-    AUTH_TYPE,
-    CONTENT_LENGTH,
-    CONTENT_TYPE,
-    GATEWAY_INTERFACE,
-    PATH_INFO,
-    PATH_TRANSLATED,
-    QUERY_STRING,
-    REMOTE_ADDR,
-    REMOTE_HOST,
-    REMOTE_IDENT,
-    REMOTE_USER,
-    REQUEST_METHOD,
-    SCRIPT_NAME,
-    SERVER_NAME,
-    SERVER_PORT,
-    SERVER_PROTOCOL,
-    SERVER_SOFTWARE,
-    X_, // Custom var
-  };
-
-  union Val {
-    CgiAuthType *auth_type;
-    unsigned int content_length;
-    ContentType *content_type;
-    GatewayInterface gateway_interface;
-    std::list<std::string> *path_info;
-    std::string *path_translated;
-    std::map<std::string, std::string> *query_string;
-    unsigned char remote_addr[4];
-    std::list<std::string> *remote_host;
-    std::string *remote_ident;
-    std::string *remote_user;
-    Http::Method request_method;
-    std::list<std::string> *script_name;
-    ServerName *server_name;
-    unsigned short server_port;
-    ServerProtocol server_protocol;
-    ServerSoftware server_software;
-    EtcMetaVar *etc_val;
-  };
-
-  class Parser {
-    virtual void phantom() = 0;
-    static Result<std::pair<CgiMetaVar, size_t> > parse_auth_type(std::string);
-    static Result<std::pair<CgiMetaVar, size_t> >
-        parse_content_length(std::string);
-    static Result<std::pair<CgiMetaVar, size_t> >
-        parse_content_type(std::string);
-    static Result<std::pair<CgiMetaVar, size_t> >
-        parse_gateway_interface(std::string);
-    static Result<std::pair<CgiMetaVar, size_t> > parse_path_info(std::string);
-    static Result<std::pair<CgiMetaVar, size_t> >
-        parse_path_translated(std::string);
-    static Result<std::pair<CgiMetaVar, size_t> >
-        parse_query_string(std::string);
-    static Result<std::pair<CgiMetaVar, size_t> >
-        parse_remote_addr(std::string);
-    static Result<std::pair<CgiMetaVar, size_t> >
-        parse_remote_host(std::string);
-    static Result<std::pair<CgiMetaVar, size_t> >
-        parse_remote_ident(std::string);
-    static Result<std::pair<CgiMetaVar, size_t> >
-        parse_remote_user(std::string);
-    static Result<std::pair<CgiMetaVar, size_t> >
-        parse_request_method(std::string);
-    static Result<std::pair<CgiMetaVar, size_t> >
-        parse_script_name(std::string);
-    static Result<std::pair<CgiMetaVar, size_t> >
-        parse_server_name(std::string);
-    static Result<std::pair<CgiMetaVar, size_t> >
-        parse_server_port(std::string);
-    static Result<std::pair<CgiMetaVar, size_t> >
-        parse_server_protocol(std::string);
-    static Result<std::pair<CgiMetaVar, size_t> >
-        parse_server_software(std::string);
-    static Result<std::pair<CgiMetaVar, size_t> > parse_custom_var(std::string,
-                                                                   std::string);
-
-  public:
-    static Result<std::pair<CgiMetaVar, size_t> > parse(std::string const &,
-                                                        std::string const &);
-  };
-
-  friend class CgiInput;
-
-public:
-  CgiMetaVar(const CgiMetaVar &other) : name(other.name) {
-    switch (name) {
-    case AUTH_TYPE:
-      val.auth_type = new CgiAuthType(*other.val.auth_type);
-      break;
-    case CONTENT_LENGTH:
-      val.content_length = other.val.content_length;
-      break;
-    case CONTENT_TYPE:
-      val.content_type = new ContentType(*other.val.content_type);
-      break;
-    case GATEWAY_INTERFACE:
-      val.gateway_interface = other.val.gateway_interface;
-      break;
-    case PATH_INFO:
-      val.path_info = new std::list<std::string>(*other.val.path_info);
-      break;
-    case PATH_TRANSLATED:
-      val.path_translated = new std::string(*other.val.path_translated);
-      break;
-    case QUERY_STRING:
-      val.query_string =
-          new std::map<std::string, std::string>(*other.val.query_string);
-      break;
-    case REMOTE_ADDR:
-      val.remote_addr[0] = other.val.remote_addr[0];
-      val.remote_addr[1] = other.val.remote_addr[1];
-      val.remote_addr[2] = other.val.remote_addr[2];
-      val.remote_addr[3] = other.val.remote_addr[3];
-      break;
-    case REMOTE_HOST:
-      val.remote_host = new std::list<std::string>(*other.val.remote_host);
-      break;
-    case REMOTE_IDENT:
-      val.remote_ident = new std::string(*other.val.remote_ident);
-      break;
-    case REMOTE_USER:
-      val.remote_user = new std::string(*other.val.remote_user);
-      break;
-    case REQUEST_METHOD:
-      val.request_method = other.val.request_method;
-      break;
-    case SCRIPT_NAME:
-      val.script_name = new std::list<std::string>(*other.val.script_name);
-      break;
-    case SERVER_NAME:
-      val.server_name = new ServerName(*other.val.server_name);
-      break;
-    case SERVER_PORT:
-      val.server_port = other.val.server_port;
-      break;
-    case SERVER_PROTOCOL:
-      val.server_protocol = other.val.server_protocol;
-      break;
-    case SERVER_SOFTWARE:
-      val.server_software = other.val.server_software;
-      break;
-    case X_:
-      val.etc_val = new EtcMetaVar(*other.val.etc_val);
-      break;
-    }
-  }
-
-  // Assigns from another CgiMetaVar, performing a deep copy of the active
-  // value. The operator first releases any currently owned dynamic resources
-  // associated with this->name, then copies the discriminator and value from
-  // 'other' in a way that mirrors the copy constructor. Self-assignment is
-  // explicitly guarded against so we never delete resources before reading from
-  // them.
-  CgiMetaVar &operator=(const CgiMetaVar &other) {
-    // Protect against self-assignment; required because we delete current
-    // resources before copying from 'other'.
-    if (this != &other) {
-      // Clean up the value currently selected by 'name' before overwriting it.
-      switch (name) {
-      case AUTH_TYPE:
-        delete val.auth_type;
-        break;
-      case CONTENT_TYPE:
-        delete val.content_type;
-        break;
-      case PATH_INFO:
-        delete val.path_info;
-        break;
-      case PATH_TRANSLATED:
-        delete val.path_translated;
-        break;
-      case QUERY_STRING:
-        delete val.query_string;
-        break;
-      case REMOTE_HOST:
-        delete val.remote_host;
-        break;
-      case REMOTE_IDENT:
-        delete val.remote_ident;
-        break;
-      case REMOTE_USER:
-        delete val.remote_user;
-        break;
-      case SCRIPT_NAME:
-        delete val.script_name;
-        break;
-      case SERVER_NAME:
-        delete val.server_name;
-        break;
-      case X_:
-        delete val.etc_val;
-        break;
-      default:
-        break;
-      }
-
-      // Copy new value
-      name = other.name;
-      switch (name) {
-      case AUTH_TYPE:
-        val.auth_type = new CgiAuthType(*other.val.auth_type);
-        break;
-      case CONTENT_LENGTH:
-        val.content_length = other.val.content_length;
-        break;
-      case CONTENT_TYPE:
-        val.content_type = new ContentType(*other.val.content_type);
-        break;
-      case GATEWAY_INTERFACE:
-        val.gateway_interface = other.val.gateway_interface;
-        break;
-      case PATH_INFO:
-        val.path_info = new std::list<std::string>(*other.val.path_info);
-        break;
-      case PATH_TRANSLATED:
-        val.path_translated = new std::string(*other.val.path_translated);
-        break;
-      case QUERY_STRING:
-        val.query_string =
-            new std::map<std::string, std::string>(*other.val.query_string);
-        break;
-      case REMOTE_ADDR:
-        val.remote_addr[0] = other.val.remote_addr[0];
-        val.remote_addr[1] = other.val.remote_addr[1];
-        val.remote_addr[2] = other.val.remote_addr[2];
-        val.remote_addr[3] = other.val.remote_addr[3];
-        break;
-      case REMOTE_HOST:
-        val.remote_host = new std::list<std::string>(*other.val.remote_host);
-        break;
-      case REMOTE_IDENT:
-        val.remote_ident = new std::string(*other.val.remote_ident);
-        break;
-      case REMOTE_USER:
-        val.remote_user = new std::string(*other.val.remote_user);
-        break;
-      case REQUEST_METHOD:
-        val.request_method = other.val.request_method;
-        break;
-      case SCRIPT_NAME:
-        val.script_name = new std::list<std::string>(*other.val.script_name);
-        break;
-      case SERVER_NAME:
-        val.server_name = new ServerName(*other.val.server_name);
-        break;
-      case SERVER_PORT:
-        val.server_port = other.val.server_port;
-        break;
-      case SERVER_PROTOCOL:
-        val.server_protocol = other.val.server_protocol;
-        break;
-      case SERVER_SOFTWARE:
-        val.server_software = other.val.server_software;
-        break;
-      case X_:
-        val.etc_val = new EtcMetaVar(*other.val.etc_val);
-        break;
-      }
-    }
-    return *this;
-  }
-
-  ~CgiMetaVar() {
-    switch (name) {
-    case AUTH_TYPE:
-      delete val.auth_type;
-      break;
-    case CONTENT_TYPE:
-      delete val.content_type;
-      break;
-    case PATH_INFO:
-      delete val.path_info;
-      break;
-    case PATH_TRANSLATED:
-      delete val.path_translated;
-      break;
-    case QUERY_STRING:
-      delete val.query_string;
-      break;
-    case REMOTE_HOST:
-      delete val.remote_host;
-      break;
-    case REMOTE_IDENT:
-      delete val.remote_ident;
-      break;
-    case REMOTE_USER:
-      delete val.remote_user;
-      break;
-    case SCRIPT_NAME:
-      delete val.script_name;
-      break;
-    case SERVER_NAME:
-      delete val.server_name;
-      break;
-    case X_:
-      delete val.etc_val;
-      break;
-    default:
-      break;
-    }
-  }
-
-  Name const &get_name() const { return name; }
-  Val const &get_val() const { return val; }
-
-private:
-  Name name;
-  Val val;
-  CgiMetaVar(Name n, Val v) : name(n), val(v) {}
-  static CgiMetaVar auth_type(CgiAuthType);
-  static CgiMetaVar content_length(unsigned int);
-  static CgiMetaVar content_type(const ContentType &);
-  static CgiMetaVar gateway_interface(GatewayInterface);
-  static CgiMetaVar path_info(std::list<std::string>);
-  static CgiMetaVar path_translated(std::string);
-  static CgiMetaVar query_string(std::map<std::string, std::string>);
-  static CgiMetaVar remote_addr(unsigned char, unsigned char, unsigned char,
-                                unsigned char);
-  static CgiMetaVar remote_host(std::list<std::string>);
-  static CgiMetaVar remote_ident(std::string);
-  static CgiMetaVar remote_user(std::string);
-  static CgiMetaVar request_method(Http::Method);
-  static CgiMetaVar script_name(std::list<std::string>);
-  static CgiMetaVar server_name(ServerName);
-  static CgiMetaVar server_port(unsigned short);
-  static CgiMetaVar server_protocol(ServerProtocol);
-  static CgiMetaVar server_software(ServerSoftware);
-  static CgiMetaVar custom_var(EtcMetaVar::Type, std::string, std::string);
-};
-
-class CgiInput {
-  std::vector<CgiMetaVar> mvars;
-  Http::Body req_body;
-
-private:
-  CgiInput();
-  CgiInput(std::vector<CgiMetaVar>, Http::Body);
-  CgiInput(Http::Request const &);
-
-public:
-  class Parser {
-    virtual void phantom() = 0;
-
-  public:
-    static Result<CgiInput> parse(Http::Request const &);
-  };
-
-  friend class Parser;
-  friend class CgiDelegate;
-
-  CgiInput(const CgiInput &other)
-      : mvars(other.mvars), req_body(other.req_body) {}
-  CgiInput &operator=(const CgiInput &other) {
-    if (this != &other) {
-      mvars = other.mvars;
-      req_body = other.req_body;
-    }
-    return *this;
-  }
-  void add_mvar(std::string const &, std::string const &);
-  char **to_envp() const;
+  const std::string &bytes() const { return data; }
+  size_t size() const { return offsets.size(); }
+  // NULL-terminated; valid until the next add()
+  char *const *envp();
 };
 
+/**
+ * @class CgiDelegate
+ * @brief Runs one CGI/1.1 script for one request.
+ *
+ * The script is driven in non-blocking steps so that the server can register
+ * the pipes returned by spawn() on its own EPoll: write_body() on EPOLLOUT of
+ * stdin, read_output() on EPOLLIN of stdout, and reap the script itself
+ * (child(), set_exit_status()). The server streams the output with
+ * parse_head() and take_output().
+ */
 class CgiDelegate {
-  CgiInput env;
+  EnvBlock env;
   std::string script_path;
-  Http::Request request;
+  pid_t pid;
+  std::string body;   // request body fed to the script's stdin
+  size_t written;     // bytes of body already written
+  ResponseParser output; // what the script wrote to stdout, not taken yet
+  int status;            // waitpid() status once the script has exited
+  bool framed;           // talking to a pooled worker instead of a child
+  std::string frame_head; // length prefix of the worker's response frame
+  size_t frame_left;      // bytes of the response frame not read yet
+
+  CgiDelegate(const CgiDelegate &);
+  CgiDelegate &operator=(const CgiDelegate &);
 
 public:
-  CgiDelegate(const Http::Request &req, const std::string &script);
-  Result<Http::Response> execute(int timeout_ms, EPoll *epoll);
+  // Without with_body the caller writes the request body to stdin itself
+  CgiDelegate(const Http::Request &req, const std::string &script,
+              bool with_body = true);
+  void add_env(std::string const &name, std::string const &value);
+  // Precomputed NAME=VALUE\0 entries, see Config_CGI::Get_env_block()
+  void add_env_block(std::string const &entries);
+
+  // Switches to the framed protocol of pooled workers: the environment and
+  // body become one request frame, and read_output() stops after one
+  // response frame instead of at EOF
+  void use_pool();
+
+  // Forks the script; returns the non-blocking (stdin, stdout) pipe ends
+  Result<std::pair<FileDescriptor, FileDescriptor> > spawn();
+  Result<bool> write_body(const FileDescriptor &stdin_fd);
+  Result<bool> read_output(const FileDescriptor &stdout_fd,
+                           size_t limit = static_cast<size_t>(-1));
+  // The running script, or -1 once it exited or was released
+  pid_t child() const { return pid; }
+  // The caller reaped the script
+  void set_exit_status(int wait_status);
+  // Hands the script over to the caller, who kills and reaps it; the
+  // destructor then leaves it alone
+  pid_t release_child();
+  void terminate();
+  bool succeeded() const;
+
+  // Streaming: the header block as soon as it is complete, then the body in
+  // pieces as the script writes it
+  Result<bool> parse_head(bool at_eof);
+  Http::Response head() const;
+  std::string take_output();
+  size_t buffered() const { return output.buffered(); }
+
   ~CgiDelegate();
 };
 
+// CGI/1.1 meta-variables of req (RFC 3875 4.1)
+void build_cgi_env(const Http::Request &req, EnvBlock &block);
+
+// Starts the CGI executable at path with the given stdin and stdout, in its
+// own process group
+Result<pid_t> spawn_script(const std::string &path, char *const *envp,
+                           int stdin_fd, int stdout_fd);
+
 unsigned char to_upper(unsigned char);
 
 #endif
@@ -54,11 +54,13 @@ Result<const Event *> Events::operator*() const {
 }
 
 Result<EPoll> EPoll::create(unsigned short sz) {
-  int fd = epoll_create(static_cast<int>(sz));
+  if (sz == 0)
+    return ERR(EPoll, "the epoll size is zero");
+  // sz only sizes the event buffer of wait(); close-on-exec keeps the epoll
+  // instance out of CGI scripts
+  int fd = epoll_create1(EPOLL_CLOEXEC);
   if (fd < 0) {
     switch (errno) {
-    case EINVAL:
-      return ERR(EPoll, "the epoll size is zero");
     case EMFILE:
     case ENFILE:
       return ERR(EPoll, Errors::fd_too_many);
@@ -127,7 +129,7 @@ Result<FileDescriptor *> EPoll::add_fd(FileDescriptor fd, const Event &ev,
   return OK(FileDescriptor *, &_events.back());
 }
 
-Result<Void> EPoll::modify_fd(FileDescriptor &fd, const Event &ev,
+Result<Void> EPoll::modify_fd(const FileDescriptor &fd, const Event &ev,
                               const Option &op) {
   epoll_event event = {};
   if (ev.in)
@@ -189,14 +191,30 @@ Result<Void> EPoll::del_fd(const FileDescriptor &fd) {
   for (std::list<FileDescriptor>::iterator it = _events.begin();
        it != _events.end(); ++it) {
     if (*it == fd) {
-      _events.erase(it);
+      _retired.splice(_retired.end(), _events, it);
       break;
     }
   }
   return OKV;
 }
 
+Result<FileDescriptor> EPoll::take_fd(const FileDescriptor &fd) {
+  epoll_event event = {};
+  if (epoll_ctl(_fd._fd, EPOLL_CTL_DEL, fd._fd, &event) == -1)
+    return ERR(FileDescriptor, Errors::fd_not_registered);
+  for (std::list<FileDescriptor>::iterator it = _events.begin();
+       it != _events.end(); ++it) {
+    if (*it == fd) {
+      FileDescriptor taken = *it; // leaves the list entry empty
+      _retired.splice(_retired.end(), _events, it);
+      return OK(FileDescriptor, taken);
+    }
+  }
+  return ERR(FileDescriptor, Errors::fd_not_registered);
+}
+
 Result<Events> EPoll::wait(const int timeout_ms) {
+  _retired.clear(); // the previous batch is dispatched
   struct epoll_event *events = new struct epoll_event[_size];
   int n = epoll_wait(_fd._fd, events, _size, timeout_ms);
   if (n == -1) {
@@ -126,14 +126,20 @@ private:
  * 2. Create socket and call FileDescriptor::set_nonblocking()
  * 3. Add socket to EPoll with add_fd() using edge-triggered Option
  * 4. In event loop, drain all data with while(!EWOULDBLOCK) pattern
+ *
+ * The Events of a wait() point into the registered FileDescriptors. One that
+ * del_fd() or take_fd() drops while its batch is dispatched is kept (still
+ * open, for del_fd()) until the next wait(): a later event of the batch never
+ * points at freed memory, nor at a descriptor that reused its number.
  */
 class EPoll {
   FileDescriptor _fd;
   std::list<FileDescriptor> _events;
+  std::list<FileDescriptor> _retired; // dropped since the last wait()
   unsigned short _size;
 
 public:
-  EPoll() : _fd(), _events(), _size(0) {}
+  EPoll() : _fd(), _events(), _retired(), _size(0) {}
 
   // Move-like copy constructor: transfers ownership from other, leaving it
   // empty Note: Uses const_cast to enable move semantics in C++98
@@ -142,6 +148,7 @@ public:
     // FileDescriptors
     EPoll &mutable_other = const_cast<EPoll &>(other);
     _events.swap(mutable_other._events);
+    _retired.swap(mutable_other._retired);
     // Invalidate other - make it empty
     mutable_other._size = 0;
     // FileDescriptor will handle its own state
@@ -156,6 +163,7 @@ public:
       _size = other._size;
       EPoll &mutable_other = const_cast<EPoll &>(other);
       _events.swap(mutable_other._events);
+      _retired.swap(mutable_other._retired);
       // Invalidate other - make it empty
       mutable_other._size = 0;
     }
@@ -166,8 +174,11 @@ public:
   Result<Events> wait(const int timeout_ms);
   Result<FileDescriptor *> add_fd(FileDescriptor, const Event &,
                                   const Option &);
-  Result<Void> modify_fd(FileDescriptor &, const Event &, const Option &);
+  Result<Void> modify_fd(const FileDescriptor &, const Event &,
+                         const Option &);
   Result<Void> del_fd(const FileDescriptor &);
+  // Unregisters fd and hands it back open instead of closing it
+  Result<FileDescriptor> take_fd(const FileDescriptor &);
 };
 
 #endif
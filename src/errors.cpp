@@ -23,6 +23,8 @@ const std::string Errors::readonly_filesys =
     "required to write.";
 const std::string Errors::try_again = "Try again next time.";
 const std::string Errors::conn_aborted = "A connection has been aborted.";
+const std::string Errors::broken_pipe =
+    "The reading end of the pipe has been closed.";
 const std::string Errors::unknown_char = "Unknown character";
 const std::string Errors::invalid_format = "Invalid Format";
 const std::string Errors::too_long_num = "Too long numbers";
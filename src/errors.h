@@ -26,6 +26,7 @@ public:
   const static std::string readonly_filesys;
   const static std::string try_again;
   const static std::string conn_aborted;
+  const static std::string broken_pipe;
   const static std::string unknown_char;
   const static std::string invalid_format;
   const static std::string too_long_num;
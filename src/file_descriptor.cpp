@@ -1,7 +1,8 @@
 #include "webserv.h"
 
-Result<FileDescriptor> FileDescriptor::socket_new() {
-  int sock = socket(AF_INET, SOCK_STREAM, 0);
+Result<FileDescriptor> FileDescriptor::socket_new(int domain) {
+  // Close-on-exec so that CGI scripts don't inherit listeners or backends
+  int sock = socket(domain, SOCK_STREAM | SOCK_CLOEXEC, 0);
   if (sock < 0) {
     switch (errno) {
     case EACCES:
@@ -71,7 +72,7 @@ Result<FileDescriptor> FileDescriptor::open_file(std::string const &path) {
   }
 
   // O_NOFOLLOW provides defense-in-depth against TOCTOU races with symlinks.
-  int _fd = open(safe_path.c_str(), O_RDONLY | O_NOFOLLOW);
+  int _fd = open(safe_path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
   if (_fd < 0)
     return ERR(FileDescriptor, "failed to open the config file");
 
@@ -131,6 +132,35 @@ FileDescriptor::~FileDescriptor() {
     ::close(_fd);
 }
 
+static Result<Void> bind_error() {
+  switch (errno) {
+  case EACCES:
+    return ERR(Void, Errors::access_denied);
+  case EADDRINUSE:
+  case EADDRNOTAVAIL:
+    return ERR(Void, Errors::addr_not_available);
+  case EBADF:
+  case ENOTSOCK:
+    return ERR(Void, Errors::invalid_fd);
+  case EINVAL:
+    return ERR(Void, Errors::invalid_operation);
+  case EFAULT:
+    return ERR(Void, Errors::address_fault);
+  case ELOOP:
+    return ERR(Void, Errors::addr_loop);
+  case ENAMETOOLONG:
+    return ERR(Void, Errors::name_too_long);
+  case ENOENT:
+  case ENOTDIR:
+    return ERR(Void, Errors::not_found);
+  case ENOMEM:
+    return ERR(Void, Errors::out_of_mem);
+  case EROFS:
+    return ERR(Void, Errors::readonly_filesys);
+  }
+  return ERR(Void, std::string("`bind` failed: ") + strerror(errno));
+}
+
 Result<Void> FileDescriptor::socket_bind(struct in_addr addr,
                                          unsigned short port) {
   sockaddr_in _addr;
@@ -139,33 +169,48 @@ Result<Void> FileDescriptor::socket_bind(struct in_addr addr,
   _addr.sin_addr = addr;
   _addr.sin_port = htons(port);
   if (bind(_fd, reinterpret_cast<const sockaddr *>(&_addr), sizeof(_addr)) <
-      0) {
-    switch (errno) {
-    case EACCES:
-      return ERR(Void, Errors::access_denied);
-    case EADDRINUSE:
-    case EADDRNOTAVAIL:
-      return ERR(Void, Errors::addr_not_available);
-    case EBADF:
-    case ENOTSOCK:
-      return ERR(Void, Errors::invalid_fd);
-    case EINVAL:
-      return ERR(Void, Errors::invalid_operation);
-    case EFAULT:
-      return ERR(Void, Errors::address_fault);
-    case ELOOP:
-      return ERR(Void, Errors::addr_loop);
-    case ENAMETOOLONG:
-      return ERR(Void, Errors::name_too_long);
-    case ENOENT:
-    case ENOTDIR:
-      return ERR(Void, Errors::not_found);
-    case ENOMEM:
-      return ERR(Void, Errors::out_of_mem);
-    case EROFS:
-      return ERR(Void, Errors::readonly_filesys);
+      0)
+    return bind_error();
+  return OKV;
+}
+
+// Whether the socket file at addr is left over from a server that is gone:
+// connecting to it is refused. errno is kept for the caller.
+static bool stale_socket(const sockaddr_un &addr) {
+  int saved = errno;
+  bool stale = false;
+  struct stat info;
+  if (lstat(addr.sun_path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (probe >= 0) {
+      stale = connect(probe, reinterpret_cast<const sockaddr *>(&addr),
+                      sizeof(addr)) < 0 &&
+              errno == ECONNREFUSED;
+      close(probe);
     }
   }
+  errno = saved;
+  return stale;
+}
+
+Result<Void> FileDescriptor::socket_bind(const std::string &path) {
+  sockaddr_un _addr;
+  std::memset(&_addr, 0, sizeof(_addr));
+  if (path.length() >= sizeof(_addr.sun_path))
+    return ERR(Void, Errors::name_too_long);
+  _addr.sun_family = AF_UNIX;
+  std::memcpy(_addr.sun_path, path.c_str(), path.length());
+  if (bind(_fd, reinterpret_cast<const sockaddr *>(&_addr), sizeof(_addr)) ==
+      0)
+    return OKV;
+  // A socket file left behind by a previous run is replaced; one a server
+  // still accepts on is not
+  if (errno != EADDRINUSE || !stale_socket(_addr))
+    return bind_error();
+  unlink(path.c_str());
+  if (bind(_fd, reinterpret_cast<const sockaddr *>(&_addr), sizeof(_addr)) <
+      0)
+    return bind_error();
   return OKV;
 }
 
@@ -186,7 +231,9 @@ Result<Void> FileDescriptor::socket_listen(unsigned short backlog) {
 
 Result<FileDescriptor> FileDescriptor::socket_accept(struct sockaddr *addr,
                                                      socklen_t *len) const {
-  int fd = accept(_fd, addr, len);
+  // Accepted sockets come out non-blocking and close-on-exec, saving the
+  // fcntl() round trips per connection
+  int fd = accept4(_fd, addr, len, SOCK_NONBLOCK | SOCK_CLOEXEC);
   if (fd >= 0) {
     FileDescriptor fd_;
     fd_._fd = fd;
@@ -234,6 +281,28 @@ Result<ssize_t> FileDescriptor::sock_recv(void *buf, size_t size) const {
   return OK(ssize_t, res);
 }
 
+Result<ssize_t> FileDescriptor::fd_read(void *buf, size_t size) const {
+  ssize_t res = read(_fd, buf, size);
+  if (res < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return ERR(ssize_t, Errors::try_again);
+    return ERR(ssize_t, std::string("`read` failed: ") + strerror(errno));
+  }
+  return OK(ssize_t, res);
+}
+
+Result<ssize_t> FileDescriptor::fd_write(const void *buf, size_t size) const {
+  ssize_t res = write(_fd, buf, size);
+  if (res < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return OK(ssize_t, 0);
+    if (errno == EPIPE)
+      return ERR(ssize_t, Errors::broken_pipe);
+    return ERR(ssize_t, std::string("`write` failed: ") + strerror(errno));
+  }
+  return OK(ssize_t, res);
+}
+
 Result<Http::PartialString> FileDescriptor::try_read_to_end() const {
   std::stringstream ss;
   char buf[BUFFER_SIZE];
@@ -290,6 +359,77 @@ Result<ssize_t> FileDescriptor::sock_send(const void *buf, size_t size) const {
   return OK(ssize_t, res);
 }
 
+Result<ssize_t> FileDescriptor::sock_sendmsg(const struct iovec *iov,
+                                             size_t iovcnt, int flags) const {
+  struct msghdr msg;
+  std::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = const_cast<struct iovec *>(iov);
+  msg.msg_iovlen = iovcnt;
+  ssize_t res = sendmsg(_fd, &msg, flags | MSG_NOSIGNAL);
+  if (res < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return OK(ssize_t, 0);
+    return ERR(ssize_t, std::string("`sendmsg` failed: ") + strerror(errno));
+  }
+  return OK(ssize_t, res);
+}
+
+Result<ssize_t> FileDescriptor::send_file(int in_fd, off_t *offset,
+                                          size_t count) const {
+  ssize_t res = sendfile(_fd, in_fd, offset, count);
+  if (res < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return OK(ssize_t, 0);
+    return ERR(ssize_t, std::string("`sendfile` failed: ") + strerror(errno));
+  }
+  if (res == 0 && count > 0)
+    return ERR(ssize_t, "`sendfile` failed: file shorter than expected");
+  return OK(ssize_t, res);
+}
+
+Result<ssize_t> FileDescriptor::splice_to(const FileDescriptor &out,
+                                          size_t count) const {
+  ssize_t res = splice(_fd, NULL, out._fd, NULL, count,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (res < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return ERR(ssize_t, Errors::try_again);
+    if (errno == EPIPE)
+      return ERR(ssize_t, Errors::broken_pipe);
+    return ERR(ssize_t, std::string("`splice` failed: ") + strerror(errno));
+  }
+  return OK(ssize_t, res);
+}
+
+Result<Void> FileDescriptor::socket_shutdown(int how) const {
+  if (shutdown(_fd, how) < 0)
+    return ERR(Void, std::string("`shutdown` failed: ") + strerror(errno));
+  return OKV;
+}
+
+Result<Void> FileDescriptor::socket_connect(const struct sockaddr *addr,
+                                            socklen_t len) const {
+  if (connect(_fd, addr, len) < 0 && errno != EINPROGRESS)
+    return ERR(Void, std::string("`connect` failed: ") + strerror(errno));
+  return OKV;
+}
+
+Result<Void> FileDescriptor::socket_error() const {
+  int error = 0;
+  socklen_t len = sizeof(error);
+  if (getsockopt(_fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0)
+    error = errno;
+  if (error != 0)
+    return ERR(Void, std::string("`connect` failed: ") + strerror(error));
+  return OKV;
+}
+
+bool FileDescriptor::socket_idle() const {
+  char byte;
+  ssize_t res = recv(_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
 Result<std::string> FileDescriptor::read_file_line() {
   if (fp == NULL)
     return ERR(std::string, "FILE not initialized");
@@ -5,6 +5,7 @@
 #include "http_1_1.h"
 #include "result.h"
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 class Event;
 
@@ -17,7 +18,8 @@ class FileDescriptor {
 public:
   static Result<FileDescriptor> from_raw(int);
 
-  static Result<FileDescriptor> socket_new();
+  // Stream socket of the given family (AF_INET or AF_UNIX)
+  static Result<FileDescriptor> socket_new(int domain = AF_INET);
 
   static Result<FileDescriptor> open_file(std::string const &);
 
@@ -31,6 +33,10 @@ public:
 
   Result<Void> socket_bind(struct in_addr addr, unsigned short port);
 
+  // Binds an AF_UNIX socket to a filesystem path. An existing socket file is
+  // only removed if nothing accepts on it any more.
+  Result<Void> socket_bind(const std::string &path);
+
   Result<Void> socket_listen(unsigned short backlog);
 
   Result<FileDescriptor> socket_accept(struct sockaddr *addr,
@@ -38,8 +44,29 @@ public:
 
   Result<ssize_t> sock_recv(void *buf, size_t size) const;
 
+  // shutdown(2); how is SHUT_RD, SHUT_WR or SHUT_RDWR
+  Result<Void> socket_shutdown(int how) const;
+
+  // Starts a connect() on a non-blocking socket. EINPROGRESS is not an error:
+  // EPOLLOUT then reports the outcome through socket_error().
+  Result<Void> socket_connect(const struct sockaddr *addr,
+                              socklen_t len) const;
+
+  // Pending error of the socket (SO_ERROR), e.g. of a non-blocking connect
+  Result<Void> socket_error() const;
+
+  // Whether an idle connection can still carry a request: the peer neither
+  // closed it nor sent anything unasked
+  bool socket_idle() const;
+
   Result<Http::PartialString> try_read_to_end() const;
 
+  // read() for pipes; like sock_recv, EAGAIN is reported as try_again
+  Result<ssize_t> fd_read(void *buf, size_t size) const;
+
+  // write() for pipes; like sock_send, returns 0 when the pipe is full
+  Result<ssize_t> fd_write(const void *buf, size_t size) const;
+
   /**
    * @brief Sets the file descriptor to non-blocking mode.
    *
@@ -76,6 +103,22 @@ public:
 
   Result<ssize_t> sock_send(const void *buf, size_t size) const;
 
+  // Gathers iovcnt buffers into one sendmsg() call. Like sock_send, returns 0
+  // when the socket would block.
+  Result<ssize_t> sock_sendmsg(const struct iovec *iov, size_t iovcnt,
+                               int flags) const;
+
+  // Sends count bytes of in_fd starting at *offset with sendfile(), advancing
+  // *offset. Returns 0 when the socket would block, and fails if in_fd ends
+  // before count bytes (the file was truncated). SIGPIPE must be ignored:
+  // sendfile() takes no MSG_NOSIGNAL.
+  Result<ssize_t> send_file(int in_fd, off_t *offset, size_t count) const;
+
+  // Moves up to count bytes from this socket into the pipe out with splice(),
+  // without copying them through user space. Returns 0 at EOF; EAGAIN on
+  // either side is reported as try_again.
+  Result<ssize_t> splice_to(const FileDescriptor &out, size_t count) const;
+
   Result<std::string> read_file_line();
 
   bool operator==(const int &other) const { return _fd == other; }
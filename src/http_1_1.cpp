@@ -386,13 +386,10 @@ Result<std::pair<Http::Body, size_t> > Http::Request::Parser::parse_body(
   char *end_ptr = NULL;
   unsigned long body_length = std::strtoul(length_str.c_str(), &end_ptr, 10);
 
-  if (end_ptr == length_str.c_str() || *end_ptr != '\0') {
-    // Invalid Content-Length
-    Http::Body::Value empty_val;
-    empty_val._null = NULL;
-    return OK_PAIR(Http::Body, size_t, Http::Body(Http::Body::Empty, empty_val),
-                   0);
-  }
+  if (length_str.empty() ||
+      length_str.find_first_not_of("0123456789") != std::string::npos ||
+      *end_ptr != '\0' || body_length == ULONG_MAX)
+    return ERR_PAIR(Http::Body, size_t, "Invalid Content-Length");
 
   // RFC 2616: Content-Length of 0 is valid and indicates empty body
   if (body_length == 0) {
@@ -504,6 +501,32 @@ Http::Request::Parser::parse(const char *input, size_t) {
   return OK_PAIR(Http::Request, size_t, request, offset);
 }
 
+Result<std::pair<Http::Request, size_t> >
+Http::Request::Parser::parse_head(const char *input) {
+  if (input == NULL) {
+    return ERR_PAIR(Http::Request, size_t, Errors::invalid_format);
+  }
+
+  size_t offset = 0;
+  Result<std::pair<Http::Request, size_t> > req_line_res =
+      parse_request_line(input, offset);
+  if (!req_line_res.error().empty()) {
+    return req_line_res;
+  }
+  Http::Request request = req_line_res.value().first;
+  offset += req_line_res.value().second;
+
+  Result<std::pair<std::map<std::string, std::string>, size_t> > headers_res =
+      parse_headers(input, offset);
+  if (!headers_res.error().empty()) {
+    return ERR_PAIR(Http::Request, size_t, headers_res.error());
+  }
+  request._headers = headers_res.value().first;
+  offset += headers_res.value().second;
+
+  return OK_PAIR(Http::Request, size_t, request, offset);
+}
+
 // Original parse function (delegating to Parser::parse)
 Result<std::pair<Http::Request *, size_t> >
 Http::Request::parse(const char *input, char delimiter) {
@@ -525,6 +548,20 @@ Http::Request::parse(const char *input, char delimiter) {
                  result.value().second);
 }
 
+Result<std::pair<Http::Request *, size_t> >
+Http::Request::parse_head(const char *input) {
+  Result<std::pair<Http::Request, size_t> > result =
+      Http::Request::Parser::parse_head(input);
+
+  if (!result.error().empty()) {
+    return ERR_PAIR(Http::Request *, size_t, result.error());
+  }
+
+  return OK_PAIR(Http::Request *, size_t,
+                 new Http::Request(result.value().first),
+                 result.value().second);
+}
+
 static std::string http_method_to_string(Http::Method m) {
   switch (m) {
   case Http::GET:
@@ -588,6 +625,8 @@ static std::string serialize_response_line(int status) {
     reason_phrase = " Bad Gateway";
   else if (status == 503)
     reason_phrase = " Service Unavailable";
+  else if (status == 504)
+    reason_phrase = " Gateway Timeout";
   return "HTTP/1.1 " + oss.str() + reason_phrase + "\r\n";
 }
 
@@ -709,3 +748,32 @@ std::string Http::Response::serialize() const {
 
   return start_line + header + "\r\n" + body;
 }
+
+std::string Http::Response::serialize_head() const {
+  return serialize_response_line(_status_code) + serialize_headers(_headers) +
+         "\r\n";
+}
+
+const char *Http::method_name(Method method) {
+  switch (method) {
+  case Http::GET:
+    return "GET";
+  case Http::HEAD:
+    return "HEAD";
+  case Http::POST:
+    return "POST";
+  case Http::PUT:
+    return "PUT";
+  case Http::DELETE:
+    return "DELETE";
+  case Http::OPTIONS:
+    return "OPTIONS";
+  case Http::CONNECT:
+    return "CONNECT";
+  case Http::TRACE:
+    return "TRACE";
+  case Http::PATCH:
+    return "PATCH";
+  }
+  return "";
+}
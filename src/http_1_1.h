@@ -10,6 +10,8 @@ class Http {
 
 public:
   enum Method { GET, HEAD, OPTIONS, POST, DELETE, PUT, CONNECT, TRACE, PATCH };
+  // "GET", "POST", ...
+  static const char *method_name(Method method);
 
   class PartialString {
   public:
@@ -154,6 +156,8 @@ public:
 
     public:
       static Result<std::pair<Request, size_t> > parse(const char *, size_t);
+      // Request line and headers only; the body is left Empty
+      static Result<std::pair<Request, size_t> > parse_head(const char *);
     };
 
     friend class Parser;
@@ -179,6 +183,10 @@ public:
     const std::string &path() const { return _path; }
     const Body &body() const { return _body; }
     static Result<std::pair<Request *, size_t> > parse(const char *, char);
+    // Parses up to the blank line after the headers, e.g. to route a request
+    // whose body is still arriving. The offset returned is where the body
+    // starts.
+    static Result<std::pair<Request *, size_t> > parse_head(const char *);
     std::string serialize() const;
   };
 
@@ -214,6 +222,9 @@ public:
     }
 
     std::string serialize() const;
+    // Status line and headers as they are, for a body sent separately; the
+    // caller sets Content-Length or Transfer-Encoding
+    std::string serialize_head() const;
   };
 };
 #endif
@@ -0,0 +1,105 @@
+// Handler plugin serving the page of src/cgi/cgi_html_gen.cpp in-process,
+// the reference for webserv_plugin.h. The variables the CGI program reads
+// from its environment are taken from the request view instead, the way the
+// server builds them for a script, so that `GET /gen $gen_html.cgi` and
+// `GET /gen_so &gen_html.so` can be benchmarked against each other.
+//
+// Compile:  use the project's Makefile (target `plugin`) to build gen_html.so.
+// Config:   SERVER_SOFTWARE=NAME overrides "webserv".
+// It keeps no state across requests, so routes may `offload` it.
+
+#include "../cgi/html_page.hpp"
+#include "webserv_plugin.h"
+
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <new>
+#include <string>
+
+struct HtmlGen {
+  const ws_host *host;
+  std::string server_software;
+};
+
+static std::string str(const ws_str &s) { return std::string(s.data, s.len); }
+
+static void *html_gen_init(const ws_host *host, const char *const *config) {
+  HtmlGen *gen = new (std::nothrow) HtmlGen();
+  if (gen == NULL)
+    return NULL;
+  gen->host = host;
+  gen->server_software = "webserv";
+  for (; *config != NULL; ++config) {
+    if (std::strncmp(*config, "SERVER_SOFTWARE=", 16) == 0)
+      gen->server_software = *config + 16;
+    else {
+      host->log((std::string("gen_html: unknown option ") + *config).c_str());
+      delete gen;
+      return NULL;
+    }
+  }
+  return gen;
+}
+
+static int html_gen_handle(void *state, const ws_request *req,
+                           ws_response *res) {
+  const HtmlGen &gen = *static_cast<HtmlGen *>(state);
+  std::map<std::string, std::string> standard_vars;
+  std::map<std::string, std::string> http_vars;
+
+  standard_vars["REQUEST_METHOD"] = str(req->method);
+  standard_vars["SERVER_PROTOCOL"] = "HTTP/1.1";
+  standard_vars["GATEWAY_INTERFACE"] = "CGI/1.1";
+  standard_vars["SERVER_SOFTWARE"] = gen.server_software;
+  std::string script_name = str(req->path);
+  if (script_name.length() > 1 && script_name[script_name.length() - 1] == '/')
+    script_name.erase(script_name.length() - 1);
+  standard_vars["SCRIPT_NAME"] = script_name;
+  standard_vars["PATH_INFO"] = script_name;
+  standard_vars["QUERY_STRING"] = str(req->query);
+  standard_vars["REMOTE_ADDR"] = "127.0.0.1";
+  standard_vars["REMOTE_HOST"] = "localhost";
+  standard_vars["SERVER_NAME"] = "localhost";
+  standard_vars["SERVER_PORT"] = "80";
+
+  for (size_t i = 0; i < req->header_count; ++i) {
+    std::string name = "HTTP_";
+    for (size_t j = 0; j < req->headers[i].name.len; ++j) {
+      char c = req->headers[i].name.data[j];
+      name += c == '-' ? '_'
+                       : static_cast<char>(
+                             std::toupper(static_cast<unsigned char>(c)));
+    }
+    std::string value = str(req->headers[i].value);
+    if (name == "HTTP_CONTENT_TYPE" || name == "HTTP_CONTENT_LENGTH")
+      standard_vars[name.substr(5)] = value;
+    else if (name != "HTTP_AUTHORIZATION")
+      http_vars[name] = value;
+    if (name == "HTTP_HOST" && !value.empty()) {
+      size_t colon = value.rfind(':');
+      standard_vars["SERVER_NAME"] = value.substr(0, colon);
+      if (colon != std::string::npos)
+        standard_vars["SERVER_PORT"] = value.substr(colon + 1);
+    }
+  }
+
+  std::string body = render_page(standard_vars, http_vars);
+  static const char content_type[] = "text/html; charset=UTF-8";
+  gen.host->add_header(res, "Content-Type", 12, content_type,
+                       sizeof(content_type) - 1);
+  gen.host->write(res, body.data(), body.length());
+  return 0;
+}
+
+static void html_gen_destroy(void *state) {
+  delete static_cast<HtmlGen *>(state);
+}
+
+extern "C" const ws_plugin *webserv_plugin_v1(void) {
+  static const ws_plugin plugin = {
+      WEBSERV_PLUGIN_ABI, "gen_html",      WS_PLUGIN_THREADSAFE,
+      html_gen_init,      html_gen_handle, html_gen_destroy,
+  };
+  return &plugin;
+}
@@ -0,0 +1,87 @@
+/*
+ * C ABI of webserv handler plugins.
+ *
+ * A plugin is a shared object named by a route (`GET /path &plugin.so`). It
+ * exports one function, WEBSERV_PLUGIN_SYMBOL, that describes it. The server
+ * calls init() once per route after loading the object, then handle() for
+ * every request of the route, on the event loop or, for routes marked
+ * `offload`, on one of the plugin worker threads.
+ *
+ * handle() gets a read-only view of the request, valid during the call only,
+ * and builds the response through the host functions. Plugins link against
+ * nothing of the server, so they may be written in C or C++ and built
+ * separately: cc -shared -fPIC -o plugin.so plugin.c
+ */
+#ifndef WEBSERV_PLUGIN_H
+#define WEBSERV_PLUGIN_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WEBSERV_PLUGIN_ABI 1
+#define WEBSERV_PLUGIN_SYMBOL "webserv_plugin_v1"
+
+/* handle() may run on several worker threads at once */
+#define WS_PLUGIN_THREADSAFE 0x1
+
+/* Bytes that are not NUL-terminated */
+typedef struct ws_str {
+  const char *data;
+  size_t len;
+} ws_str;
+
+typedef struct ws_header {
+  ws_str name; /* lowercase */
+  ws_str value;
+} ws_header;
+
+typedef struct ws_request {
+  ws_str method; /* "GET", "POST", ... */
+  ws_str path;   /* without the query string */
+  ws_str query;  /* after '?', empty if none */
+  const ws_header *headers;
+  size_t header_count;
+  ws_str body; /* the whole request body */
+} ws_request;
+
+/* Response under construction, owned by the server */
+typedef struct ws_response ws_response;
+
+/* Functions of the server, passed to init() */
+typedef struct ws_host {
+  unsigned int abi; /* WEBSERV_PLUGIN_ABI of the server */
+  /* 200 unless set */
+  void (*set_status)(ws_response *res, int status);
+  /* Content-Length is set by the server */
+  void (*add_header)(ws_response *res, const char *name, size_t name_len,
+                     const char *value, size_t value_len);
+  /* Appends to the body */
+  void (*write)(ws_response *res, const char *data, size_t len);
+  /* One line in the server's error log */
+  void (*log)(const char *message);
+} ws_host;
+
+typedef struct ws_plugin {
+  unsigned int abi; /* WEBSERV_PLUGIN_ABI the plugin was built against */
+  const char *name;
+  unsigned int flags; /* WS_PLUGIN_* */
+  /* config holds the route's KEY=VALUE lines and ends with NULL. Returns the
+   * state passed to handle(), or NULL if the plugin can't run. */
+  void *(*init)(const ws_host *host, const char *const *config);
+  /* Returns 0 once the response is built, or an HTTP error status the
+   * server answers with instead (500 if it is not one). */
+  int (*handle)(void *state, const ws_request *req, ws_response *res);
+  /* Called when the plugin is unloaded or replaced; may be NULL */
+  void (*destroy)(void *state);
+} ws_plugin;
+
+typedef const ws_plugin *(*ws_plugin_entry)(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WEBSERV_PLUGIN_H */
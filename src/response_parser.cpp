@@ -0,0 +1,181 @@
+#include "response_parser.h"
+#include "webserv.h"
+
+#include <cstdlib>
+#include <strings.h>
+
+ResponseParser::ResponseParser()
+    : _http(false), _head_request(false), _head_done(false), _done(false),
+      _overrun(false), _error(), _in(), _scanned(0), _body(), _status(200),
+      _headers(), _framing(Eof), _left(0), _chunks() {}
+
+ResponseParser::ResponseParser(bool http, bool head_request)
+    : _http(http), _head_request(head_request), _head_done(false),
+      _done(false), _overrun(false), _error(), _in(), _scanned(0), _body(),
+      _status(200), _headers(), _framing(Eof), _left(0), _chunks() {}
+
+ResponseParser ResponseParser::cgi() { return ResponseParser(false, false); }
+
+ResponseParser ResponseParser::http(bool head_request) {
+  return ResponseParser(true, head_request);
+}
+
+Result<Void> ResponseParser::fail(const std::string &error) {
+  _error = error;
+  _in.clear();
+  _body.clear();
+  return ERR(Void, error);
+}
+
+Result<Void> ResponseParser::feed(const char *data, size_t len) {
+  if (!_error.empty())
+    return ERR(Void, _error);
+  if (_head_done)
+    return feed_body(data, len);
+
+  _in.append(data, len);
+  // The blank line may have begun in the previous piece
+  size_t from = _scanned > 3 ? _scanned - 3 : 0;
+  _scanned = _in.size();
+  size_t lf = _in.find("\n\n", from);
+  size_t crlf = _in.find("\r\n\r\n", from);
+  if (lf != std::string::npos && (crlf == std::string::npos || lf < crlf))
+    return parse_head(lf, lf + 2);
+  if (crlf != std::string::npos)
+    return parse_head(crlf, crlf + 4);
+  return OKV;
+}
+
+// The value of a header, by case-insensitive name, or NULL
+static const std::string *
+find_header(const std::map<std::string, std::string> &headers,
+            const char *name) {
+  for (std::map<std::string, std::string>::const_iterator it = headers.begin();
+       it != headers.end(); ++it) {
+    if (strcasecmp(it->first.c_str(), name) == 0)
+      return &it->second;
+  }
+  return NULL;
+}
+
+// Splits the header block, the first end bytes of _in, into the status and
+// headers, and decides the framing of the body that follows at body_start
+Result<Void> ResponseParser::parse_head(size_t end, size_t body_start) {
+  size_t pos = 0;
+  while (pos < end) {
+    size_t eol = _in.find('\n', pos);
+    if (eol == std::string::npos || eol > end)
+      eol = end;
+    std::string line = _in.substr(pos, eol - pos);
+    bool first = pos == 0;
+    pos = eol + 1;
+    if (!line.empty() && line[line.length() - 1] == '\r')
+      line.erase(line.length() - 1);
+
+    if (first && _http && line.compare(0, 5, "HTTP/") == 0) {
+      size_t space = line.find(' ');
+      _status = space == std::string::npos
+                    ? 0
+                    : std::atoi(line.c_str() + space + 1);
+      continue;
+    }
+    size_t colon = line.find(':');
+    if (colon == std::string::npos)
+      continue;
+    std::string name = line.substr(0, colon);
+    size_t value_start = line.find_first_not_of(" \t", colon + 1);
+    std::string value =
+        value_start == std::string::npos ? "" : line.substr(value_start);
+    if (strcasecmp(name.c_str(), "Status") == 0)
+      _status = std::atoi(value.c_str());
+    else
+      _headers[name] = value;
+  }
+  if (_status < 100 || _status > 999)
+    return fail("invalid response status");
+
+  _head_done = true;
+  if (_http) {
+    const std::string *encoding = find_header(_headers, "Transfer-Encoding");
+    const std::string *length = find_header(_headers, "Content-Length");
+    if (_head_request || _status < 200 || _status == 204 || _status == 304) {
+      _framing = NoBody;
+      _done = true;
+    } else if (encoding != NULL &&
+               encoding->find("chunked") != std::string::npos) {
+      _framing = Chunked;
+      _chunks = BodyStream::chunked();
+    } else if (length != NULL) {
+      if (length->empty() ||
+          length->find_first_not_of("0123456789") != std::string::npos)
+        return fail("invalid response Content-Length");
+      _framing = Length;
+      _left = std::strtoul(length->c_str(), NULL, 10);
+      _done = _left == 0;
+    }
+  }
+
+  std::string rest = _in.substr(body_start);
+  _in.clear();
+  _scanned = 0;
+  return feed_body(rest.data(), rest.length());
+}
+
+Result<Void> ResponseParser::feed_body(const char *data, size_t len) {
+  size_t take;
+  switch (_framing) {
+  case Eof:
+    _body.append(data, len);
+    break;
+  case Length:
+    take = MIN(len, _left);
+    _body.append(data, take);
+    _left -= take;
+    _done = _left == 0;
+    _overrun = _overrun || len > take;
+    break;
+  case Chunked:
+    if (_done) {
+      _overrun = _overrun || len > 0;
+      break;
+    }
+    _in.append(data, len);
+    {
+      Result<Void> decoded =
+          _chunks.decode(_in, _body, static_cast<size_t>(-1));
+      if (!decoded.has_value())
+        return fail("response " + decoded.error());
+    }
+    if (_chunks.done()) {
+      _done = true;
+      _overrun = !_in.empty();
+      _in.clear();
+    }
+    break;
+  case NoBody:
+    _overrun = _overrun || len > 0;
+    break;
+  }
+  return OKV;
+}
+
+Result<Void> ResponseParser::finish() {
+  if (!_error.empty())
+    return ERR(Void, _error);
+  if (!_head_done) {
+    _head_done = true;
+    _framing = Eof;
+    _body.swap(_in);
+    _in.clear();
+  }
+  if (!_done && _framing != Eof)
+    return fail("response cut short by the end of the stream");
+  _done = true;
+  return OKV;
+}
+
+std::string ResponseParser::take_body() {
+  std::string taken;
+  taken.swap(_body);
+  return taken;
+}
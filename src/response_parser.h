@@ -0,0 +1,88 @@
+#ifndef RESPONSE_PARSER_H
+#define RESPONSE_PARSER_H
+
+#include "result.h"
+#include "server/BodyStream.hpp"
+#include <map>
+#include <string>
+
+/**
+ * @class ResponseParser
+ * @brief Incremental parser of the response a backend writes.
+ *
+ * Bytes are fed as they are read. The status and headers are available as
+ * soon as the blank line ending them arrives, and the body is handed out in
+ * pieces by take_body(), decoded from its framing, so a response never has
+ * to be held whole. A header block ends with CRLF CRLF or LF LF.
+ *
+ * The output of a CGI script (cgi()) takes its status from a Status header
+ * and runs until the end of the stream. An HTTP response (http()) may start
+ * with a status line instead, and ends where its Content-Length or chunked
+ * framing says, so that the connection can carry the next request; without
+ * either it runs until the end of the stream.
+ */
+class ResponseParser {
+public:
+  // Where the body ends
+  enum Framing {
+    Eof,     // at the end of the stream
+    Length,  // after Content-Length bytes
+    Chunked, // after the last chunk, decoded by take_body()
+    NoBody,  // HEAD, 1xx, 204 and 304 responses have none
+  };
+
+private:
+  bool _http;
+  bool _head_request;
+  bool _head_done;
+  bool _done;
+  bool _overrun; // bytes came after the end of the response
+  std::string _error;
+  std::string _in;   // the header block so far, or chunked bytes not decoded
+  size_t _scanned;   // of _in, searched for the blank line already
+  std::string _body; // decoded body bytes not taken yet
+  int _status;
+  std::map<std::string, std::string> _headers;
+  Framing _framing;
+  size_t _left; // Length: body bytes still to come
+  BodyStream _chunks;
+
+  ResponseParser(bool http, bool head_request);
+  Result<Void> parse_head(size_t end, size_t body_start);
+  Result<Void> feed_body(const char *data, size_t len);
+  Result<Void> fail(const std::string &error);
+
+public:
+  ResponseParser();
+  // Output of a CGI script
+  static ResponseParser cgi();
+  // Response of an HTTP backend to a request; a HEAD request gets no body
+  static ResponseParser http(bool head_request);
+
+  // Bytes read from the backend. Once it failed (a bad status or framing)
+  // it keeps failing with the same error.
+  Result<Void> feed(const char *data, size_t len);
+  // The stream ended: output without a blank line is all body, and a body
+  // cut short of its framing fails
+  Result<Void> finish();
+
+  bool head_done() const { return _head_done; }
+  // The response ended where its framing said, or at finish()
+  bool done() const { return _done; }
+  bool overrun() const { return _overrun; }
+  const std::string &error() const { return _error; }
+
+  // Status and headers, once head_done(); the Status header is left out
+  int status() const { return _status; }
+  const std::map<std::string, std::string> &headers() const {
+    return _headers;
+  }
+  Framing framing() const { return _framing; }
+
+  // Bytes held: the header block so far, then the body not taken yet
+  size_t buffered() const { return _head_done ? _body.size() : _in.size(); }
+  // Hands over the body bytes decoded since the last call
+  std::string take_body();
+};
+
+#endif // RESPONSE_PARSER_H
@@ -0,0 +1,75 @@
+#include "BodyStream.hpp"
+#include "../webserv.h"
+
+// Longest chunk-size line accepted, extensions included
+#define CHUNK_LINE_MAX 1024
+
+BodyStream BodyStream::length(size_t content_length) {
+  BodyStream body;
+  body._state = content_length > 0 ? Data : Done;
+  body._left = content_length;
+  return body;
+}
+
+BodyStream BodyStream::chunked() {
+  BodyStream body;
+  body._chunked = true;
+  body._state = Size;
+  return body;
+}
+
+void BodyStream::consumed_raw(size_t count) {
+  _left -= MIN(count, _left);
+  if (!_chunked && _left == 0)
+    _state = Done;
+}
+
+Result<Void> BodyStream::decode(std::string &in, std::string &out,
+                                size_t limit) {
+  size_t pos = 0;
+
+  while (_state != Done && pos < in.length()) {
+    if (_state == Data) {
+      if (out.length() >= limit)
+        break;
+      size_t take = MIN(MIN(_left, in.length() - pos), limit - out.length());
+      out.append(in, pos, take);
+      pos += take;
+      _left -= take;
+      _decoded += take;
+      if (_left == 0)
+        _state = _chunked ? DataEnd : Done;
+      continue;
+    }
+
+    size_t eol = in.find("\r\n", pos);
+    if (eol == std::string::npos) {
+      if (in.length() - pos > CHUNK_LINE_MAX)
+        return ERR(Void, "chunked body: line too long");
+      break; // wait for the rest of the line
+    }
+    std::string line = in.substr(pos, eol - pos);
+    pos = eol + 2;
+
+    if (_state == DataEnd) {
+      if (!line.empty())
+        return ERR(Void, "chunked body: missing CRLF after chunk data");
+      _state = Size;
+    } else if (_state == Trailer) {
+      if (line.empty())
+        _state = Done;
+    } else {
+      // chunk-size [; extensions]
+      line = line.substr(0, line.find(';'));
+      size_t end = line.find_last_not_of(" \t");
+      line.erase(end == std::string::npos ? 0 : end + 1);
+      if (line.empty() || line.length() > 15 ||
+          line.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+        return ERR(Void, "chunked body: invalid chunk size");
+      _left = std::strtoul(line.c_str(), NULL, 16);
+      _state = _left > 0 ? Data : Trailer;
+    }
+  }
+  in.erase(0, pos);
+  return OKV;
+}
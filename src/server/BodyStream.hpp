@@ -0,0 +1,49 @@
+#ifndef BODYSTREAM_HPP
+#define BODYSTREAM_HPP
+
+#include "../result.h"
+
+#include <string>
+
+/**
+ * @class BodyStream
+ * @brief Framing of a request body that is consumed as it arrives.
+ *
+ * A Content-Length body is counted down; a chunked one is decoded one piece at
+ * a time, so neither has to be held whole. decode() takes body bytes from the
+ * front of the connection's input and leaves whatever follows the body (the
+ * next pipelined request) in place.
+ */
+class BodyStream {
+  enum State {
+    Size,     // chunk-size line, up to its CRLF
+    Data,     // chunk data, or the whole Content-Length body
+    DataEnd,  // CRLF after the chunk data
+    Trailer,  // trailer fields, up to the empty line
+    Done,
+  };
+  bool _chunked;
+  State _state;
+  size_t _left;    // bytes of the current chunk, or of the body
+  size_t _decoded; // body bytes moved by decode() so far
+
+public:
+  BodyStream() : _chunked(false), _state(Done), _left(0), _decoded(0) {}
+  static BodyStream length(size_t content_length);
+  static BodyStream chunked();
+
+  // Moves body bytes from the front of in to out, stopping once out holds
+  // limit bytes. Fails on malformed chunked framing.
+  Result<Void> decode(std::string &in, std::string &out, size_t limit);
+
+  // Body bytes that may be moved without decoding (Content-Length only)
+  size_t raw_left() const { return _chunked ? 0 : _left; }
+  void consumed_raw(size_t count);
+
+  // Size of a chunked body so far, checked against the route's limit
+  size_t decoded() const { return _decoded; }
+  bool is_chunked() const { return _chunked; }
+  bool done() const { return _state == Done; }
+};
+
+#endif
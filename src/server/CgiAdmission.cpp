@@ -0,0 +1,213 @@
+#include "CgiAdmission.hpp"
+#include "../webserv.h"
+
+void CgiAdmission::set_limits(unsigned int max_running,
+                              unsigned int max_waiting) {
+  this->max_running = max_running;
+  this->max_waiting = max_waiting;
+}
+
+CgiQueue *CgiAdmission::add_script(const Config_CGI &cgi) {
+  std::map<std::string, CgiQueue>::iterator it =
+      queues.find(cgi.Get_executable());
+  if (it != queues.end())
+    return &it->second;
+
+  CgiQueue &queue = queues[cgi.Get_executable()];
+  queue.script = cgi.Get_executable();
+  queue.options = cgi.Get_queue();
+  queue.running = 0;
+  queue.started = 0;
+  queue.rejected = 0;
+  queue.expired = 0;
+  queue.waited = 0;
+  queue.wait_ms_sum = 0;
+  queue.wait_ms_max = 0;
+  queue.exited = 0;
+  queue.wall_ms_sum = 0;
+  queue.cpu_us_sum = 0;
+  return &queue;
+}
+
+CgiQueue *CgiAdmission::find(const std::string &script) {
+  std::map<std::string, CgiQueue>::iterator it = queues.find(script);
+  return it != queues.end() ? &it->second : NULL;
+}
+
+bool CgiAdmission::has_slot(const CgiQueue &queue) const {
+  return (queue.options.concurrency == 0 ||
+          queue.running < queue.options.concurrency) &&
+         (max_running == 0 || running < max_running);
+}
+
+// Newcomers queue behind the script's waiters even when a slot just freed up,
+// so that the queue stays FIFO
+CgiAdmission::Verdict CgiAdmission::admit(CgiQueue &queue,
+                                          const FileDescriptor *client,
+                                          long long now) {
+  if (try_admit(queue))
+    return Run;
+  if (queue.waiting.size() >= queue.options.max_waiting ||
+      waiting >= max_waiting) {
+    queue.rejected++;
+    return Refuse;
+  }
+  CgiWaiter waiter;
+  waiter.client = client;
+  waiter.since_ms = now;
+  queue.waiting.push_back(waiter);
+  waiting++;
+  return Wait;
+}
+
+bool CgiAdmission::try_admit(CgiQueue &queue) {
+  if (!queue.waiting.empty() || !has_slot(queue))
+    return false;
+  queue.running++;
+  queue.started++;
+  running++;
+  return true;
+}
+
+void CgiAdmission::release(CgiQueue &queue) {
+  queue.running--;
+  running--;
+}
+
+void CgiAdmission::cancel(CgiQueue &queue, const FileDescriptor *client) {
+  for (std::deque<CgiWaiter>::iterator it = queue.waiting.begin();
+       it != queue.waiting.end(); ++it) {
+    if (it->client == client) {
+      queue.waiting.erase(it);
+      waiting--;
+      return;
+    }
+  }
+}
+
+const FileDescriptor *CgiAdmission::next_ready(long long now) {
+  CgiQueue *oldest = NULL;
+  for (std::map<std::string, CgiQueue>::iterator it = queues.begin();
+       it != queues.end(); ++it) {
+    CgiQueue &queue = it->second;
+    if (queue.waiting.empty() || !has_slot(queue))
+      continue;
+    if (oldest == NULL ||
+        queue.waiting.front().since_ms < oldest->waiting.front().since_ms)
+      oldest = &queue;
+  }
+  if (oldest == NULL)
+    return NULL;
+
+  CgiWaiter waiter = oldest->waiting.front();
+  oldest->waiting.pop_front();
+  waiting--;
+  oldest->running++;
+  oldest->started++;
+  running++;
+  long long waited = now - waiter.since_ms;
+  oldest->waited++;
+  oldest->wait_ms_sum += waited;
+  oldest->wait_ms_max = MAX(oldest->wait_ms_max, waited);
+  return waiter.client;
+}
+
+// Waiters of one script share its queue_timeout, so only the oldest one of
+// each queue needs to be looked at
+const FileDescriptor *CgiAdmission::next_expired(long long now) {
+  for (std::map<std::string, CgiQueue>::iterator it = queues.begin();
+       it != queues.end(); ++it) {
+    CgiQueue &queue = it->second;
+    if (queue.waiting.empty() ||
+        now - queue.waiting.front().since_ms < queue.options.timeout_ms)
+      continue;
+    const FileDescriptor *client = queue.waiting.front().client;
+    queue.waiting.pop_front();
+    waiting--;
+    queue.expired++;
+    return client;
+  }
+  return NULL;
+}
+
+long long CgiAdmission::next_deadline() const {
+  long long deadline = -1;
+  for (std::map<std::string, CgiQueue>::const_iterator it = queues.begin();
+       it != queues.end(); ++it) {
+    const CgiQueue &queue = it->second;
+    if (queue.waiting.empty())
+      continue;
+    long long at = queue.waiting.front().since_ms + queue.options.timeout_ms;
+    if (deadline < 0 || at < deadline)
+      deadline = at;
+  }
+  return deadline;
+}
+
+void CgiAdmission::record_exit(const std::string &script, long long wall_ms,
+                               long long cpu_us) {
+  CgiQueue *queue = find(script);
+  if (queue == NULL)
+    return;
+  queue->exited++;
+  queue->wall_ms_sum += wall_ms;
+  queue->cpu_us_sum += cpu_us;
+}
+
+// One line per script and counter, e.g.
+// webserv_cgi_queued{script="slow.cgi"} 3
+static void metric(std::ostringstream &os, const char *name,
+                   const std::string &script, long long value) {
+  os << "webserv_cgi_" << name << "{script=\"" << script << "\"} " << value
+     << "\n";
+}
+
+std::string CgiAdmission::metrics() const {
+  std::ostringstream os;
+  os << "# TYPE webserv_cgi_global_running gauge\n"
+     << "webserv_cgi_global_running " << running << "\n"
+     << "# TYPE webserv_cgi_global_queued gauge\n"
+     << "webserv_cgi_global_queued " << waiting << "\n"
+     << "# TYPE webserv_cgi_global_max_running gauge\n"
+     << "webserv_cgi_global_max_running " << max_running << "\n"
+     << "# TYPE webserv_cgi_global_max_queued gauge\n"
+     << "webserv_cgi_global_max_queued " << max_waiting << "\n";
+
+  static const char *const types[][2] = {
+      {"running", "gauge"},
+      {"queued", "gauge"},
+      {"concurrency", "gauge"},
+      {"started_total", "counter"},
+      {"rejected_total", "counter"},
+      {"queue_timeouts_total", "counter"},
+      {"queue_wait_ms_count", "counter"},
+      {"queue_wait_ms_sum", "counter"},
+      {"queue_wait_ms_max", "gauge"},
+      {"exited_total", "counter"},
+      {"wall_ms_total", "counter"},
+      {"cpu_us_total", "counter"},
+  };
+  for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+    os << "# TYPE webserv_cgi_" << types[i][0] << " " << types[i][1] << "\n";
+    for (std::map<std::string, CgiQueue>::const_iterator it = queues.begin();
+         it != queues.end(); ++it) {
+      const CgiQueue &q = it->second;
+      const long long values[] = {
+          q.running,
+          static_cast<long long>(q.waiting.size()),
+          q.options.concurrency,
+          static_cast<long long>(q.started),
+          static_cast<long long>(q.rejected),
+          static_cast<long long>(q.expired),
+          static_cast<long long>(q.waited),
+          q.wait_ms_sum,
+          q.wait_ms_max,
+          static_cast<long long>(q.exited),
+          q.wall_ms_sum,
+          q.cpu_us_sum,
+      };
+      metric(os, types[i][0], q.script, values[i]);
+    }
+  }
+  return os.str();
+}
@@ -0,0 +1,88 @@
+#ifndef CGIADMISSION_HPP
+#define CGIADMISSION_HPP
+
+#include "../Config_CGI.hpp"
+#include "../file_descriptor.h"
+
+#include <deque>
+#include <map>
+#include <string>
+
+// Client waiting for a slot of its script
+struct CgiWaiter {
+  const FileDescriptor *client;
+  long long since_ms; // CLOCK_MONOTONIC, when it was queued
+};
+
+// Slots, wait queue and counters of one CGI script
+struct CgiQueue {
+  std::string script;
+  CgiQueueOptions options;
+  unsigned int running;
+  std::deque<CgiWaiter> waiting; // oldest first
+
+  unsigned long long started;  // requests given a slot
+  unsigned long long rejected; // 503 because the queue was full
+  unsigned long long expired;  // 503 after queue_timeout
+  unsigned long long waited;   // started after waiting in the queue
+  long long wait_ms_sum;
+  long long wait_ms_max;
+
+  unsigned long long exited; // scripts reaped
+  long long wall_ms_sum;
+  long long cpu_us_sum; // user + system
+};
+
+/**
+ * @class CgiAdmission
+ * @brief Caps the CGI requests running at once, per script and overall.
+ *
+ * A request that finds no free slot waits in its script's FIFO queue; it is
+ * refused right away once that queue (or all queues together) is full, and
+ * dropped from the queue after the script's queue_timeout. The server hands
+ * freed slots to the oldest waiter that may run (next_ready()), so a script
+ * held at its own cap does not block the others.
+ */
+class CgiAdmission {
+  std::map<std::string, CgiQueue> queues; // by executable
+  unsigned int max_running;               // 0: no global cap
+  unsigned int max_waiting;
+  unsigned int running;
+  unsigned int waiting;
+
+  bool has_slot(const CgiQueue &queue) const;
+
+public:
+  enum Verdict { Run, Wait, Refuse };
+
+  CgiAdmission()
+      : queues(), max_running(0), max_waiting(0), running(0), waiting(0) {}
+
+  void set_limits(unsigned int max_running, unsigned int max_waiting);
+  // The queue of the script, with the options of the first route naming it;
+  // Server::create_pools() refuses routes that set others
+  CgiQueue *add_script(const Config_CGI &cgi);
+  CgiQueue *find(const std::string &script);
+
+  // Run takes a slot, Wait queues client
+  Verdict admit(CgiQueue &queue, const FileDescriptor *client, long long now);
+  // Takes a free slot if there is one, never queues
+  bool try_admit(CgiQueue &queue);
+  void release(CgiQueue &queue);
+  void cancel(CgiQueue &queue, const FileDescriptor *client);
+
+  // Pops the oldest waiter that may run now and gives it a slot, or NULL
+  const FileDescriptor *next_ready(long long now);
+  // Pops a waiter past its queue_timeout, or NULL
+  const FileDescriptor *next_expired(long long now);
+  // Earliest queue_timeout of a waiter, -1 if none waits
+  long long next_deadline() const;
+  // Cost of one run of script, reported by the ChildManager
+  void record_exit(const std::string &script, long long wall_ms,
+                   long long cpu_us);
+
+  // Counters in the Prometheus text format
+  std::string metrics() const;
+};
+
+#endif
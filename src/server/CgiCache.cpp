@@ -0,0 +1,262 @@
+#include "CgiCache.hpp"
+#include "../webserv.h"
+
+static std::string lowercase(std::string s) {
+  for (size_t i = 0; i < s.length(); ++i)
+    s[i] = static_cast<char>(std::tolower(static_cast<unsigned char>(s[i])));
+  return s;
+}
+
+// Finds a response header whatever its case
+static std::map<std::string, std::string>::iterator
+find_header(std::map<std::string, std::string> &headers,
+            const std::string &name) {
+  for (std::map<std::string, std::string>::iterator it = headers.begin();
+       it != headers.end(); ++it) {
+    if (lowercase(it->first) == name)
+      return it;
+  }
+  return headers.end();
+}
+
+static std::string trim(const std::string &s) {
+  size_t begin = s.find_first_not_of(" \t");
+  if (begin == std::string::npos)
+    return "";
+  return s.substr(begin, s.find_last_not_of(" \t") - begin + 1);
+}
+
+// HTTP-date (RFC 7231 IMF-fixdate), -1 if it is not one
+static time_t parse_date(const std::string &value) {
+  struct tm tm;
+  std::memset(&tm, 0, sizeof(tm));
+  const char *end = strptime(value.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  if (end == NULL || *end != '\0')
+    return -1;
+  return timegm(&tm);
+}
+
+// Delta-seconds of a directive such as max-age=60, -1 if malformed
+static long long parse_seconds(const std::string &value) {
+  if (value.empty() || value.length() > 9 ||
+      value.find_first_not_of("0123456789") != std::string::npos)
+    return -1;
+  return std::strtol(value.c_str(), NULL, 10);
+}
+
+// Statuses that may be stored without explicit freshness (RFC 7231 6.1)
+static bool cacheable_status(int status) {
+  return status == 200 || status == 203 || status == 300 || status == 301 ||
+         status == 404 || status == 410;
+}
+
+size_t CgiCache::cost(const std::string &key, const CachedResponse &entry) {
+  size_t size = key.length() + entry.head.length() + entry.body.size();
+  for (size_t i = 0; i < entry.vary.size(); ++i)
+    size += entry.vary[i].first.length() + entry.vary[i].second.length();
+  return size;
+}
+
+void CgiCache::erase(std::map<std::string, CachedResponse>::iterator it) {
+  bytes -= cost(it->first, it->second);
+  lru.erase(it->second.lru);
+  entries.erase(it);
+}
+
+CgiCache::Lookup
+CgiCache::lookup(const std::string &key,
+                 const std::map<std::string, std::string> &request_headers,
+                 bool can_fill, const FileDescriptor *client, long long now,
+                 const CachedResponse *&entry) {
+  entry = NULL;
+  std::map<std::string, CachedResponse>::iterator it = entries.find(key);
+  if (it != entries.end() && now >= it->second.stale_until_ms) {
+    erase(it);
+    it = entries.end();
+  }
+  if (it != entries.end() && it->second.pass) {
+    passes++;
+    return Bypass;
+  }
+
+  bool matches = it != entries.end();
+  for (size_t i = 0; matches && i < it->second.vary.size(); ++i) {
+    std::map<std::string, std::string>::const_iterator value =
+        request_headers.find(it->second.vary[i].first);
+    matches = (value != request_headers.end() ? value->second : "") ==
+              it->second.vary[i].second;
+  }
+  bool filling = fills.find(key) != fills.end();
+  if (matches) {
+    lru.splice(lru.begin(), lru, it->second.lru);
+    entry = &it->second;
+    if (now < it->second.fresh_until_ms) {
+      hits++;
+      return Hit;
+    }
+    stale_hits++;
+    if (filling || !can_fill)
+      return Stale;
+    fills[key];
+    return Revalidate;
+  }
+
+  if (!can_fill) {
+    passes++;
+    return Bypass;
+  }
+  if (filling) {
+    fills[key].push_back(client);
+    coalesced++;
+    return Wait;
+  }
+  fills[key];
+  misses++;
+  return Fill;
+}
+
+// Freshness comes from s-maxage, max-age or Expires, in that order, and
+// otherwise from the route's TTL. Responses marked no-store, no-cache or
+// private, setting cookies or varying on everything are not stored.
+bool CgiCache::store(CacheFill &fill, long long now) {
+  std::map<std::string, std::string> &headers = fill.headers;
+  std::map<std::string, std::string>::iterator it;
+  bool storable = cacheable_status(fill.status) && !fill.overflow &&
+                  find_header(headers, "set-cookie") == headers.end();
+  long long max_age = -1;
+  long long s_maxage = -1;
+  long long stale = fill.options.stale;
+
+  if ((it = find_header(headers, "cache-control")) != headers.end()) {
+    std::vector<std::string> directives = string_split(it->second, ",");
+    for (size_t i = 0; i < directives.size(); ++i) {
+      std::string directive = lowercase(trim(directives[i]));
+      std::string name = directive.substr(0, directive.find('='));
+      std::string value = directive.find('=') == std::string::npos
+                              ? ""
+                              : directive.substr(directive.find('=') + 1);
+      if (name == "no-store" || name == "no-cache" || name == "private")
+        storable = false;
+      else if (name == "s-maxage")
+        s_maxage = parse_seconds(value);
+      else if (name == "max-age")
+        max_age = parse_seconds(value);
+      else if (name == "stale-while-revalidate" && parse_seconds(value) >= 0)
+        stale = parse_seconds(value);
+    }
+  }
+  long long ttl = s_maxage >= 0 ? s_maxage : max_age;
+  if (ttl < 0 && (it = find_header(headers, "expires")) != headers.end()) {
+    time_t expires = parse_date(it->second);
+    std::map<std::string, std::string>::iterator date =
+        find_header(headers, "date");
+    time_t origin = date != headers.end() ? parse_date(date->second) : -1;
+    if (origin == -1)
+      origin = time(NULL);
+    ttl = expires == -1 ? 0 : static_cast<long long>(expires - origin);
+  }
+  if (ttl < 0)
+    ttl = fill.options.ttl;
+
+  CachedResponse entry;
+  if ((it = find_header(headers, "vary")) != headers.end()) {
+    std::vector<std::string> names = string_split(it->second, ",");
+    for (size_t i = 0; i < names.size(); ++i) {
+      std::string name = lowercase(trim(names[i]));
+      if (name == "*")
+        storable = false;
+      std::map<std::string, std::string>::const_iterator value =
+          fill.request_headers.find(name);
+      entry.vary.push_back(std::make_pair(
+          name, value != fill.request_headers.end() ? value->second : ""));
+    }
+  }
+
+  if (storable && ttl > 0) {
+    if ((it = find_header(headers, "age")) != headers.end())
+      headers.erase(it);
+    std::ostringstream length;
+    length << fill.body.length();
+    headers["Content-Length"] = length.str();
+    Http::Body::Value none;
+    none._null = NULL;
+    entry.head = Http::Response(fill.status, headers,
+                                Http::Body(Http::Body::Empty, none))
+                     .serialize_head();
+    entry.head.erase(entry.head.length() - 2); // the empty line
+    entry.body = SharedBuffer(fill.body);
+    entry.pass = false;
+    entry.fresh_until_ms = now + ttl * 1000;
+    entry.stale_until_ms = entry.fresh_until_ms + stale * 1000;
+  } else {
+    entry.vary.clear();
+    entry.pass = true;
+    entry.fresh_until_ms =
+        now + static_cast<long long>(fill.options.ttl) * 1000;
+    entry.stale_until_ms = entry.fresh_until_ms;
+  }
+  entry.stored_ms = now;
+
+  std::map<std::string, CachedResponse>::iterator old =
+      entries.find(fill.key);
+  if (old != entries.end())
+    erase(old);
+  size_t size = cost(fill.key, entry);
+  if (size > max_bytes)
+    return false;
+  while (bytes + size > max_bytes) {
+    erase(entries.find(lru.back()));
+    evictions++;
+  }
+  lru.push_front(fill.key);
+  entry.lru = lru.begin();
+  entries[fill.key] = entry;
+  bytes += size;
+  fill.stored = !entry.pass;
+  if (fill.stored)
+    stores++;
+  return fill.stored;
+}
+
+std::vector<const FileDescriptor *> CgiCache::finish(const std::string &key) {
+  std::vector<const FileDescriptor *> waiters;
+  std::map<std::string, std::vector<const FileDescriptor *> >::iterator it =
+      fills.find(key);
+  if (it == fills.end())
+    return waiters;
+  waiters.swap(it->second);
+  fills.erase(it);
+  return waiters;
+}
+
+void CgiCache::cancel(const std::string &key, const FileDescriptor *client) {
+  std::map<std::string, std::vector<const FileDescriptor *> >::iterator it =
+      fills.find(key);
+  if (it == fills.end())
+    return;
+  std::vector<const FileDescriptor *> &waiters = it->second;
+  waiters.erase(std::remove(waiters.begin(), waiters.end(), client),
+                waiters.end());
+}
+
+std::string CgiCache::metrics() const {
+  static const char *const names[] = {
+      "hits_total",     "stale_hits_total", "misses_total",
+      "coalesced_total", "bypassed_total",  "stores_total",
+      "evictions_total",
+  };
+  const unsigned long long values[] = {
+      hits, stale_hits, misses, coalesced, passes, stores, evictions,
+  };
+  std::ostringstream os;
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+    os << "# TYPE webserv_cgi_cache_" << names[i] << " counter\n"
+       << "webserv_cgi_cache_" << names[i] << " " << values[i] << "\n";
+  os << "# TYPE webserv_cgi_cache_entries gauge\n"
+     << "webserv_cgi_cache_entries " << entries.size() << "\n"
+     << "# TYPE webserv_cgi_cache_bytes gauge\n"
+     << "webserv_cgi_cache_bytes " << bytes << "\n"
+     << "# TYPE webserv_cgi_cache_max_bytes gauge\n"
+     << "webserv_cgi_cache_max_bytes " << max_bytes << "\n";
+  return os.str();
+}
@@ -0,0 +1,109 @@
+#ifndef CGICACHE_HPP
+#define CGICACHE_HPP
+
+#include "../Config_CGI.hpp"
+#include "../file_descriptor.h"
+#include "OutputQueue.hpp"
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+// Response of a cache fill, collected while the script's output is relayed
+struct CacheFill {
+  std::string key;
+  CgiCacheOptions options; // of the route
+  // Request headers (lowercase names) the response may Vary on
+  std::map<std::string, std::string> request_headers;
+  // Revalidation of a stale entry: the client was answered with that entry
+  // and the script's output only goes to the cache
+  bool background;
+  int status;
+  std::map<std::string, std::string> headers; // without the framing
+  std::string body;
+  bool overflow; // body larger than CGI_CACHE_MAX_ENTRY, not stored
+  bool stored;   // set by CgiCache::store()
+};
+
+// Stored response; serving it copies the head only
+struct CachedResponse {
+  std::string head; // status line and headers with Content-Length, without
+                    // the empty line that ends them
+  SharedBuffer body;
+  // Request headers named by Vary and their values (lowercase names)
+  std::vector<std::pair<std::string, std::string> > vary;
+  bool pass;           // uncacheable response: requests skip the cache
+  long long stored_ms; // CLOCK_MONOTONIC, for the Age header
+  long long fresh_until_ms;
+  long long stale_until_ms; // then the entry is dropped
+  std::list<std::string>::iterator lru;
+};
+
+/**
+ * @class CgiCache
+ * @brief Short-lived cache of CGI GET responses with single-flight fills.
+ *
+ * A miss makes its request the fill of the key: the script runs once and
+ * the requests that miss the same key in the meantime wait for it (Wait)
+ * instead of starting the script again. finish() hands them back to the
+ * server, which serves them from the new entry. A stale entry is still
+ * served during its stale window while one request refreshes it
+ * (Revalidate). Responses that may not be stored leave a pass entry for the
+ * route's TTL, so that requests to them are not serialized behind fills.
+ * Entries are evicted least recently used first once they take more than
+ * the cgi_cache limit.
+ */
+class CgiCache {
+  std::map<std::string, CachedResponse> entries;
+  std::list<std::string> lru; // most recently used first
+  // Keys being filled and the clients waiting for them
+  std::map<std::string, std::vector<const FileDescriptor *> > fills;
+  size_t max_bytes;
+  size_t bytes;
+
+  unsigned long long hits;
+  unsigned long long stale_hits;
+  unsigned long long misses;
+  unsigned long long coalesced;
+  unsigned long long passes;
+  unsigned long long stores;
+  unsigned long long evictions;
+
+  static size_t cost(const std::string &key, const CachedResponse &entry);
+  void erase(std::map<std::string, CachedResponse>::iterator it);
+
+public:
+  enum Lookup {
+    Hit,        // fresh entry
+    Stale,      // stale entry, already being refreshed
+    Revalidate, // stale entry; the caller refreshes it in the background
+    Fill,       // miss; the caller runs the script and store()s the result
+    Wait,       // miss; the client waits for the fill in flight
+    Bypass,     // the request runs as if there was no cache
+  };
+
+  CgiCache()
+      : entries(), lru(), fills(), max_bytes(0), bytes(0), hits(0),
+        stale_hits(0), misses(0), coalesced(0), passes(0), stores(0),
+        evictions(0) {}
+
+  void set_limit(size_t max_bytes) { this->max_bytes = max_bytes; }
+
+  // entry is set for Hit, Stale and Revalidate. Only requests that may fill
+  // (GET) start fills or wait for them.
+  Lookup lookup(const std::string &key,
+                const std::map<std::string, std::string> &request_headers,
+                bool can_fill, const FileDescriptor *client, long long now,
+                const CachedResponse *&entry);
+  // Stores the response of a fill if its status and headers allow it
+  bool store(CacheFill &fill, long long now);
+  // Ends the fill of key; returns the clients that waited for it
+  std::vector<const FileDescriptor *> finish(const std::string &key);
+  void cancel(const std::string &key, const FileDescriptor *client);
+
+  // Counters in the Prometheus text format
+  std::string metrics() const;
+};
+
+#endif
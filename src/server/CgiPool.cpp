@@ -0,0 +1,136 @@
+#include "CgiPool.hpp"
+#include "../webserv.h"
+
+CgiPool::CgiPool(const Config_CGI &cgi, EPoll &epoll, ChildManager &children)
+    : script(cgi.Get_executable()), route_env(cgi.Get_env_block()), env(),
+      options(cgi.Get_pool()), epoll(epoll), children(children), workers(),
+      waiting() {
+  env.add_block(route_env);
+  env.add("GATEWAY_INTERFACE=CGI/1.1");
+  env.add("WEBSERV_POOL=1");
+}
+
+bool CgiPool::matches(const Config_CGI &cgi) const {
+  return options == cgi.Get_pool() && route_env == cgi.Get_env_block();
+}
+
+CgiPool::~CgiPool() {
+  while (!workers.empty())
+    remove(workers.begin(), 0);
+}
+
+Result<CgiWorker *> CgiPool::spawn(long long now) {
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+    return ERR(CgiWorker *,
+               std::string("`socketpair` failed: ") + strerror(errno));
+
+  Result<pid_t> spawned = spawn_script(script, env.envp(), sv[1], sv[1]);
+  close(sv[1]);
+  if (!spawned.has_value()) {
+    close(sv[0]);
+    return ERR(CgiWorker *, spawned.error());
+  }
+  pid_t pid = spawned.value();
+
+  FileDescriptor sock = FileDescriptor::from_raw(sv[0]).value();
+  Result<Void> nb_result = sock.set_nonblocking();
+  Event event(&sock, true, true, false, false, false, false);
+  Option option(true, false, false, false);
+  Result<FileDescriptor *> add_result =
+      nb_result.has_value() ? epoll.add_fd(sock, event, option)
+                            : ERR(FileDescriptor *, nb_result.error());
+  if (!add_result.has_value()) {
+    kill(-pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return ERR(CgiWorker *, add_result.error());
+  }
+
+  children.watch(pid, script, now);
+  CgiWorker worker;
+  worker.pid = pid;
+  worker.sock = add_result.value();
+  worker.served = 0;
+  worker.idle_since_ms = now;
+  worker.busy = false;
+  workers.push_front(worker);
+  return OK(CgiWorker *, &workers.front());
+}
+
+// Stops the worker and closes its socket; the ChildManager reaps it
+void CgiPool::remove(std::list<CgiWorker>::iterator it, long long now) {
+  children.terminate(it->pid, now);
+  epoll.del_fd(*it->sock);
+  workers.erase(it);
+}
+
+std::list<CgiWorker>::iterator CgiPool::find(const CgiWorker *worker) {
+  std::list<CgiWorker>::iterator it = workers.begin();
+  while (it != workers.end() && &*it != worker)
+    ++it;
+  return it;
+}
+
+Result<CgiWorker *> CgiPool::acquire(long long now) {
+  for (std::list<CgiWorker>::iterator it = workers.begin();
+       it != workers.end(); ++it) {
+    if (!it->busy) {
+      it->busy = true;
+      return OK(CgiWorker *, &*it);
+    }
+  }
+  if (workers.size() >= options.max_workers)
+    return OK(CgiWorker *, NULL);
+  Result<CgiWorker *> res = spawn(now);
+  if (res.has_value())
+    res.value()->busy = true;
+  return res;
+}
+
+void CgiPool::release(CgiWorker *worker, long long now) {
+  std::list<CgiWorker>::iterator it = find(worker);
+  if (it == workers.end())
+    return;
+  it->served++;
+  if (options.max_requests > 0 && it->served >= options.max_requests) {
+    remove(it, now);
+    return;
+  }
+  it->busy = false;
+  it->idle_since_ms = now;
+  // Reused first, so that the extra workers of a burst go idle and expire
+  workers.splice(workers.begin(), workers, it);
+}
+
+void CgiPool::discard(CgiWorker *worker, long long now) {
+  std::list<CgiWorker>::iterator it = find(worker);
+  if (it != workers.end())
+    remove(it, now);
+}
+
+void CgiPool::maintain(long long now) {
+  // Busy workers are watched through their socket by Server::cgi_event()
+  std::list<CgiWorker>::iterator it = workers.begin();
+  while (it != workers.end()) {
+    std::list<CgiWorker>::iterator worker = it++;
+    if (worker->busy)
+      continue;
+    if (!children.running(worker->pid)) {
+      std::cerr << "WARNING: CGI worker " << script << " exited" << std::endl;
+      epoll.del_fd(*worker->sock);
+      workers.erase(worker);
+    } else if (workers.size() > options.min_workers &&
+               now - worker->idle_since_ms >=
+                   static_cast<long long>(options.idle_timeout) * 1000)
+      remove(worker, now);
+  }
+
+  while (workers.size() < options.min_workers) {
+    Result<CgiWorker *> res = spawn(now);
+    if (!res.has_value()) {
+      std::cerr << "ERROR: CGI worker " << script << ": " << res.error()
+                << std::endl;
+      break;
+    }
+  }
+}
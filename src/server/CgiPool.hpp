@@ -0,0 +1,75 @@
+#ifndef CGIPOOL_HPP
+#define CGIPOOL_HPP
+
+#include "../Config_CGI.hpp"
+#include "../cgi_1_1.h"
+#include "../epoll_kqueue.h"
+#include "ChildManager.hpp"
+
+#include <deque>
+#include <list>
+#include <string>
+#include <sys/types.h>
+
+// One long-lived process of a pooled CGI script
+struct CgiWorker {
+  pid_t pid;
+  const FileDescriptor *sock; // server end of the socketpair, owned by EPoll
+  unsigned int served;        // requests answered so far
+  long long idle_since_ms;    // when the worker last became idle
+  bool busy;
+};
+
+/**
+ * @class CgiPool
+ * @brief Long-lived workers of one CGI script, FastCGI-style.
+ *
+ * Workers are started with one end of a socketpair as stdin and stdout and
+ * WEBSERV_POOL=1 in the environment. A request is sent as two frames, the
+ * NUL-separated environment and the body, each prefixed with its length as
+ * 4 big-endian bytes; the worker answers with one frame holding the usual CGI
+ * output. Scripts that don't check WEBSERV_POOL keep running as plain CGI/1.1.
+ *
+ * The sockets are registered with the server's EPoll (IN|OUT, edge-triggered)
+ * and driven by Server::cgi_event() while a worker is busy. The processes are
+ * reaped by the server's ChildManager.
+ */
+class CgiPool {
+  std::string script;
+  std::string route_env; // NAME=VALUE of the route, as in Config_CGI
+  EnvBlock env;          // the same plus WEBSERV_POOL
+  CgiPoolOptions options;
+  EPoll &epoll;
+  ChildManager &children;
+  std::list<CgiWorker> workers; // most recently used first
+
+  Result<CgiWorker *> spawn(long long now);
+  void remove(std::list<CgiWorker>::iterator it, long long now);
+  std::list<CgiWorker>::iterator find(const CgiWorker *worker);
+
+  CgiPool(const CgiPool &);
+  CgiPool &operator=(const CgiPool &);
+
+public:
+  // Clients whose request waits for a worker, in arrival order
+  std::deque<const FileDescriptor *> waiting;
+
+  CgiPool(const Config_CGI &cgi, EPoll &epoll, ChildManager &children);
+  ~CgiPool();
+
+  // Whether another route of the script asks for the same workers
+  bool matches(const Config_CGI &cgi) const;
+
+  // An idle worker, a new one while below max_workers, or NULL when all
+  // workers are busy
+  Result<CgiWorker *> acquire(long long now);
+  // The worker answered its request; it is replaced after max_requests
+  void release(CgiWorker *worker, long long now);
+  // The worker failed or was abandoned in the middle of a request
+  void discard(CgiWorker *worker, long long now);
+  // Replaces crashed workers up to min_workers and stops the ones idle for
+  // longer than idle_timeout
+  void maintain(long long now);
+};
+
+#endif
@@ -0,0 +1,154 @@
+#include "ChildManager.hpp"
+#include "../webserv.h"
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+static long long to_us(const struct timeval &tv) {
+  return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// pidfd_open(2) has no libc wrapper before glibc 2.36
+static int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+  (void)pid;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+// Signals the process group of the child (scripts are started in their own),
+// or the child alone if it already left it
+static void signal_group(pid_t pid, int sig) {
+  if (kill(-pid, sig) == -1)
+    kill(pid, sig);
+}
+
+ChildManager::~ChildManager() {
+  for (std::map<pid_t, Child>::iterator it = children.begin();
+       it != children.end(); ++it) {
+    signal_group(it->first, SIGKILL);
+    waitpid(it->first, NULL, 0);
+    if (it->second.pidfd != NULL)
+      epoll.del_fd(*it->second.pidfd);
+  }
+}
+
+void ChildManager::watch(pid_t pid, const std::string &name, long long now) {
+  Child child;
+  child.name = name;
+  child.started_ms = now;
+  child.terminated = false;
+  child.kill_at_ms = -1;
+  child.pidfd = NULL;
+
+  int raw = open_pidfd(pid);
+  if (raw != -1) {
+    fcntl(raw, F_SETFD, FD_CLOEXEC);
+    FileDescriptor fd = FileDescriptor::from_raw(raw).value();
+    Event event(&fd, true, false, false, false, false, false);
+    Option option(true, false, false, false);
+    Result<FileDescriptor *> res = epoll.add_fd(fd, event, option);
+    if (res.has_value()) {
+      child.pidfd = res.value();
+      pidfds[child.pidfd] = pid;
+    }
+  }
+  if (child.pidfd == NULL)
+    polled++;
+  children[pid] = child;
+}
+
+void ChildManager::terminate(pid_t pid, long long now) {
+  std::map<pid_t, Child>::iterator it = children.find(pid);
+  if (it == children.end() || it->second.terminated)
+    return;
+  signal_group(pid, SIGTERM);
+  it->second.terminated = true;
+  it->second.kill_at_ms = now + CHILD_KILL_GRACE;
+}
+
+bool ChildManager::running(pid_t pid) const {
+  return children.find(pid) != children.end();
+}
+
+bool ChildManager::owns(const FileDescriptor *fd) const {
+  return pidfds.find(fd) != pidfds.end();
+}
+
+// Reaps pid if it has exited and stops watching it
+bool ChildManager::collect(pid_t pid, long long now, ChildExit &exit) {
+  Child &child = children.at(pid);
+  // What is left of a terminated script's process group goes with it once
+  // the leader has exited, not before: it got SIGTERM and its grace period.
+  // Sent while the unreaped leader still holds the group id (WNOWAIT).
+  if (child.terminated) {
+    siginfo_t info;
+    info.si_pid = 0;
+    if (waitid(P_PID, static_cast<id_t>(pid), &info,
+               WEXITED | WNOHANG | WNOWAIT) == 0 &&
+        info.si_pid == pid)
+      kill(-pid, SIGKILL);
+  }
+
+  int status;
+  struct rusage usage;
+  pid_t res = wait4(pid, &status, WNOHANG, &usage);
+  if (res == 0)
+    return false;
+
+  exit.pid = pid;
+  exit.name = child.name;
+  exit.status = res == -1 ? -1 : status;
+  exit.terminated = child.terminated;
+  exit.wall_ms = now - child.started_ms;
+  exit.user_us = res == -1 ? 0 : to_us(usage.ru_utime);
+  exit.sys_us = res == -1 ? 0 : to_us(usage.ru_stime);
+
+  if (child.pidfd != NULL) {
+    pidfds.erase(child.pidfd);
+    epoll.del_fd(*child.pidfd);
+  } else
+    polled--;
+  children.erase(pid);
+  return true;
+}
+
+bool ChildManager::reap(const FileDescriptor *pidfd, long long now,
+                        ChildExit &exit) {
+  std::map<const FileDescriptor *, pid_t>::iterator it = pidfds.find(pidfd);
+  if (it == pidfds.end())
+    return false;
+  return collect(it->second, now, exit);
+}
+
+void ChildManager::sweep(long long now, std::vector<ChildExit> &exits) {
+  std::vector<pid_t> pids;
+  for (std::map<pid_t, Child>::iterator it = children.begin();
+       it != children.end(); ++it) {
+    if (it->second.kill_at_ms >= 0 && now >= it->second.kill_at_ms) {
+      signal_group(it->first, SIGKILL);
+      it->second.kill_at_ms = -1;
+    }
+    if (it->second.pidfd == NULL)
+      pids.push_back(it->first);
+  }
+  for (size_t i = 0; i < pids.size(); ++i) {
+    ChildExit exit;
+    if (collect(pids[i], now, exit))
+      exits.push_back(exit);
+  }
+}
+
+long long ChildManager::next_deadline(long long now) const {
+  long long deadline = polled > 0 ? now + CGI_REAP_INTERVAL : -1;
+  for (std::map<pid_t, Child>::const_iterator it = children.begin();
+       it != children.end(); ++it) {
+    long long at = it->second.kill_at_ms;
+    if (at >= 0 && (deadline < 0 || at < deadline))
+      deadline = at;
+  }
+  return deadline;
+}
@@ -0,0 +1,73 @@
+#ifndef CHILDMANAGER_HPP
+#define CHILDMANAGER_HPP
+
+#include "../epoll_kqueue.h"
+
+#include <map>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+// How a child process ended, and what it cost
+struct ChildExit {
+  pid_t pid;
+  std::string name; // executable, for the logs
+  int status;       // wait status, -1 if the child was lost
+  bool terminated;  // killed by terminate()
+  long long wall_ms;
+  long long user_us; // CPU time of the child (not of its own children)
+  long long sys_us;
+};
+
+/**
+ * @class ChildManager
+ * @brief Reaps the server's child processes from the event loop.
+ *
+ * Every child is watched through a pidfd registered with the server's EPoll
+ * (IN becomes ready when it exits), so its exit status and resource usage are
+ * collected with wait4(WNOHANG) as soon as it is known, without polling or
+ * blocking. Kernels without pidfd_open() fall back to polling those children
+ * every CGI_REAP_INTERVAL.
+ *
+ * terminate() sends SIGTERM to the child's process group and SIGKILL once
+ * CHILD_KILL_GRACE ms have passed; the child stays tracked until it is
+ * reaped, so an abandoned script never becomes a zombie.
+ */
+class ChildManager {
+  struct Child {
+    std::string name;
+    long long started_ms;
+    bool terminated;             // terminate() was called
+    long long kill_at_ms;        // SIGKILL then, -1 if none is due
+    const FileDescriptor *pidfd; // owned by EPoll, NULL: polled
+  };
+  EPoll &epoll;
+  std::map<pid_t, Child> children;
+  std::map<const FileDescriptor *, pid_t> pidfds;
+  size_t polled; // children without a pidfd
+
+  bool collect(pid_t pid, long long now, ChildExit &exit);
+
+  ChildManager(const ChildManager &);
+  ChildManager &operator=(const ChildManager &);
+
+public:
+  explicit ChildManager(EPoll &epoll) : epoll(epoll), polled(0) {}
+  // Kills and reaps the children still running
+  ~ChildManager();
+
+  void watch(pid_t pid, const std::string &name, long long now);
+  // SIGTERM now, SIGKILL after CHILD_KILL_GRACE
+  void terminate(pid_t pid, long long now);
+  bool running(pid_t pid) const;
+
+  bool owns(const FileDescriptor *fd) const;
+  // EPOLLIN on the pidfd of a child; false if it hasn't actually exited
+  bool reap(const FileDescriptor *pidfd, long long now, ChildExit &exit);
+  // Sends the SIGKILLs that are due and reaps the polled children
+  void sweep(long long now, std::vector<ChildExit> &exits);
+  // Next SIGKILL or poll, -1 if there is nothing to wait for
+  long long next_deadline(long long now) const;
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include "OutputQueue.hpp"
+#include "../webserv.h"
+
+#include <climits>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// Upper bound on iovecs gathered per sendmsg() call
+#define OUTPUT_IOV_BATCH MIN(64, IOV_MAX)
+
+SharedBuffer::SharedBuffer(const std::string &data) : _rep(new Rep) {
+  _rep->data = data;
+  _rep->refs = 1;
+}
+
+SharedBuffer::SharedBuffer(const SharedBuffer &other) : _rep(other._rep) {
+  if (_rep)
+    _rep->refs++;
+}
+
+SharedBuffer &SharedBuffer::operator=(const SharedBuffer &other) {
+  if (_rep != other._rep) {
+    release();
+    _rep = other._rep;
+    if (_rep)
+      _rep->refs++;
+  }
+  return *this;
+}
+
+void SharedBuffer::release() {
+  if (_rep && --_rep->refs == 0)
+    delete _rep;
+  _rep = NULL;
+}
+
+SharedFile::SharedFile(int fd) : _rep(new Rep) {
+  _rep->fd = fd;
+  _rep->refs = 1;
+}
+
+SharedFile::SharedFile(const SharedFile &other) : _rep(other._rep) {
+  if (_rep)
+    _rep->refs++;
+}
+
+SharedFile &SharedFile::operator=(const SharedFile &other) {
+  if (_rep != other._rep) {
+    release();
+    _rep = other._rep;
+    if (_rep)
+      _rep->refs++;
+  }
+  return *this;
+}
+
+void SharedFile::release() {
+  if (_rep && --_rep->refs == 0) {
+    ::close(_rep->fd);
+    delete _rep;
+  }
+  _rep = NULL;
+}
+
+void OutputQueue::push(const std::string &bytes) {
+  if (!bytes.empty())
+    push(SharedBuffer(bytes));
+}
+
+void OutputQueue::push(const SharedBuffer &buf) {
+  if (buf.size() == 0)
+    return;
+  Segment seg;
+  seg.buf = buf;
+  seg.offset = 0;
+  seg.length = buf.size();
+  _segments.push_back(seg);
+  _size += seg.length;
+}
+
+void OutputQueue::push_file(const SharedFile &file, off_t offset,
+                            size_t length) {
+  if (length == 0)
+    return;
+  Segment seg;
+  seg.file = file;
+  seg.offset = offset;
+  seg.length = length;
+  _segments.push_back(seg);
+  _size += seg.length;
+}
+
+Result<size_t> OutputQueue::flush(const FileDescriptor &sock) {
+  size_t total = 0;
+
+  while (!_segments.empty()) {
+    Segment &head = _segments.front();
+    ssize_t sent;
+
+    if (head.file.is_open()) {
+      Result<ssize_t> res =
+          sock.send_file(head.file.fd(), &head.offset, head.length);
+      if (!res.has_value())
+        return ERR(size_t, res.error());
+      sent = res.value();
+      if (sent == 0)
+        break; // EWOULDBLOCK
+      head.length -= static_cast<size_t>(sent);
+      if (head.length == 0)
+        _segments.pop_front();
+    } else {
+      struct iovec iov[OUTPUT_IOV_BATCH];
+      size_t iovcnt = 0;
+      int flags = 0;
+      for (std::deque<Segment>::iterator it = _segments.begin();
+           it != _segments.end() && iovcnt < OUTPUT_IOV_BATCH; ++it) {
+        if (it->file.is_open()) {
+          flags = MSG_MORE; // the file body goes out with the next call
+          break;
+        }
+        iov[iovcnt].iov_base =
+            const_cast<char *>(it->buf.data() + it->offset);
+        iov[iovcnt].iov_len = it->length;
+        iovcnt++;
+      }
+      Result<ssize_t> res = sock.sock_sendmsg(iov, iovcnt, flags);
+      if (!res.has_value())
+        return ERR(size_t, res.error());
+      sent = res.value();
+      if (sent == 0)
+        break; // EWOULDBLOCK
+      size_t left = static_cast<size_t>(sent);
+      while (left > 0) {
+        Segment &seg = _segments.front();
+        if (left < seg.length) {
+          seg.offset += static_cast<off_t>(left);
+          seg.length -= left;
+          break;
+        }
+        left -= seg.length;
+        _segments.pop_front();
+      }
+    }
+    total += static_cast<size_t>(sent);
+    _size -= static_cast<size_t>(sent);
+  }
+  return OK(size_t, total);
+}
@@ -0,0 +1,87 @@
+#ifndef OUTPUTQUEUE_HPP
+#define OUTPUTQUEUE_HPP
+
+#include "../file_descriptor.h"
+
+#include <deque>
+#include <string>
+#include <sys/types.h>
+
+// Reference-counted immutable byte buffer. Copies share the same storage, so
+// a pre-serialized header block or a cached body can be queued on many
+// connections without being copied.
+class SharedBuffer {
+  struct Rep {
+    std::string data;
+    size_t refs;
+  };
+  Rep *_rep;
+
+  void release();
+
+public:
+  SharedBuffer() : _rep(NULL) {}
+  explicit SharedBuffer(const std::string &data);
+  SharedBuffer(const SharedBuffer &other);
+  SharedBuffer &operator=(const SharedBuffer &other);
+  ~SharedBuffer() { release(); }
+
+  const char *data() const { return _rep ? _rep->data.data() : NULL; }
+  size_t size() const { return _rep ? _rep->data.size() : 0; }
+};
+
+// Reference-counted open file; the descriptor is closed with the last copy.
+class SharedFile {
+  struct Rep {
+    int fd;
+    size_t refs;
+  };
+  Rep *_rep;
+
+  void release();
+
+public:
+  SharedFile() : _rep(NULL) {}
+  explicit SharedFile(int fd);
+  SharedFile(const SharedFile &other);
+  SharedFile &operator=(const SharedFile &other);
+  ~SharedFile() { release(); }
+
+  bool is_open() const { return _rep != NULL; }
+  int fd() const { return _rep ? _rep->fd : -1; }
+};
+
+/**
+ * @class OutputQueue
+ * @brief Pending response bytes of one connection, kept as separate segments.
+ *
+ * Headers and bodies are queued without being concatenated. flush() gathers
+ * the leading memory segments into a single sendmsg() call and sends file
+ * regions with sendfile(), passing MSG_MORE when a file body follows so the
+ * headers and the first body bytes share a packet.
+ */
+class OutputQueue {
+  struct Segment {
+    SharedBuffer buf;
+    SharedFile file;
+    off_t offset; // position in buf, or in file
+    size_t length;
+  };
+  std::deque<Segment> _segments;
+  size_t _size;
+
+public:
+  OutputQueue() : _segments(), _size(0) {}
+
+  void push(const std::string &bytes);
+  void push(const SharedBuffer &buf);
+  void push_file(const SharedFile &file, off_t offset, size_t length);
+
+  bool empty() const { return _segments.empty(); }
+  size_t size() const { return _size; }
+
+  // Sends as much as the socket accepts; returns the number of bytes sent.
+  Result<size_t> flush(const FileDescriptor &sock);
+};
+
+#endif
@@ -0,0 +1,345 @@
+#include "PluginHost.hpp"
+#include "../webserv.h"
+
+#include <dlfcn.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+// Set by SIGHUP; the server loop reloads the plugins once it sees it
+volatile sig_atomic_t g_reloadPlugins = 0;
+
+void request_reload(const int) throw() { g_reloadPlugins = 1; }
+
+static void host_set_status(ws_response *res, int status) {
+  res->status = status;
+}
+
+static void host_add_header(ws_response *res, const char *name,
+                            size_t name_len, const char *value,
+                            size_t value_len) {
+  res->headers[std::string(name, name_len)] = std::string(value, value_len);
+}
+
+static void host_write(ws_response *res, const char *data, size_t len) {
+  res->body.append(data, len);
+}
+
+// One write(2), so that lines of concurrent workers don't interleave
+static void host_log(const char *message) {
+  std::string line = std::string("plugin: ") + message + "\n";
+  ssize_t written = write(STDERR_FILENO, line.data(), line.length());
+  (void)written;
+}
+
+static const ws_host host_functions = {
+    WEBSERV_PLUGIN_ABI, host_set_status, host_add_header, host_write,
+    host_log,
+};
+
+static ws_str view(const std::string &s) {
+  ws_str str;
+  str.data = s.data();
+  str.len = s.length();
+  return str;
+}
+
+// Copies the file at path into fd
+static Result<Void> copy_file(const std::string &path, int fd) {
+  int in = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in == -1)
+    return ERR(Void, strerror(errno));
+  char buf[64 * 1024];
+  ssize_t n;
+  while ((n = read(in, buf, sizeof(buf))) > 0) {
+    if (write(fd, buf, static_cast<size_t>(n)) != n) {
+      std::string error = strerror(errno);
+      close(in);
+      return ERR(Void, error);
+    }
+  }
+  std::string error = n == -1 ? strerror(errno) : "";
+  close(in);
+  if (!error.empty())
+    return ERR(Void, error);
+  return OKV;
+}
+
+PluginHost::PluginHost(EPoll &epoll)
+    : epoll(epoll), libraries(), configs(), threads(), todo(), done(),
+      stopping(false), wakeup(NULL) {
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&wake, NULL);
+}
+
+PluginHost::~PluginHost() {
+  pthread_mutex_lock(&lock);
+  stopping = true;
+  pthread_cond_broadcast(&wake);
+  pthread_mutex_unlock(&lock);
+  for (size_t i = 0; i < threads.size(); ++i)
+    pthread_join(threads[i], NULL);
+
+  while (!todo.empty()) {
+    release(todo.front());
+    todo.pop_front();
+  }
+  while (!done.empty()) {
+    release(done.front());
+    done.pop_front();
+  }
+  for (std::map<std::string, PluginLibrary *>::iterator it =
+           libraries.begin();
+       it != libraries.end(); ++it)
+    close_library(it->second);
+  if (wakeup != NULL)
+    epoll.del_fd(*wakeup);
+  pthread_cond_destroy(&wake);
+  pthread_mutex_destroy(&lock);
+}
+
+// dlopen() hands out the object it already has for a path, so a reload would
+// get the old code back. The object is loaded from a private copy instead,
+// unlinked right away.
+Result<PluginLibrary *> PluginHost::open_library(const Config_Plugin &plugin) {
+  const std::string &path = plugin.Get_library();
+  char copy[] = "/tmp/webserv-plugin-XXXXXX.so";
+  int fd = mkstemps(copy, 3);
+  if (fd == -1)
+    return ERR(PluginLibrary *, path + ": " + strerror(errno));
+  Result<Void> copied = copy_file(path, fd);
+  close(fd);
+  void *handle = NULL;
+  std::string error;
+  if (!copied.has_value())
+    error = copied.error();
+  else if ((handle = dlopen(copy, RTLD_NOW | RTLD_LOCAL)) == NULL)
+    error = dlerror();
+  unlink(copy);
+  if (handle == NULL)
+    return ERR(PluginLibrary *, path + ": " + error);
+
+  ws_plugin_entry entry = reinterpret_cast<ws_plugin_entry>(
+      dlsym(handle, WEBSERV_PLUGIN_SYMBOL));
+  const ws_plugin *desc = entry != NULL ? entry() : NULL;
+  if (desc == NULL || desc->handle == NULL || desc->init == NULL)
+    error = "no " WEBSERV_PLUGIN_SYMBOL "() describing a handler";
+  else if (desc->abi != WEBSERV_PLUGIN_ABI)
+    error = "built for another plugin ABI";
+  else if (plugin.Get_offload() && !(desc->flags & WS_PLUGIN_THREADSAFE))
+    error = "offload needs a plugin marked WS_PLUGIN_THREADSAFE";
+  if (!error.empty()) {
+    dlclose(handle);
+    return ERR(PluginLibrary *, path + ": " + error);
+  }
+
+  const std::vector<std::string> &config = plugin.Get_config();
+  std::vector<const char *> argv;
+  for (size_t i = 0; i < config.size(); ++i)
+    argv.push_back(config[i].c_str());
+  argv.push_back(NULL);
+  void *state = desc->init(&host_functions, &argv[0]);
+  if (state == NULL) {
+    dlclose(handle);
+    return ERR(PluginLibrary *, path + ": init failed");
+  }
+
+  PluginLibrary *library = new PluginLibrary();
+  library->name = path;
+  library->handle = handle;
+  library->plugin = desc;
+  library->state = state;
+  library->in_flight = 0;
+  library->retired = false;
+  return OK(PluginLibrary *, library);
+}
+
+void PluginHost::close_library(PluginLibrary *library) {
+  if (library->plugin->destroy != NULL)
+    library->plugin->destroy(library->state);
+  dlclose(library->handle);
+  delete library;
+}
+
+void *PluginHost::work(void *arg) {
+  PluginHost &host = *static_cast<PluginHost *>(arg);
+  uint64_t one = 1;
+
+  pthread_mutex_lock(&host.lock);
+  while (true) {
+    while (host.todo.empty() && !host.stopping)
+      pthread_cond_wait(&host.wake, &host.lock);
+    if (host.stopping)
+      break;
+    PluginCall *call = host.todo.front();
+    host.todo.pop_front();
+    pthread_mutex_unlock(&host.lock);
+
+    call->result = call->library->plugin->handle(
+        call->library->state, &call->request, &call->response);
+
+    pthread_mutex_lock(&host.lock);
+    host.done.push_back(call);
+    host.wakeup->fd_write(&one, sizeof(one));
+  }
+  pthread_mutex_unlock(&host.lock);
+  return NULL;
+}
+
+Result<Void> PluginHost::start_threads(unsigned int count) {
+  int raw = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (raw == -1)
+    return ERR(Void, std::string("eventfd: ") + strerror(errno));
+  FileDescriptor fd = FileDescriptor::from_raw(raw).value();
+  Event event(&fd, true, false, false, false, false, false);
+  Option option(true, false, false, false);
+  Result<FileDescriptor *> res = epoll.add_fd(fd, event, option);
+  if (!res.has_value())
+    return ERR(Void, res.error());
+  wakeup = res.value();
+
+  // Signals are left to the event loop
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  int error = 0;
+  for (unsigned int i = 0; i < count && error == 0; ++i) {
+    pthread_t thread;
+    error = pthread_create(&thread, NULL, work, this);
+    if (error == 0)
+      threads.push_back(thread);
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (threads.empty())
+    return ERR(Void, std::string("pthread_create: ") + strerror(error));
+  if (error != 0)
+    std::cerr << "WARNING: only " << threads.size()
+              << " plugin threads started: " << strerror(error) << std::endl;
+  return OKV;
+}
+
+Result<Void> PluginHost::load(const std::vector<const Config_Plugin *> &routes,
+                              unsigned int threads) {
+  bool offload = false;
+  for (size_t i = 0; i < routes.size(); ++i) {
+    const Config_Plugin &plugin = *routes[i];
+    std::string key = plugin.Get_key();
+    offload = offload || plugin.Get_offload();
+    std::map<std::string, PluginLibrary *>::iterator it = libraries.find(key);
+    if (it != libraries.end()) {
+      if (plugin.Get_offload() &&
+          !(it->second->plugin->flags & WS_PLUGIN_THREADSAFE))
+        return ERR(Void, plugin.Get_library() + ": offload needs a plugin "
+                                                "marked WS_PLUGIN_THREADSAFE");
+      if (plugin.Get_offload())
+        configs.find(key)->second = plugin;
+      continue;
+    }
+    Result<PluginLibrary *> library = open_library(plugin);
+    if (!library.has_value())
+      return ERR(Void, library.error());
+    libraries[key] = library.value();
+    configs.insert(std::make_pair(key, plugin));
+    std::cout << "Plugin " << library.value()->plugin->name << " loaded from "
+              << plugin.Get_library() << std::endl;
+  }
+  if (offload && this->threads.empty())
+    return start_threads(threads);
+  return OKV;
+}
+
+Result<Void> PluginHost::reload() {
+  std::map<std::string, PluginLibrary *> fresh;
+  for (std::map<std::string, Config_Plugin>::iterator it = configs.begin();
+       it != configs.end(); ++it) {
+    Result<PluginLibrary *> library = open_library(it->second);
+    if (!library.has_value()) {
+      for (std::map<std::string, PluginLibrary *>::iterator loaded =
+               fresh.begin();
+           loaded != fresh.end(); ++loaded)
+        close_library(loaded->second);
+      return ERR(Void, library.error());
+    }
+    fresh[it->first] = library.value();
+  }
+
+  libraries.swap(fresh);
+  for (std::map<std::string, PluginLibrary *>::iterator it = fresh.begin();
+       it != fresh.end(); ++it) {
+    if (it->second->in_flight == 0)
+      close_library(it->second);
+    else
+      it->second->retired = true;
+  }
+  std::cout << "Plugins reloaded: " << libraries.size() << std::endl;
+  return OKV;
+}
+
+PluginCall *PluginHost::prepare(const Config_Plugin &plugin,
+                                const Http::Request &request,
+                                const std::string &body) {
+  std::map<std::string, PluginLibrary *>::iterator it =
+      libraries.find(plugin.Get_key());
+  if (it == libraries.end())
+    return NULL;
+
+  PluginCall *call = new PluginCall();
+  call->library = it->second;
+  call->library->in_flight++;
+  call->client = NULL;
+  call->method = Http::method_name(request.method());
+  size_t query = request.path().find('?');
+  call->path = request.path().substr(0, query);
+  if (query != std::string::npos)
+    call->query = request.path().substr(query + 1);
+  call->body = body;
+  call->header_data.assign(request.headers().begin(),
+                           request.headers().end());
+  call->headers.resize(call->header_data.size());
+  for (size_t i = 0; i < call->header_data.size(); ++i) {
+    call->headers[i].name = view(call->header_data[i].first);
+    call->headers[i].value = view(call->header_data[i].second);
+  }
+
+  call->request.method = view(call->method);
+  call->request.path = view(call->path);
+  call->request.query = view(call->query);
+  call->request.headers = call->headers.empty() ? NULL : &call->headers[0];
+  call->request.header_count = call->headers.size();
+  call->request.body = view(call->body);
+  call->response.status = 200;
+  call->result = 0;
+  return call;
+}
+
+void PluginHost::run(PluginCall *call) {
+  call->result = call->library->plugin->handle(
+      call->library->state, &call->request, &call->response);
+}
+
+void PluginHost::offload(PluginCall *call) {
+  pthread_mutex_lock(&lock);
+  todo.push_back(call);
+  pthread_cond_signal(&wake);
+  pthread_mutex_unlock(&lock);
+}
+
+bool PluginHost::owns(const FileDescriptor *fd) const {
+  return fd != NULL && fd == wakeup;
+}
+
+std::vector<PluginCall *> PluginHost::completed() {
+  uint64_t count;
+  wakeup->fd_read(&count, sizeof(count));
+  pthread_mutex_lock(&lock);
+  std::vector<PluginCall *> calls(done.begin(), done.end());
+  done.clear();
+  pthread_mutex_unlock(&lock);
+  return calls;
+}
+
+void PluginHost::release(PluginCall *call) {
+  PluginLibrary *library = call->library;
+  delete call;
+  if (--library->in_flight == 0 && library->retired)
+    close_library(library);
+}
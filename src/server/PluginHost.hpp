@@ -0,0 +1,117 @@
+#ifndef PLUGINHOST_HPP
+#define PLUGINHOST_HPP
+
+#include "../Config_Plugin.hpp"
+#include "../epoll_kqueue.h"
+#include "../http_1_1.h"
+#include "../plugin/webserv_plugin.h"
+#include "../result.h"
+
+#include <deque>
+#include <map>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+// Response a plugin builds through the ws_host functions
+struct ws_response {
+  int status;
+  std::map<std::string, std::string> headers;
+  std::string body;
+};
+
+// Loaded shared object and the state its init() returned for one route
+// configuration
+struct PluginLibrary {
+  std::string name; // path of the shared object, for the logs
+  void *handle;
+  const ws_plugin *plugin;
+  void *state;
+  size_t in_flight; // PluginCalls not released yet
+  bool retired;     // replaced by a reload, unloaded once in_flight is 0
+};
+
+// One request to a plugin. It owns every byte its ws_request points to, so
+// that an offloaded call doesn't depend on the connection's buffers.
+struct PluginCall {
+  PluginLibrary *library;
+  const FileDescriptor *client; // NULL once the client disconnected
+  std::string method;
+  std::string path;
+  std::string query;
+  std::string body;
+  std::vector<std::pair<std::string, std::string> > header_data;
+  std::vector<ws_header> headers;
+  ws_request request;
+  ws_response response;
+  int result; // of handle()
+};
+
+/**
+ * @class PluginHost
+ * @brief Runs the in-process handler plugins of `&library.so` routes.
+ *
+ * Every distinct route configuration gets its own instance of the plugin:
+ * the shared object is loaded with dlopen() and its init() called with the
+ * route's KEY=VALUE lines. handle() runs on the event loop, or for `offload`
+ * routes on a small pool of worker threads that hand finished calls back
+ * through an eventfd registered with the server's EPoll.
+ *
+ * reload() loads every plugin again and swaps them in only if all of them
+ * loaded; a replaced instance is destroyed and unloaded once its last call
+ * was released, so calls in flight finish on the code they started on.
+ */
+class PluginHost {
+  EPoll &epoll;
+  // Current instances, by Config_Plugin::Get_key()
+  std::map<std::string, PluginLibrary *> libraries;
+  // What they were loaded from, for reload(); offload is set if any route
+  // of the instance offloads
+  std::map<std::string, Config_Plugin> configs;
+
+  // Worker threads; todo and done are guarded by lock
+  std::vector<pthread_t> threads;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  std::deque<PluginCall *> todo;
+  std::deque<PluginCall *> done;
+  bool stopping;
+  // eventfd the threads signal done calls on, owned by EPoll; NULL without
+  // threads
+  const FileDescriptor *wakeup;
+
+  static void *work(void *host);
+  static Result<PluginLibrary *> open_library(const Config_Plugin &plugin);
+  static void close_library(PluginLibrary *library);
+  Result<Void> start_threads(unsigned int count);
+
+  PluginHost(const PluginHost &);
+  PluginHost &operator=(const PluginHost &);
+
+public:
+  explicit PluginHost(EPoll &epoll);
+  // Joins the threads and unloads every plugin
+  ~PluginHost();
+
+  // Loads the plugin of every route; starts threads workers if some route
+  // offloads
+  Result<Void> load(const std::vector<const Config_Plugin *> &routes,
+                    unsigned int threads);
+  // Loads every plugin again from disk (on SIGHUP)
+  Result<Void> reload();
+
+  // Copies the request for the route's plugin; NULL if none is loaded
+  PluginCall *prepare(const Config_Plugin &plugin, const Http::Request &request,
+                      const std::string &body);
+  // Calls handle() on the event loop
+  void run(PluginCall *call);
+  // Queues the call to the worker threads; it comes back from completed()
+  void offload(PluginCall *call);
+  bool owns(const FileDescriptor *fd) const;
+  // Offloaded calls that finished (EPOLLIN on the eventfd)
+  std::vector<PluginCall *> completed();
+  // Deletes the call, unloading its plugin if a reload replaced it
+  void release(PluginCall *call);
+};
+
+#endif
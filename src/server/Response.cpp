@@ -1,6 +1,8 @@
 #include "Response.hpp"
 #include "../cgi_1_1.h"
 
+std::map<std::string, CachedFile> Response::file_cache;
+
 std::string Response::get_pwd() {
   char buffer[1024];
   if (getcwd(buffer, sizeof(buffer)) != NULL) {
@@ -54,17 +56,46 @@ HttpResponse Response::generate(const Http::Request *request,
     full_path = error_file_path(404);
   else if (path_type == -1)
     full_path = error_file_path(500);
-  std::ifstream file(full_path.c_str());
-  if (file.is_open()) {
-    std::ostringstream ss;
-    ss << file.rdbuf();
-    response.body = ss.str();
-    response.status_code = "200 OK";
-    file.close();
-  }
+  load_body(full_path, response);
   return response;
 }
 
+void Response::load_body(const std::string &path, HttpResponse &response) {
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+    return;
+  size_t size = static_cast<size_t>(info.st_size);
+
+  if (size <= RESPONSE_CACHE_FILE_MAX) {
+    std::map<std::string, CachedFile>::iterator it = file_cache.find(path);
+    if (it == file_cache.end() || it->second.mtime != info.st_mtime ||
+        it->second.size != info.st_size) {
+      std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+      if (!file.is_open())
+        return;
+      std::ostringstream ss;
+      ss << file.rdbuf();
+      if (file_cache.size() >= RESPONSE_CACHE_ENTRIES &&
+          it == file_cache.end())
+        file_cache.clear();
+      CachedFile &entry = file_cache[path];
+      entry.body = SharedBuffer(ss.str());
+      entry.mtime = info.st_mtime;
+      entry.size = info.st_size;
+      it = file_cache.find(path);
+    }
+    response.body = it->second.body;
+    response.content_length = it->second.body.size();
+  } else {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return;
+    response.file = SharedFile(fd);
+    response.content_length = size;
+  }
+  response.status_code = "200 OK";
+}
+
 std::string Response::resolve_full_path(const Http::Request *request,
                                         const ServerConfig *config) {
   const RouteRule *rule = config->findRoute(request->method(), request->path());
@@ -7,7 +7,10 @@
 #define FORBIDDEN 3
 
 #include "../ServerConfig.hpp"
+#include "OutputQueue.hpp"
+#include <fcntl.h>
 #include <fstream>
+#include <map>
 #include <sstream>
 #include <string>
 #include <sys/stat.h>
@@ -18,10 +21,25 @@ struct StatusInfo {
   std::string file_path;
 };
 
+// Files up to this size are kept in memory and shared between responses;
+// larger ones are sent straight from the page cache with sendfile()
+#define RESPONSE_CACHE_FILE_MAX (64 * 1024)
+#define RESPONSE_CACHE_ENTRIES 256
+
 struct HttpResponse {
   std::string status_code;
-  std::string body;
+  SharedBuffer body; // in-memory body, or
+  SharedFile file;   // file body of content_length bytes
+  size_t content_length;
   std::string mime_type;
+
+  HttpResponse() : content_length(0) {}
+};
+
+struct CachedFile {
+  SharedBuffer body;
+  time_t mtime;
+  off_t size;
 };
 
 class Response {
@@ -35,6 +53,10 @@ private:
                                        const ServerConfig *config);
   static std::string get_pwd();
   static std::string error_file_path(int error_code);
+  static void load_body(const std::string &path, HttpResponse &response);
+
+  // key: absolute file path, validated against mtime and size on every hit
+  static std::map<std::string, CachedFile> file_cache;
 };
 
 #endif
\ No newline at end of file
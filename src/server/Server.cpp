@@ -1,30 +1,79 @@
 #include "Server.hpp"
 #include "../webserv.h"
 
+// Header lines shared by every response, serialized once
+static const SharedBuffer common_headers(std::string(
+    "Content-Type: text/html\r\nConnection: keep-alive\r\n\r\n"));
+
+static long long monotonic_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Bodyless answer for a CGI request without a usable script response
+static std::string gateway_error(
+    int status_code, const std::map<std::string, std::string> &headers =
+                         std::map<std::string, std::string>()) {
+  Http::Body::Value none;
+  none._null = NULL;
+  return Http::Response(status_code, headers,
+                        Http::Body(Http::Body::Empty, none))
+      .serialize();
+}
+
+// Text form of a client's address, empty for a unix socket
+static std::string peer_address(const struct sockaddr_storage &addr) {
+  char text[INET6_ADDRSTRLEN];
+  const void *raw = NULL;
+  if (addr.ss_family == AF_INET)
+    raw = &reinterpret_cast<const struct sockaddr_in &>(addr).sin_addr;
+  else if (addr.ss_family == AF_INET6)
+    raw = &reinterpret_cast<const struct sockaddr_in6 &>(addr).sin6_addr;
+  if (raw == NULL || inet_ntop(addr.ss_family, raw, text, sizeof(text)) == NULL)
+    return std::string();
+  return text;
+}
+
+// Accepts at most accept_batch connections per wakeup so that a burst on one
+// listener cannot starve clients that are already connected. A listener that
+// hits the cap is retried after the current events (ET won't report it again).
 void Server::new_connection(const FileDescriptor *server_fd) {
-  while (true) { // Edge-Triggered이므로 모든 연결을 다 받아야 함
-    Result<FileDescriptor> client_result = server_fd->socket_accept(NULL, NULL);
+  const ServerLimits &limits = config.Get_Limits();
+
+  for (unsigned int accepted = 0; accepted < limits.accept_batch; accepted++) {
+    struct sockaddr_storage peer;
+    socklen_t peer_len = sizeof(peer);
+    peer.ss_family = AF_UNSPEC;
+    Result<FileDescriptor> client_result = server_fd->socket_accept(
+        reinterpret_cast<struct sockaddr *>(&peer), &peer_len);
     if (!client_result.has_value()) {
       const std::string &err = client_result.error();
       if (err == Errors::try_again)
-        break; // EWOULDBLOCK: nothing to connect
-      else if (err == Errors::interrupted)
-        continue; // EINTR: accept retry
-      else {
+        return; // EWOULDBLOCK: nothing to connect
+      else if (err == Errors::interrupted || err == Errors::conn_aborted)
+        continue; // EINTR, ECONNABORTED: accept retry
+      else if (err == Errors::fd_too_many) {
+        // EMFILE/ENFILE: stop accepting until a descriptor is freed
+        pause_listener(server_fd);
+        return;
+      } else {
         std::cerr << "ERROR: accept failed: " << err << std::endl;
-        break;
+        return;
       }
     }
 
+    // accept4() already made the socket non-blocking and close-on-exec
     FileDescriptor client_fd = client_result.value();
-    if (!client_fd.set_nonblocking().has_value()) {
-      std::cerr << "ERROR: failed to set client socket to non-blocking mode"
-                << std::endl;
+    accept_retry_ms = 0;
+    if (clients.size() >= limits.max_connections ||
+        buffered_bytes >= limits.max_buffered) {
+      reject_overloaded(client_fd);
       continue;
     }
 
-    // register client socket to EPoll
-    Event client_event(&client_fd, true, true, false, false, false, false);
+    // register client socket to EPoll (EPOLLOUT is armed on demand)
+    Event client_event(&client_fd, true, false, false, false, false, false);
     Option client_option(true, false, false, false);
 
     Result<FileDescriptor *> add_result =
@@ -35,7 +84,9 @@ void Server::new_connection(const FileDescriptor *server_fd) {
       // ★ 내 문지기(server_fd)의 Config 설정을 그대로 복사해서 세션에 넣음!
       if (listeners.find(server_fd) != listeners.end()) {
         session.config = listeners.at(server_fd);
+        session.server_port = listener_ports.at(server_fd);
       }
+      session.remote_addr = peer_address(peer);
       clients[client_ptr] = session;
       std::cout << "New client connected!" << std::endl;
     } else {
@@ -43,20 +94,176 @@ void Server::new_connection(const FileDescriptor *server_fd) {
                 << std::endl;
     }
   }
+  accept_pending.insert(server_fd);
+}
+
+// Answers with the pre-serialized 503 and closes. What the client already
+// sent is drained first, for at most OVERLOAD_DRAIN_READS reads and up to its
+// EOF, so the close doesn't turn into a reset that discards the response.
+void Server::reject_overloaded(const FileDescriptor &client_fd) {
+  char buf[NETWORK_BUFFER_SIZE];
+  for (int i = 0; i < OVERLOAD_DRAIN_READS; ++i) {
+    Result<ssize_t> res = client_fd.sock_recv(buf, sizeof(buf));
+    if (!res.has_value() || res.value() == 0)
+      break;
+  }
+  client_fd.sock_send(overload_response.data(), overload_response.length());
+}
+
+// Disables EPOLLIN of a listener out of file descriptors. It is enabled
+// again when a client disconnects, and every ACCEPT_RETRY_INTERVAL until a
+// connection is accepted, since closing a script's pipes or a backend socket
+// frees descriptors too.
+void Server::pause_listener(const FileDescriptor *server_fd) {
+  if (paused_listeners.find(server_fd) != paused_listeners.end())
+    return;
+  Event event(server_fd, false, false, false, false, false, false);
+  Option option(true, false, false, false);
+  Result<Void> mod_result = epoll.modify_fd(*server_fd, event, option);
+  if (!mod_result.has_value()) {
+    std::cerr << "ERROR: epoll modify failed: " << mod_result.error()
+              << std::endl;
+    return;
+  }
+  paused_listeners.insert(server_fd);
+  accept_pending.erase(server_fd);
+  if (accept_retry_ms == 0)
+    std::cerr << "WARNING: out of file descriptors, accepting paused"
+              << std::endl;
+  accept_retry_ms = monotonic_ms() + ACCEPT_RETRY_INTERVAL;
+}
+
+// Re-arms EPOLLIN; EPOLL_CTL_MOD reports connections queued in the meantime.
+void Server::resume_listeners() {
+  for (std::set<const FileDescriptor *>::iterator it =
+           paused_listeners.begin();
+       it != paused_listeners.end(); ++it) {
+    Event event(*it, true, false, false, false, false, false);
+    Option option(true, false, false, false);
+    Result<Void> mod_result = epoll.modify_fd(**it, event, option);
+    if (!mod_result.has_value())
+      std::cerr << "ERROR: epoll modify failed: " << mod_result.error()
+                << std::endl;
+  }
+  paused_listeners.clear();
 }
 
 void Server::disconnect(const FileDescriptor *client_fd) {
-  std::cout << "Client disconnected" << std::endl;
+  ClientSession &session = clients.at(client_fd);
+  if (!session.closed)
+    std::cout << "Client disconnected" << std::endl;
+  // A cache refresh outlives its client, or the next stale hit would start
+  // the script again; finish_cgi() or finish_uwsgi() completes the disconnect
+  if ((session.cgi != NULL && session.cgi->fill != NULL &&
+       session.cgi->fill->background) ||
+      (session.uwsgi != NULL && session.uwsgi->fill != NULL &&
+       session.uwsgi->fill->background)) {
+    if (!session.closed) {
+      session.closed = true;
+      client_fd->socket_shutdown(SHUT_RDWR);
+      session.in_buff.clear();
+      session.out_queue = OutputQueue();
+      account(session);
+    }
+    return;
+  }
+  close_cgi(client_fd);
+  close_uwsgi(client_fd);
+  // The worker thread can't be stopped; its call is dropped once it is done
+  if (session.plugin_call != NULL)
+    session.plugin_call->client = NULL;
+  if (session.cgi_queue != NULL && session.cgi_admitted)
+    cgi_admission.release(*session.cgi_queue);
+  else if (session.cgi_queue != NULL)
+    cgi_admission.cancel(*session.cgi_queue, client_fd);
+  if (session.cache_fill != NULL)
+    end_fill(session.cache_fill);
+  if (!session.cache_wait.empty())
+    cgi_cache.cancel(session.cache_wait, client_fd);
+  upload_resume.erase(client_fd);
+  cache_resume.erase(client_fd);
+  buffered_bytes -= clients.at(client_fd).accounted;
   epoll.del_fd(*client_fd);
   clients.erase(client_fd);
+  if (!paused_listeners.empty())
+    resume_listeners();
+}
+
+// Keeps buffered_bytes in step with the session's pending input and output
+void Server::account(ClientSession &session) {
+  size_t pending = session.in_buff.length() + session.out_queue.size();
+  buffered_bytes = buffered_bytes - session.accounted + pending;
+  session.accounted = pending;
+}
+
+// Parses a Content-Length value: digits only, and no larger than size_t
+static bool content_length_value(const std::string &value, size_t &length) {
+  if (value.empty() ||
+      value.find_first_not_of("0123456789") != std::string::npos)
+    return false;
+  length = 0;
+  for (size_t i = 0; i < value.length(); i++) {
+    size_t digit = static_cast<size_t>(value[i] - '0');
+    if (length > (static_cast<size_t>(-1) - digit) / 10)
+      return false;
+    length = length * 10 + digit;
+  }
+  return true;
+}
+
+// Returns the length of the first complete request in buf (headers plus
+// Content-Length body bytes), or npos while it is still incomplete. A head
+// with an invalid Content-Length sets bad_length instead.
+static size_t complete_request_length(const std::string &buf,
+                                      bool &bad_length) {
+  bad_length = false;
+  size_t header_end = buf.find("\r\n\r\n");
+  if (header_end == std::string::npos)
+    return std::string::npos;
+
+  size_t body_length = 0;
+  std::string headers = buf.substr(0, header_end);
+  for (size_t i = 0; i < headers.length(); i++)
+    headers[i] =
+        static_cast<char>(std::tolower(static_cast<unsigned char>(headers[i])));
+  size_t cl_pos = headers.find("\r\ncontent-length:");
+  if (cl_pos != std::string::npos) {
+    size_t value_end = headers.find("\r\n", cl_pos + 2);
+    std::string value = headers.substr(cl_pos + 17, value_end - (cl_pos + 17));
+    value.erase(0, value.find_first_not_of(" \t"));
+    value.erase(value.find_last_not_of(" \t") + 1);
+    if (!content_length_value(value, body_length)) {
+      bad_length = true;
+      return std::string::npos;
+    }
+  }
+
+  if (buf.length() - (header_end + 4) < body_length)
+    return std::string::npos;
+  return header_end + 4 + body_length;
 }
 
 void Server::client_read(const FileDescriptor *client_fd) {
-  while (true) { // ET 모드이므로 버퍼가 빌 때까지 다 읽음
+  ClientSession &session = clients.at(client_fd);
+
+  // The body of a CGI request goes to the script, not to in_buff
+  if (session.uploading) {
+    if (pump_upload(client_fd))
+      flush_output(client_fd);
+    return;
+  }
+
+  // ET 모드이므로 버퍼가 빌 때까지 다 읽음 (출력이 밀려 있으면 잠시 멈춤)
+  while (!session.read_paused && !session.closing) {
     char buf[NETWORK_BUFFER_SIZE];
     Result<ssize_t> recv_res = client_fd->sock_recv(buf, sizeof(buf));
-    if (!recv_res.has_value())
-      break; // EWOULDBLOCK
+    if (!recv_res.has_value()) {
+      if (recv_res.error() == Errors::try_again)
+        break; // EWOULDBLOCK
+      std::cerr << "ERROR: " << recv_res.error() << std::endl;
+      disconnect(client_fd);
+      return;
+    }
 
     ssize_t bytes = recv_res.value();
     if (bytes == 0) {
@@ -64,76 +271,1869 @@ void Server::client_read(const FileDescriptor *client_fd) {
       disconnect(client_fd);
       return;
     }
-    clients.at(client_fd).in_buff.append(buf, static_cast<std::size_t>(bytes));
+    session.in_buff.append(buf, static_cast<std::size_t>(bytes));
+    handle_requests(client_fd);
   }
 
-  // HTTP 파싱 및 응답 생성 로직
-  if (clients.find(client_fd) != clients.end() &&
-      !clients.at(client_fd).in_buff.empty()) {
-    std::string &in_buffer = clients.at(client_fd).in_buff;
-    size_t header_end = in_buffer.find("\r\n\r\n");
+  // Try to send right away instead of waiting for the next EPOLLOUT edge
+  flush_output(client_fd);
+}
 
-    if (header_end != std::string::npos) {
-      Result<std::pair<Http::Request *, size_t> > request_result =
-          Http::Request::parse(in_buffer.c_str(), '\0');
-      if (!request_result.has_value()) {
-        std::cerr << request_result.error() << std::endl;
-        return;
+// Framing of the request body, from its headers (names are lowercase).
+// Fails on a Content-Length that isn't a number, and on a Transfer-Encoding
+// whose last coding isn't chunked, the only one decoded: the end of the body
+// can't be told then.
+static bool body_framing(const Http::Request &request, BodyStream &body) {
+  const std::map<std::string, std::string> &headers = request.headers();
+  std::map<std::string, std::string>::const_iterator it =
+      headers.find("transfer-encoding");
+  if (it != headers.end()) {
+    size_t last = it->second.rfind(',');
+    std::string coding =
+        it->second.substr(last == std::string::npos ? 0 : last + 1);
+    coding.erase(0, coding.find_first_not_of(" \t"));
+    if (strcasecmp(coding.c_str(), "chunked") != 0)
+      return false;
+    body = BodyStream::chunked();
+    return true;
+  }
+  size_t length = 0;
+  it = headers.find("content-length");
+  if (it != headers.end() && !content_length_value(it->second, length))
+    return false;
+  body = BodyStream::length(length);
+  return true;
+}
+
+// Framing of a request that passed body_framing()
+static BodyStream body_stream(const Http::Request &request) {
+  BodyStream body;
+  body_framing(request, body);
+  return body;
+}
+
+// Answers a request whose body can't be delimited. Whatever follows it on
+// the connection is unusable, so nothing more is read and the connection is
+// closed once the 400 is sent (see flush_output()).
+static void refuse_framing(ClientSession &session) {
+  std::cerr << "WARNING: invalid Content-Length or Transfer-Encoding"
+            << std::endl;
+  std::map<std::string, std::string> headers;
+  headers["Connection"] = "close";
+  session.out_queue.push(gateway_error(400, headers));
+  session.in_buff.clear();
+  session.closing = true;
+}
+
+// Largest request body a route takes, from its `->{}` (1 KB without a route)
+static size_t body_limit(const RouteRule *rule) {
+  return static_cast<size_t>(rule != NULL ? rule->maxBodyKB : 1) * 1024;
+}
+
+// Parses every complete request in in_buff and queues its response, stopping
+// (and pausing reads) once pending output crosses OUTPUT_HIGH_WATER. A CGI or
+// uWSGI request also stops the loop until its script or backend has answered.
+void Server::handle_requests(const FileDescriptor *client_fd) {
+  ClientSession &session = clients.at(client_fd);
+  std::string &in_buffer = session.in_buff;
+
+  while (!session.closing && session.cgi == NULL && !session.uploading &&
+         (session.cgi_queue == NULL || session.cgi_admitted) &&
+         session.cache_wait.empty() && session.plugin_call == NULL &&
+         session.uwsgi == NULL &&
+         session.out_queue.size() < OUTPUT_HIGH_WATER) {
+    bool bad_length = false;
+    size_t request_length = complete_request_length(in_buffer, bad_length);
+    if (bad_length) {
+      session.head_routed = false;
+      refuse_framing(session);
+      break;
+    }
+    if (request_length == std::string::npos) {
+      if (session.head_routed || !route_head(client_fd))
+        break;
+      continue;
+    }
+    session.head_routed = false;
+
+    Result<std::pair<Http::Request *, size_t> > request_result =
+        Http::Request::parse(in_buffer.c_str(), '\0');
+    if (!request_result.has_value()) {
+      std::cerr << request_result.error() << std::endl;
+      session.out_queue.push(gateway_error(400));
+      in_buffer.erase(0, request_length);
+      continue;
+    }
+
+    Http::Request *request = request_result.value().first;
+    std::cout << "[Request] " << request->method() << " " << request->path()
+              << std::endl;
+    BodyStream framing;
+    if (!body_framing(*request, framing)) {
+      delete request;
+      refuse_framing(session);
+      break;
+    }
+    // A chunked body follows the head, see route_head()
+    if (framing.is_chunked()) {
+      delete request;
+      session.head_routed = false;
+      if (!route_head(client_fd))
+        break;
+      continue;
+    }
+
+    std::string path = request->path().substr(0, request->path().find('?'));
+    const std::string &metrics = config.Get_Limits().metrics;
+    if (!metrics.empty() && request->method() == Http::GET &&
+        path == metrics) {
+      delete request;
+      send_metrics(session);
+      in_buffer.erase(0, request_length);
+      continue;
+    }
+
+    const RouteRule *rule = NULL;
+    if (session.config != NULL)
+      rule = session.config->findRoute(request->method(), path);
+    session.body_limit = body_limit(rule);
+    if (framing.raw_left() > session.body_limit) {
+      std::cerr << "WARNING: request body over the route's limit" << std::endl;
+      delete request;
+      session.out_queue.push(gateway_error(413));
+      in_buffer.erase(0, request_length);
+      continue;
+    }
+    if (rule != NULL && (rule->op == CGI || rule->op == UWSGI)) {
+      CgiCache::Lookup lookup = lookup_cache(client_fd, *request, *rule);
+      if (lookup == CgiCache::Wait) {
+        delete request;
+        break;
+      }
+      if (lookup != CgiCache::Fill && lookup != CgiCache::Bypass) {
+        delete request; // answered from the cache
+        in_buffer.erase(0, request_length);
+        continue;
+      }
+    }
+    if (rule != NULL && rule->op == CGI) {
+      CgiAdmission::Verdict verdict = admit_cgi(client_fd, rule->cgi);
+      if (verdict == CgiAdmission::Wait) {
+        delete request;
+        break;
       }
+      // A plain script reads its body from in_buff like a streamed one
+      bool pooled = rule->cgi.Get_pool().max_workers > 0;
+      if (!pooled)
+        request_length = in_buffer.find("\r\n\r\n") + 4;
+      in_buffer.erase(0, request_length);
+      if (verdict == CgiAdmission::Refuse)
+        refuse_cgi(client_fd, *request, 503, !pooled);
+      else if (!start_cgi(client_fd, *request, rule->cgi))
+        refuse_cgi(client_fd, *request, 502, !pooled);
+      delete request;
+      continue;
+    }
 
-      Http::Request *request = request_result.value().first;
-      std::cout << "[Request] " << request->method() << " " << request->path()
-                << std::endl;
+    if (rule != NULL && rule->op == UWSGI) {
+      CgiAdmission::Verdict verdict = admit_cgi(client_fd, rule->cgi);
+      if (verdict == CgiAdmission::Wait) {
+        delete request;
+        break;
+      }
+      size_t body_start = in_buffer.find("\r\n\r\n") + 4;
+      std::string body =
+          in_buffer.substr(body_start, request_length - body_start);
+      in_buffer.erase(0, request_length);
+      bool started = verdict == CgiAdmission::Run &&
+                     start_uwsgi(client_fd, *request, rule->cgi, body, false);
+      if (!started)
+        refuse_cgi(client_fd, *request,
+                   verdict == CgiAdmission::Refuse ? 503 : 502, false);
+      delete request;
+      if (!started)
+        continue;
+      break;
+    }
 
-      HttpResponse http =
-          Response::generate(request, clients.at(client_fd).config);
+    if (rule != NULL && rule->op == PLUGIN) {
+      size_t body_start = in_buffer.find("\r\n\r\n") + 4;
+      PluginCall *call = plugins.prepare(
+          rule->plugin, *request,
+          in_buffer.substr(body_start, request_length - body_start));
       delete request;
+      in_buffer.erase(0, request_length);
+      if (call == NULL) {
+        session.out_queue.push(gateway_error(503));
+        continue;
+      }
+      if (rule->plugin.Get_offload()) {
+        call->client = client_fd;
+        session.plugin_call = call;
+        plugins.offload(call);
+        break;
+      }
+      plugins.run(call);
+      send_plugin(session, *call);
+      plugins.release(call);
+      continue;
+    }
+
+    HttpResponse http = Response::generate(request, session.config);
+    delete request;
+
+    // HTTP 응답 메시지 조립: status line and Content-Length are the only
+    // per-response bytes; headers and body are queued without copying
+    // todo: 하드코딩된 response 말고 동적으로
+    std::ostringstream status;
+    status << "HTTP/1.1 " << http.status_code << "\r\n";
+    status << "Content-Length: " << http.content_length << "\r\n";
+    session.out_queue.push(status.str());
+    session.out_queue.push(common_headers);
+    if (http.file.is_open())
+      session.out_queue.push_file(http.file, 0, http.content_length);
+    else
+      session.out_queue.push(http.body);
+    in_buffer.erase(0, request_length);
+  }
+
+  if (session.out_queue.size() >= OUTPUT_HIGH_WATER)
+    session.read_paused = true;
+}
 
-      // HTTP 응답 메시지 조립
-      // todo: 하드코딩된 response 말고 동적으로
-      std::ostringstream server_response;
-      server_response << "HTTP/1.1 " << http.status_code << "\r\n";
-      server_response << "Content-Type: text/html\r\n";
-      server_response << "Content-Length: " << http.body.length() << "\r\n";
-      server_response << "Connection: keep-alive\r\n\r\n";
-      server_response << http.body;
+// Tells a client that waits with `Expect: 100-continue` to send the body that
+// is now streamed. Without it, a script or backend answering before reading
+// the body would leave the client holding it back while the body is waited on.
+static void send_continue(ClientSession &session,
+                          const Http::Request &request) {
+  const std::map<std::string, std::string> &headers = request.headers();
+  std::map<std::string, std::string>::const_iterator it =
+      headers.find("expect");
+  if (it != headers.end() &&
+      strcasecmp(it->second.c_str(), "100-continue") == 0)
+    session.out_queue.push(std::string("HTTP/1.1 100 Continue\r\n\r\n"));
+}
 
-      clients.at(client_fd).out_buff += server_response.str();
-      in_buffer.erase(0, header_end + 4);
+// The head of a chunked request, as that of the same request with its
+// decoded body of length bytes
+static std::string dechunked_head(const std::string &head, size_t length) {
+  std::string out;
+  size_t pos = 0;
+  size_t eol;
+  while ((eol = head.find("\r\n", pos)) != std::string::npos && eol > pos) {
+    std::string line = head.substr(pos, eol - pos);
+    pos = eol + 2;
+    if (strncasecmp(line.c_str(), "transfer-encoding:", 18) != 0 &&
+        strncasecmp(line.c_str(), "content-length:", 15) != 0)
+      out += line + "\r\n";
+  }
+  std::ostringstream length_line;
+  length_line << "Content-Length: " << length << "\r\n\r\n";
+  return out + length_line.str();
+}
+
+// Routes a request whose body is still arriving. A plain CGI route starts
+// its script right away and gets a Content-Length body streamed to its
+// stdin, and a uWSGI route sends its packet and streams the body after it. A
+// chunked body is collected and decoded first, since CONTENT_LENGTH is due
+// up front to a script (RFC 3875 4.1.2) as to a uWSGI packet; any other
+// request waits in in_buff until it is complete. Returns true if the request
+// was taken off in_buff.
+bool Server::route_head(const FileDescriptor *client_fd) {
+  ClientSession &session = clients.at(client_fd);
+  if (session.config == NULL ||
+      session.in_buff.find("\r\n\r\n") == std::string::npos)
+    return false;
+  session.head_routed = true;
+
+  // A malformed head is reported once the request is complete
+  Result<std::pair<Http::Request *, size_t> > head =
+      Http::Request::parse_head(session.in_buff.c_str());
+  if (!head.has_value())
+    return false;
+  Http::Request *request = head.value().first;
+  BodyStream framing;
+  if (!body_framing(*request, framing)) {
+    std::cout << "[Request] " << request->method() << " " << request->path()
+              << std::endl;
+    delete request;
+    session.head_routed = false;
+    refuse_framing(session);
+    return true;
+  }
+  const RouteRule *rule = session.config->findRoute(
+      request->method(),
+      request->path().substr(0, request->path().find('?')));
+  // Refused before any of a body over the limit is buffered
+  session.body_limit = body_limit(rule);
+  if (framing.raw_left() > session.body_limit) {
+    std::cerr << "WARNING: request body over the route's limit" << std::endl;
+    session.head_routed = false;
+    session.in_buff.erase(0, head.value().second);
+    refuse_cgi(client_fd, *request, 413, true);
+    delete request;
+    return true;
+  }
+  if (framing.is_chunked()) {
+    session.head_routed = false;
+    session.collect_head = session.in_buff.substr(0, head.value().second);
+    session.in_buff.erase(0, head.value().second);
+    session.upload = framing;
+    session.uploading = true;
+    session.collecting = true;
+    session.upload_buf.clear();
+    if (!session.in_buff.empty())
+      upload_resume.insert(client_fd);
+    send_continue(session, *request);
+    delete request;
+    return true;
+  }
+  bool uwsgi = rule != NULL && rule->op == UWSGI && framing.raw_left() > 0;
+  if (!uwsgi && (rule == NULL || rule->op != CGI ||
+                 rule->cgi.Get_pool().max_workers > 0)) {
+    delete request;
+    return false;
+  }
+  CgiAdmission::Verdict verdict = admit_cgi(client_fd, rule->cgi);
+  if (verdict == CgiAdmission::Wait) {
+    delete request;
+    return false;
+  }
+
+  std::cout << "[Request] " << request->method() << " " << request->path()
+            << std::endl;
+  session.head_routed = false;
+  session.in_buff.erase(0, head.value().second);
+  std::string none;
+  if (verdict == CgiAdmission::Refuse)
+    refuse_cgi(client_fd, *request, 503, true);
+  else if (uwsgi ? !start_uwsgi(client_fd, *request, rule->cgi, none, true)
+                 : !start_cgi(client_fd, *request, rule->cgi))
+    refuse_cgi(client_fd, *request, 502, true);
+  else
+    send_continue(session, *request);
+  delete request;
+  return true;
+}
+
+// A slow upload doesn't count against the script's or the backend's timeout,
+// up to UPLOAD_TIME_MAX: a client trickling its body can't hold the script
+// or backend forever. The end of the body always counts.
+static void upload_progress(ClientSession &session, bool done = false) {
+  long long now = monotonic_ms();
+  if (!done && now >= session.upload_until_ms)
+    return;
+  if (session.cgi != NULL)
+    session.cgi->deadline_ms = now + session.cgi->timeout_ms;
+  if (session.uwsgi != NULL)
+    session.uwsgi->deadline_ms = now + session.uwsgi->timeout_ms;
+}
+
+// A response still coming in keeps the script or the backend alive: the
+// route's timeout counts from the last piece relayed, so a long streamed
+// response isn't cut while it moves.
+static void output_progress(ClientSession &session) {
+  long long now = monotonic_ms();
+  if (session.cgi != NULL)
+    session.cgi->deadline_ms = now + session.cgi->timeout_ms;
+  if (session.uwsgi != NULL)
+    session.uwsgi->deadline_ms = now + session.uwsgi->timeout_ms;
+}
+
+// Moves the body of a CGI request from the connection to the script's stdin,
+// or that of a uWSGI request to the backend socket once the packet is sent.
+// Bytes already read are decoded into upload_buf (at most UPLOAD_BUFFER_SIZE
+// at a time); the rest of a Content-Length body is spliced from the socket
+// straight into the pipe, or read through in_buff for the backend. Stops
+// whenever the socket or the sink would block: EPOLLIN on the one and
+// EPOLLOUT on the other both call it again. Once the script or backend
+// stopped reading, the rest of the body is read and dropped so that the next
+// request starts at the right byte. Returns false if the client was
+// disconnected.
+bool Server::pump_upload(const FileDescriptor *client_fd) {
+  ClientSession &session = clients.at(client_fd);
+
+  while (session.uploading) {
+    CgiJob *job = session.cgi;
+    UwsgiJob *backend = session.uwsgi;
+    if (backend != NULL && backend->sending)
+      return true; // the packet first, see uwsgi_event()
+    const FileDescriptor *stdin_fd = job != NULL ? job->stdin_fd : NULL;
+    const FileDescriptor *sink = stdin_fd;
+    if (backend != NULL && backend->streaming)
+      sink = backend->sock;
+
+    // 1. Decoded bytes to the script or backend
+    if (!session.upload_buf.empty() && !session.collecting) {
+      if (sink == NULL) {
+        session.upload_buf.clear();
+        continue;
+      }
+      Result<ssize_t> res = sink->fd_write(session.upload_buf.data(),
+                                           session.upload_buf.length());
+      if (!res.has_value()) {
+        close_upload_sink(client_fd); // it stopped reading
+        continue;
+      }
+      if (res.value() == 0)
+        return true; // full, wait for EPOLLOUT on the sink
+      session.upload_buf.erase(0, static_cast<size_t>(res.value()));
+      if (backend != NULL)
+        backend->body_sent = true;
+      upload_progress(session);
+      continue;
+    }
+
+    // 2. Body bytes already in in_buff
+    if (!session.in_buff.empty() && !session.upload.done()) {
+      size_t in_left = session.in_buff.length();
+      Result<Void> res = session.upload.decode(
+          session.in_buff, session.upload_buf,
+          session.collecting ? session.body_limit + 1 : UPLOAD_BUFFER_SIZE);
+      if (!res.has_value()) {
+        std::cerr << "ERROR: " << res.error() << std::endl;
+        disconnect(client_fd);
+        return false;
+      }
+      // A chunked body has no length to check up front
+      if (session.collecting &&
+          session.upload.decoded() > session.body_limit) {
+        std::cerr << "WARNING: request body over the route's limit"
+                  << std::endl;
+        session.upload_buf.clear();
+        session.collecting = false;
+        session.out_queue.push(gateway_error(413));
+        continue; // the rest is dropped
+      }
+      if (session.upload.done() ||
+          (session.collecting ? session.in_buff.length() < in_left
+                              : !session.upload_buf.empty()))
+        continue;
+      // else only part of a chunk-size line: read on
+    }
+
+    // 3. Whole body consumed
+    if (session.upload.done()) {
+      session.uploading = false;
+      if (job != NULL || backend != NULL) {
+        close_upload_sink(client_fd); // EOF for the script or backend
+        upload_progress(session, true);
+      } else if (session.collecting) {
+        // Routed again as a Content-Length request
+        session.collecting = false;
+        session.in_buff.insert(
+            0, dechunked_head(session.collect_head,
+                              session.upload_buf.length()) +
+                   session.upload_buf);
+        session.collect_head.clear();
+        session.upload_buf.clear();
+        handle_requests(client_fd);
+      } else {
+        handle_requests(client_fd); // its response went out already
+      }
+      return true;
+    }
+
+    // 4. More from the socket: spliced into the pipe when nothing needs
+    // decoding, otherwise read into in_buff
+    Result<ssize_t> res = OK(ssize_t, 0);
+    size_t raw = session.upload.raw_left();
+    if (raw > 0 && stdin_fd != NULL && session.in_buff.empty()) {
+      res = client_fd->splice_to(*stdin_fd, MIN(raw, UPLOAD_BUFFER_SIZE));
+      if (!res.has_value() && res.error() == Errors::broken_pipe) {
+        close_upload_sink(client_fd);
+        continue;
+      }
+      if (res.has_value() && res.value() > 0) {
+        session.upload.consumed_raw(static_cast<size_t>(res.value()));
+        upload_progress(session);
+      }
+    } else {
+      char buf[NETWORK_BUFFER_SIZE];
+      res = client_fd->sock_recv(buf, sizeof(buf));
+      if (res.has_value())
+        session.in_buff.append(buf, static_cast<size_t>(res.value()));
+    }
+    if (!res.has_value()) {
+      if (res.error() == Errors::try_again)
+        return true; // the socket is empty, or the sink is full
+      std::cerr << "ERROR: " << res.error() << std::endl;
+      disconnect(client_fd);
+      return false;
+    }
+    if (res.value() == 0) {
+      disconnect(client_fd); // EOF in the middle of the body
+      return false;
+    }
+  }
+  return true;
+}
+
+// Sends as much of out_queue as the socket accepts. EPOLLOUT is armed only
+// when the kernel buffer fills up, and reading resumes once the backlog drains
+// below OUTPUT_LOW_WATER. Returns false if the client was disconnected.
+bool Server::flush_output(const FileDescriptor *client_fd) {
+  ClientSession &session = clients.at(client_fd);
+
+  while (true) {
+    // ET 모드이므로 보낼 수 있는 만큼 (stops at EWOULDBLOCK)
+    Result<size_t> send_res = session.out_queue.flush(*client_fd);
+    if (!send_res.has_value()) {
+      std::cerr << "ERROR: " << send_res.error() << std::endl;
+      disconnect(client_fd);
+      return false;
     }
+
+    if (session.cgi != NULL && session.cgi->output_held &&
+        session.out_queue.size() <= OUTPUT_LOW_WATER)
+      cgi_resume.insert(client_fd); // read on from the script in start()
+    if (session.uwsgi != NULL && session.uwsgi->output_held &&
+        session.out_queue.size() <= OUTPUT_LOW_WATER)
+      uwsgi_resume.insert(client_fd);
+    if (!session.read_paused || session.out_queue.size() > OUTPUT_LOW_WATER)
+      break;
+    // Backlog drained: serve requests that were held back, then retry
+    session.read_paused = false;
+    handle_requests(client_fd);
+  }
+  if (session.closing && session.out_queue.size() == 0) {
+    disconnect(client_fd);
+    return false;
+  }
+
+  account(session);
+  update_interest(client_fd);
+  return true;
+}
+
+// Re-registers the client with the interest set implied by its session state.
+// EPOLL_CTL_MOD re-evaluates readiness, so re-enabling EPOLLIN after a pause
+// reports data that arrived in the meantime even in edge-triggered mode.
+void Server::update_interest(const FileDescriptor *client_fd) {
+  ClientSession &session = clients.at(client_fd);
+  bool want_write = !session.out_queue.empty();
+  bool want_read = !session.read_paused;
+
+  if (want_write == session.out_armed && want_read == session.in_armed)
+    return;
+  Event event(client_fd, want_read, want_write, false, false, false, false);
+  Option option(true, false, false, false);
+  Result<Void> mod_result = epoll.modify_fd(*client_fd, event, option);
+  if (!mod_result.has_value()) {
+    std::cerr << "ERROR: epoll modify failed: " << mod_result.error()
+              << std::endl;
+    return;
   }
+  session.out_armed = want_write;
+  session.in_armed = want_read;
 }
 
 void Server::client_write(const FileDescriptor *client_fd) {
   if (clients.find(client_fd) == clients.end())
     return;
+  flush_output(client_fd);
+}
 
-  std::string &write_buffer = clients.at(client_fd).out_buff;
-  if (!write_buffer.empty()) {
-    while (true) { // ET 모드이므로 보낼 수 있는 만큼 다 보냄
-      Result<ssize_t> send_res =
-          client_fd->sock_send(write_buffer.c_str(), write_buffer.length());
-      if (!send_res.has_value())
-        break; // EWOULDBLOCK
+// Plain-text page with the CGI admission counters, at the `metrics` path of
+// the limits block
+void Server::send_metrics(ClientSession &session) {
+  std::string body = cgi_admission.metrics() + cgi_cache.metrics() +
+                     UwsgiGroup::metrics(uwsgi_groups, monotonic_ms());
+  std::map<std::string, std::string> headers;
+  std::ostringstream length;
+  length << body.length();
+  headers["Content-Type"] = "text/plain; version=0.0.4";
+  headers["Content-Length"] = length.str();
+  Http::Body::Value none;
+  none._null = NULL;
+  session.out_queue.push(
+      Http::Response(200, headers, Http::Body(Http::Body::Empty, none))
+          .serialize_head());
+  session.out_queue.push(body);
+}
 
-      ssize_t bytes = send_res.value();
-      if (bytes == 0)
-        break;
+// GET and HEAD requests without a body or credentials share cached responses
+static bool cacheable_request(const Http::Request &request) {
+  if (request.method() != Http::GET && request.method() != Http::HEAD)
+    return false;
+  const std::map<std::string, std::string> &headers = request.headers();
+  std::map<std::string, std::string>::const_iterator length =
+      headers.find("content-length");
+  return headers.find("authorization") == headers.end() &&
+         headers.find("transfer-encoding") == headers.end() &&
+         (length == headers.end() || length->second == "0");
+}
 
-      write_buffer.erase(0, static_cast<std::size_t>(bytes));
-      if (write_buffer.empty())
-        break;
+// Answers a request to a CGI or uWSGI route with `cache` from the
+// micro-cache. Fill and Bypass leave the request to run the script or go to
+// the backend (a Fill stores its response); Wait holds it until the fill of
+// the same key ends. Anything else was answered, and for Revalidate the
+// script or backend refreshes the stale entry on this connection unless it
+// has no free slot.
+CgiCache::Lookup Server::lookup_cache(const FileDescriptor *client_fd,
+                                      const Http::Request &request,
+                                      const RouteRule &rule) {
+  const Config_CGI &cgi = rule.cgi;
+  ClientSession &session = clients.at(client_fd);
+  bool bypass = session.cache_bypass;
+  session.cache_bypass = false;
+  // Requests routed again after waiting for a slot were looked up already
+  if (bypass || cgi.Get_cache().ttl == 0 || session.cache_fill != NULL ||
+      session.cgi_admitted || session.cgi_expired ||
+      !cacheable_request(request))
+    return CgiCache::Bypass;
+
+  std::string key = cgi.Get_executable() + " " + request.path();
+  long long now = monotonic_ms();
+  const CachedResponse *entry;
+  CgiCache::Lookup lookup =
+      cgi_cache.lookup(key, request.headers(), request.method() == Http::GET,
+                       client_fd, now, entry);
+  if (lookup == CgiCache::Wait)
+    session.cache_wait = key;
+  if (lookup == CgiCache::Fill || lookup == CgiCache::Revalidate) {
+    CacheFill *fill = new CacheFill();
+    fill->key = key;
+    fill->options = cgi.Get_cache();
+    fill->request_headers = request.headers();
+    fill->background = lookup == CgiCache::Revalidate;
+    fill->status = 0;
+    fill->overflow = false;
+    fill->stored = false;
+    session.cache_fill = fill;
+  }
+  if (entry == NULL)
+    return lookup;
+
+  send_cached(session, *entry, request.method() == Http::HEAD, now);
+  if (lookup == CgiCache::Revalidate) {
+    CgiQueue *queue = cgi_admission.find(cgi.Get_executable());
+    std::string none;
+    if (!cgi_admission.try_admit(*queue)) {
+      end_fill(session.cache_fill);
+      session.cache_fill = NULL;
+    } else if (rule.op == UWSGI
+                   ? !start_uwsgi(client_fd, request, cgi, none, false)
+                   : !start_cgi(client_fd, request, cgi)) {
+      std::cerr << "WARNING: CGI cache refresh failed" << std::endl;
+      // Still here when the request was not encoded
+      if (session.cache_fill != NULL) {
+        end_fill(session.cache_fill);
+        session.cache_fill = NULL;
+      }
+    }
+  }
+  return lookup;
+}
+
+// Queues a cached response; only its head, which gets the entry's Age, is
+// copied
+void Server::send_cached(ClientSession &session, const CachedResponse &entry,
+                         bool head_only, long long now) {
+  std::ostringstream head;
+  head << entry.head << "Age: " << (now - entry.stored_ms) / 1000
+       << "\r\n\r\n";
+  session.out_queue.push(head.str());
+  if (!head_only)
+    session.out_queue.push(entry.body);
+}
+
+// Ends a cache fill and routes the requests that waited for it again: they
+// are answered from the new entry, or run the script if none was stored
+void Server::end_fill(CacheFill *fill) {
+  std::vector<const FileDescriptor *> waiters = cgi_cache.finish(fill->key);
+  for (size_t i = 0; i < waiters.size(); ++i) {
+    ClientSession &session = clients.at(waiters[i]);
+    session.cache_wait.clear();
+    session.cache_bypass = !fill->stored;
+    cache_resume.insert(waiters[i]);
+  }
+  delete fill;
+}
+
+// Queues the response a plugin built, or the error status it returned
+void Server::send_plugin(ClientSession &session, const PluginCall &call) {
+  int status = call.result != 0 ? call.result : call.response.status;
+  if (status < (call.result != 0 ? 400 : 200) || status > 599) {
+    std::cerr << "WARNING: plugin " << call.library->plugin->name
+              << " answered " << status << std::endl;
+    status = 500;
+  }
+  if (call.result != 0 || status != call.response.status) {
+    session.out_queue.push(gateway_error(status));
+    return;
+  }
+
+  std::map<std::string, std::string> headers = call.response.headers;
+  bool body = status != 204 && status != 304;
+  if (body) {
+    std::ostringstream length;
+    length << call.response.body.length();
+    headers["Content-Length"] = length.str();
+  }
+  Http::Body::Value none;
+  none._null = NULL;
+  session.out_queue.push(
+      Http::Response(status, headers, Http::Body(Http::Body::Empty, none))
+          .serialize_head());
+  if (body)
+    session.out_queue.push(call.response.body);
+}
+
+// Answers the offloaded plugin calls that finished and goes on with the
+// requests that waited behind them
+void Server::plugin_done() {
+  std::vector<PluginCall *> calls = plugins.completed();
+  for (size_t i = 0; i < calls.size(); ++i) {
+    const FileDescriptor *client_fd = calls[i]->client;
+    if (client_fd != NULL) {
+      ClientSession &session = clients.at(client_fd);
+      session.plugin_call = NULL;
+      send_plugin(session, *calls[i]);
+      handle_requests(client_fd);
+      flush_output(client_fd);
     }
+    plugins.release(calls[i]);
+  }
+}
+
+// Removes a header whatever its case; returns its value through value
+static bool take_header(std::map<std::string, std::string> &headers,
+                        std::string name, std::string *value) {
+  std::transform(name.begin(), name.end(), name.begin(), to_upper);
+  for (std::map<std::string, std::string>::iterator it = headers.begin();
+       it != headers.end(); ++it) {
+    std::string key = it->first;
+    std::transform(key.begin(), key.end(), key.begin(), to_upper);
+    if (key == name) {
+      if (value != NULL)
+        *value = it->second;
+      headers.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Forwards a request to the backend of a `$PORT` route. The exchange runs on
+// the event loop (uwsgi_event()), so a slow backend only holds up its own
+// connection; the response is queued by finish_uwsgi(). With stream_body the
+// request's body is not in body but still on the connection, and is passed
+// on by pump_upload() once the packet is sent.
+bool Server::start_uwsgi(const FileDescriptor *client_fd,
+                         const Http::Request &request, const Config_CGI &cgi,
+                         std::string &body, bool stream_body) {
+  UwsgiGroup *group = uwsgi_groups.at(cgi.Get_executable());
+  long long now = monotonic_ms();
+  size_t instance = group->pick(now);
+  UwsgiDelegate *delegate = new UwsgiDelegate(request, group->pool(instance));
+  const std::map<std::string, std::string> &vars = cgi.Get_env();
+  for (std::map<std::string, std::string>::const_iterator it = vars.begin();
+       it != vars.end(); ++it)
+    delegate->add_var(it->first, it->second);
+  // A streamed body goes out after the packet, from pump_upload()
+  BodyStream upload = stream_body ? body_stream(request) : BodyStream();
+  ClientSession &session = clients.at(client_fd);
+  Result<Void> encoded = delegate->encode(
+      body, upload.raw_left(), session.server_port, session.remote_addr);
+  CgiQueue *slot = cgi_admission.find(cgi.Get_executable());
+  if (!encoded.has_value()) {
+    std::cerr << "ERROR: " << encoded.error() << std::endl;
+    group->abandon(instance);
+    cgi_admission.release(*slot);
+    delete delegate;
+    return false;
+  }
+
+  UwsgiJob *job = new UwsgiJob();
+  job->delegate = delegate;
+  job->group = group;
+  job->instance = instance;
+  job->slot = slot;
+  job->started_ms = now;
+  job->sock = NULL;
+  job->sending = true;
+  job->head_only = request.method() == Http::HEAD;
+  job->timeout_ms = static_cast<long long>(cgi.Get_timeout() * 1000);
+  job->deadline_ms = now + job->timeout_ms;
+  job->streaming = stream_body;
+  job->body_sent = false;
+  job->head_sent = false;
+  job->chunked = false;
+  job->output_held = false;
+  job->fill = session.cache_fill;
+  session.cache_fill = NULL;
+  session.uwsgi = job;
+  if (!connect_uwsgi(client_fd)) {
+    group->done(instance, false, 0, now);
+    job->group = NULL;
+    close_uwsgi(client_fd);
+    return false;
+  }
+  if (stream_body) {
+    session.upload = upload;
+    session.uploading = true;
+    session.upload_buf.clear();
+    session.upload_until_ms = now + UPLOAD_TIME_MAX;
+  }
+  return true;
+}
+
+// Takes a connection for the uWSGI request and registers it for EPOLLOUT,
+// which a new socket reports once connected and a pooled one right away
+bool Server::connect_uwsgi(const FileDescriptor *client_fd) {
+  UwsgiJob *job = clients.at(client_fd).uwsgi;
+  Result<FileDescriptor> conn = job->delegate->connect();
+  if (!conn.has_value()) {
+    std::cerr << "ERROR: " << conn.error() << std::endl;
+    return false;
+  }
+  FileDescriptor sock = conn.value();
+  Event event(&sock, false, true, false, false, false, false);
+  Option option(true, false, false, false);
+  Result<FileDescriptor *> res = epoll.add_fd(sock, event, option);
+  if (!res.has_value()) {
+    std::cerr << "ERROR: epoll add failed: " << res.error() << std::endl;
+    return false;
+  }
+  job->sock = res.value();
+  job->sending = true;
+  uwsgi_socks[job->sock] = client_fd;
+  return true;
+}
+
+// Progress on the backend socket of a uWSGI request: the packet is written,
+// then the response relayed as it is read. A streamed body goes out in
+// between, while the response is read already: a backend may answer before
+// it has read the whole body.
+void Server::uwsgi_event(const FileDescriptor *sock_fd) {
+  const FileDescriptor *client_fd = uwsgi_socks.at(sock_fd);
+  ClientSession &session = clients.at(client_fd);
+  UwsgiJob *job = session.uwsgi;
+
+  if (!job->sending) {
+    if (job->streaming && session.uploading && !pump_upload(client_fd))
+      return;
+    if (session.uwsgi != NULL)
+      pump_uwsgi(client_fd);
+    return;
   }
+  Result<bool> sent = job->delegate->send(*sock_fd);
+  if (!sent.has_value()) {
+    uwsgi_failed(client_fd, sent.error());
+    return;
+  }
+  if (sent.value()) {
+    // EPOLL_CTL_MOD reports a response that is already there
+    job->sending = false;
+    Event event(sock_fd, true, job->streaming, false, false, false, false);
+    Option option(true, false, false, false);
+    epoll.modify_fd(*sock_fd, event, option);
+    if (job->streaming && pump_upload(client_fd))
+      flush_output(client_fd);
+  }
+}
+
+// Closes the backend connection of a failed exchange. A pooled connection
+// the backend had closed gets the request again on a new one, unless part of
+// a streamed body went out on it already; anything else answers 502.
+void Server::uwsgi_failed(const FileDescriptor *client_fd,
+                          const std::string &error) {
+  UwsgiJob *job = clients.at(client_fd).uwsgi;
+  uwsgi_socks.erase(job->sock);
+  epoll.del_fd(*job->sock);
+  job->sock = NULL;
+  job->streaming = false;
+  if (job->delegate->stale() && !job->body_sent) {
+    job->streaming = clients.at(client_fd).uploading;
+    if (connect_uwsgi(client_fd))
+      return;
+  }
+  std::cerr << "ERROR: " << error << std::endl;
+  finish_uwsgi(client_fd, 502);
+}
+
+// The script's stdin or the uWSGI backend gets no more of the request body,
+// which is complete or no longer read: EOF for the script, and the backend
+// socket is only watched for the response from then on
+void Server::close_upload_sink(const FileDescriptor *client_fd) {
+  ClientSession &session = clients.at(client_fd);
+  if (session.cgi != NULL)
+    close_cgi_pipe(session.cgi->stdin_fd);
+  UwsgiJob *job = session.uwsgi;
+  if (job == NULL || !job->streaming)
+    return;
+  job->streaming = false;
+  Event event(job->sock, true, false, false, false, false, false);
+  Option option(true, false, false, false);
+  epoll.modify_fd(*job->sock, event, option);
+}
+
+// Reads the backend's response as far as the client's out_queue allows and
+// relays it, like pump_cgi(): at OUTPUT_HIGH_WATER the rest is left in the
+// socket until flush_output() queues the client on uwsgi_resume
+void Server::pump_uwsgi(const FileDescriptor *client_fd) {
+  ClientSession &session = clients.at(client_fd);
+  UwsgiJob *job = session.uwsgi;
+  job->output_held = false;
+  if (job->sock == NULL || job->sending)
+    return;
+
+  size_t queued = session.out_queue.size();
+  size_t limit = queued < OUTPUT_HIGH_WATER ? OUTPUT_HIGH_WATER - queued : 0;
+  Result<bool> res = job->delegate->receive(*job->sock, limit);
+  if (!res.has_value()) {
+    uwsgi_failed(client_fd, res.error());
+    return;
+  }
+  if (res.value()) {
+    finish_uwsgi(client_fd, 0);
+    return;
+  }
+  job->output_held = job->delegate->output().buffered() >= limit;
+  int error_status = relay_uwsgi(session);
+  if (error_status != 0)
+    finish_uwsgi(client_fd, error_status);
+  else
+    flush_output(client_fd);
+}
+
+// Queues what the backend has sent so far: the head once it is complete,
+// with the framing of this connection (its own Content-Length,
+// Transfer-Encoding and Connection headers are replaced), then the body.
+// The body is passed through after a Content-Length and chunked otherwise,
+// unless all of it is already there. Returns the error status for a response
+// that can't be relayed, or 0.
+int Server::relay_uwsgi(ClientSession &session) {
+  UwsgiJob *job = session.uwsgi;
+  ResponseParser &output = job->delegate->output();
+  CacheFill *fill = job->fill;
+  // A background refresh only feeds the cache, like in relay_cgi()
+  OutputQueue discarded;
+  OutputQueue &out =
+      fill != NULL && fill->background ? discarded : session.out_queue;
+
+  if (!job->head_sent) {
+    if (!output.head_done()) {
+      if (output.buffered() < OUTPUT_HIGH_WATER)
+        return 0;
+      std::cerr << "ERROR: uWSGI: header block too large" << std::endl;
+      return 502;
+    }
+    int status = output.status();
+    if (status < 200 || status > 599) {
+      std::cerr << "WARNING: uWSGI backend answered " << status << std::endl;
+      return 502;
+    }
+    std::map<std::string, std::string> headers = output.headers();
+    std::string length;
+    bool has_length = take_header(headers, "Content-Length", &length);
+    take_header(headers, "Transfer-Encoding", NULL);
+    take_header(headers, "Connection", NULL);
+    if (fill != NULL) {
+      fill->status = status;
+      fill->headers = headers;
+    }
+    if (output.framing() == ResponseParser::NoBody) {
+      // A HEAD response keeps the length the backend announced
+      if (job->head_only && has_length)
+        headers["Content-Length"] = length;
+    } else if (output.framing() == ResponseParser::Length) {
+      headers["Content-Length"] = length;
+    } else if (output.done()) {
+      // All of the body is already here: no need for chunking
+      std::ostringstream size;
+      size << output.buffered();
+      headers["Content-Length"] = size.str();
+    } else {
+      job->chunked = true;
+      headers["Transfer-Encoding"] = "chunked";
+    }
+    Http::Body::Value none;
+    none._null = NULL;
+    out.push(
+        Http::Response(status, headers, Http::Body(Http::Body::Empty, none))
+            .serialize_head());
+    job->head_sent = true;
+    output_progress(session);
+  }
+
+  std::string data = output.take_body();
+  if (!data.empty())
+    output_progress(session);
+  if (fill != NULL && !fill->overflow) {
+    fill->overflow = fill->body.length() + data.length() > CGI_CACHE_MAX_ENTRY;
+    if (fill->overflow)
+      std::string().swap(fill->body);
+    else
+      fill->body += data;
+  }
+  if (!job->chunked) {
+    if (!data.empty())
+      out.push(data);
+  } else {
+    if (!data.empty()) {
+      std::ostringstream size;
+      size << std::hex << data.length() << "\r\n";
+      out.push(size.str());
+      out.push(data);
+      out.push(std::string("\r\n"));
+    }
+    if (output.done())
+      out.push(std::string("0\r\n\r\n"));
+  }
+  return 0;
+}
+
+// Completes the backend's response, or answers with a bodyless error_status
+// (502 for a failed exchange, 504 past the route's timeout), and resumes the
+// requests pipelined behind it. Once the head went out an error can only cut
+// the connection. A connection whose response ended cleanly goes back to the
+// backend's pool, unless the backend answered before all of a streamed body
+// was sent, which it would take the next request for.
+void Server::finish_uwsgi(const FileDescriptor *client_fd, int error_status) {
+  ClientSession &session = clients.at(client_fd);
+  UwsgiJob *job = session.uwsgi;
+
+  if (error_status == 0)
+    error_status = relay_uwsgi(session);
+  long long now = monotonic_ms();
+  job->group->done(job->instance, error_status == 0, now - job->started_ms,
+                   now);
+  job->group = NULL;
+  if (error_status == 0 && job->fill != NULL)
+    cgi_cache.store(*job->fill, now);
+  if (error_status != 0 && job->fill != NULL && job->fill->background) {
+    // The stale entry stays until its stale window ends
+    std::cerr << "WARNING: uWSGI cache refresh failed" << std::endl;
+  } else if (error_status != 0 && job->head_sent) {
+    std::cerr << "WARNING: uWSGI response cut short" << std::endl;
+    disconnect(client_fd);
+    return;
+  } else if (error_status != 0) {
+    session.out_queue.push(gateway_error(error_status));
+  }
+  if (error_status == 0 && job->sock != NULL && job->delegate->reusable() &&
+      !session.uploading) {
+    uwsgi_socks.erase(job->sock);
+    Result<FileDescriptor> kept = epoll.take_fd(*job->sock);
+    if (kept.has_value())
+      job->delegate->pool().checkin(kept.value(), now);
+    job->sock = NULL;
+  }
+  close_uwsgi(client_fd);
+  if (session.closed) {
+    disconnect(client_fd);
+    return;
+  }
+
+  handle_requests(client_fd);
+  flush_output(client_fd);
+}
+
+// Releases the uWSGI job of a session, closing its backend connection
+void Server::close_uwsgi(const FileDescriptor *client_fd) {
+  ClientSession &session = clients.at(client_fd);
+  UwsgiJob *job = session.uwsgi;
+  if (job == NULL)
+    return;
+  if (job->group != NULL)
+    job->group->abandon(job->instance);
+  if (job->sock != NULL) {
+    uwsgi_socks.erase(job->sock);
+    epoll.del_fd(*job->sock);
+  }
+  cgi_admission.release(*job->slot);
+  if (job->fill != NULL)
+    end_fill(job->fill);
+  delete job->delegate;
+  delete job;
+  session.uwsgi = NULL;
+  uwsgi_resume.erase(client_fd);
+  // The rest of a streamed body is dropped, even if the socket reports
+  // nothing new: it may have stopped while the backend was full
+  if (session.uploading)
+    upload_resume.insert(client_fd);
+}
+
+// The uWSGI backend whose health probe fd is, or NULL
+UwsgiGroup *Server::probe_owner(const FileDescriptor *fd) const {
+  for (std::map<std::string, UwsgiGroup *>::const_iterator it =
+           uwsgi_groups.begin();
+       it != uwsgi_groups.end(); ++it) {
+    if (it->second->owns(fd))
+      return it->second;
+  }
+  return NULL;
+}
+
+// Answers the uWSGI requests past their route's timeout, then runs the
+// backends' health probes and closes their idle connections past
+// keepalive_timeout
+void Server::sweep_uwsgi() {
+  long long now = monotonic_ms();
+  std::vector<const FileDescriptor *> late;
+  for (std::map<const FileDescriptor *, const FileDescriptor *>::iterator it =
+           uwsgi_socks.begin();
+       it != uwsgi_socks.end(); ++it) {
+    if (now >= clients.at(it->second).uwsgi->deadline_ms)
+      late.push_back(it->second);
+  }
+  for (size_t i = 0; i < late.size(); ++i) {
+    std::cerr << "WARNING: uWSGI timed out" << std::endl;
+    finish_uwsgi(late[i], 504);
+  }
+
+  for (std::map<std::string, UwsgiGroup *>::iterator it =
+           uwsgi_groups.begin();
+       it != uwsgi_groups.end(); ++it)
+    it->second->tick(now);
+}
+
+// Whether the CGI request at the front of in_buff may start. A request that
+// waited in its script's queue is routed again with the verdict it got there.
+CgiAdmission::Verdict Server::admit_cgi(const FileDescriptor *client_fd,
+                                        const Config_CGI &cgi) {
+  ClientSession &session = clients.at(client_fd);
+  if (session.cgi_admitted) {
+    session.cgi_admitted = false;
+    session.cgi_queue = NULL; // the slot now belongs to the job
+    return CgiAdmission::Run;
+  }
+  if (session.cgi_expired) {
+    session.cgi_expired = false;
+    return CgiAdmission::Refuse;
+  }
+  CgiQueue *queue = cgi_admission.find(cgi.Get_executable());
+  CgiAdmission::Verdict verdict =
+      cgi_admission.admit(*queue, client_fd, monotonic_ms());
+  if (verdict == CgiAdmission::Wait)
+    session.cgi_queue = queue;
+  else if (verdict == CgiAdmission::Refuse)
+    std::cerr << "WARNING: CGI " << cgi.Get_executable() << " is busy"
+              << std::endl;
+  return verdict;
+}
+
+// Answers a request that won't run: 503 when its script is at its limits,
+// 502 when it could not be started, 413 when its body is over the route's
+// limit. The body, unless it was parsed with the request, is read and
+// dropped by pump_upload() like the rest of a body the script stopped reading.
+void Server::refuse_cgi(const FileDescriptor *client_fd,
+                        const Http::Request &request, int status,
+                        bool drain_body) {
+  ClientSession &session = clients.at(client_fd);
+  session.out_queue.push(status == 503 ? cgi_busy_response
+                                       : gateway_error(status));
+  if (session.cache_fill != NULL) {
+    end_fill(session.cache_fill);
+    session.cache_fill = NULL;
+  }
+  if (!drain_body)
+    return;
+  session.upload = body_stream(request);
+  session.uploading = !session.upload.done();
+  session.upload_buf.clear();
+  if (session.uploading && !session.in_buff.empty())
+    upload_resume.insert(client_fd);
+}
+
+// Hands freed slots to queued CGI requests, oldest first, after answering
+// the ones that waited longer than their queue_timeout with a 503
+void Server::serve_cgi_queue() {
+  long long now = monotonic_ms();
+  const FileDescriptor *client_fd;
+
+  while ((client_fd = cgi_admission.next_expired(now)) != NULL) {
+    ClientSession &session = clients.at(client_fd);
+    std::cerr << "WARNING: CGI request waited too long" << std::endl;
+    session.cgi_queue = NULL;
+    session.cgi_expired = true;
+    session.head_routed = false;
+    handle_requests(client_fd);
+    flush_output(client_fd);
+  }
+  while ((client_fd = cgi_admission.next_ready(now)) != NULL) {
+    ClientSession &session = clients.at(client_fd);
+    session.cgi_admitted = true;
+    session.head_routed = false;
+    handle_requests(client_fd);
+    flush_output(client_fd);
+  }
+}
+
+// Starts the script of a CGI route: forks it and registers its pipes with
+// EPoll, or hands the request to a pooled worker. The response is queued by
+// finish_cgi(), so a slow script only holds up its own connection.
+bool Server::start_cgi(const FileDescriptor *client_fd,
+                       const Http::Request &request, const Config_CGI &cgi) {
+  ClientSession &session = clients.at(client_fd);
+  bool pooled = cgi.Get_pool().max_workers > 0;
+  CgiDelegate *delegate =
+      new CgiDelegate(request, cgi.Get_executable(), pooled);
+  delegate->add_env_block(cgi.Get_env_block());
+
+  CgiJob *job = new CgiJob();
+  job->delegate = delegate;
+  job->stdin_fd = NULL;
+  job->stdout_fd = NULL;
+  job->pool = NULL;
+  job->worker = NULL;
+  job->slot = cgi_admission.find(cgi.Get_executable());
+  job->timeout_ms = static_cast<long long>(cgi.Get_timeout() * 1000);
+  job->deadline_ms = monotonic_ms() + job->timeout_ms;
+  job->relay = CgiJob::Head;
+  job->body_left = 0;
+  job->output_held = false;
+  job->fill = session.cache_fill;
+  session.cache_fill = NULL;
+
+  if (pooled) {
+    delegate->use_pool();
+    job->pool = cgi_pools.at(cgi.Get_executable());
+    session.cgi = job;
+    cgi_clients.insert(client_fd);
+    if (!assign_worker(client_fd)) {
+      close_cgi(client_fd);
+      return false;
+    }
+    return true;
+  }
+
+  Result<std::pair<FileDescriptor, FileDescriptor> > pipes =
+      delegate->spawn();
+  if (!pipes.has_value()) {
+    std::cerr << "ERROR: CGI: " << pipes.error() << std::endl;
+    cgi_admission.release(*job->slot);
+    if (job->fill != NULL)
+      end_fill(job->fill);
+    delete delegate;
+    delete job;
+    return false;
+  }
+  FileDescriptor stdin_fd = pipes.value().first;
+  FileDescriptor stdout_fd = pipes.value().second;
+  session.cgi = job;
+  cgi_clients.insert(client_fd);
+  children.watch(delegate->child(), cgi.Get_executable(), monotonic_ms());
+  cgi_pids[delegate->child()] = client_fd;
+
+  Option option(true, false, false, false);
+  Event out_event(&stdout_fd, true, false, false, false, false, false);
+  Result<FileDescriptor *> out_result =
+      epoll.add_fd(stdout_fd, out_event, option);
+  if (!out_result.has_value()) {
+    std::cerr << "ERROR: epoll add failed: " << out_result.error()
+              << std::endl;
+    close_cgi(client_fd);
+    return false;
+  }
+  job->stdout_fd = out_result.value();
+  cgi_pipes[job->stdout_fd] = client_fd;
+
+  // The body still in in_buff or on the socket is streamed by pump_upload(),
+  // which the first EPOLLOUT on stdin starts. Without a body, closing stdin
+  // (stdin_fd going out of scope) gives the script its EOF right away.
+  session.upload = body_stream(request);
+  session.uploading = !session.upload.done();
+  session.upload_until_ms = monotonic_ms() + UPLOAD_TIME_MAX;
+  if (session.uploading) {
+    Event in_event(&stdin_fd, false, true, false, false, false, false);
+    Result<FileDescriptor *> in_result =
+        epoll.add_fd(stdin_fd, in_event, option);
+    if (!in_result.has_value()) {
+      std::cerr << "ERROR: epoll add failed: " << in_result.error()
+                << std::endl;
+      close_cgi(client_fd);
+      return false;
+    }
+    job->stdin_fd = in_result.value();
+    cgi_pipes[job->stdin_fd] = client_fd;
+  }
+  return true;
+}
+
+// Sends a pooled request to a free worker, or queues the client until one is
+// released. Returns false if no worker could be started.
+bool Server::assign_worker(const FileDescriptor *client_fd) {
+  CgiJob *job = clients.at(client_fd).cgi;
+
+  Result<CgiWorker *> res = job->pool->acquire(monotonic_ms());
+  if (!res.has_value()) {
+    std::cerr << "ERROR: CGI worker: " << res.error() << std::endl;
+    return false;
+  }
+  if (res.value() == NULL) {
+    job->pool->waiting.push_back(client_fd);
+    return true;
+  }
+  job->worker = res.value();
+  cgi_pipes[job->worker->sock] = client_fd;
+
+  // The worker socket stays registered for IN|OUT; EAGAIN waits for the
+  // next EPOLLOUT edge
+  Result<bool> write_result = job->delegate->write_body(*job->worker->sock);
+  if (!write_result.has_value()) {
+    std::cerr << "ERROR: CGI worker: " << write_result.error() << std::endl;
+    cgi_pipes.erase(job->worker->sock);
+    job->pool->discard(job->worker, monotonic_ms());
+    job->worker = NULL;
+    return false;
+  }
+  return true;
+}
+
+// Hands workers that became free to the clients queued on the pool
+void Server::serve_waiting(CgiPool *pool) {
+  while (!pool->waiting.empty()) {
+    const FileDescriptor *client_fd = pool->waiting.front();
+    pool->waiting.pop_front();
+    if (!assign_worker(client_fd)) {
+      finish_cgi(client_fd, 502);
+      continue;
+    }
+    if (clients.at(client_fd).cgi->worker == NULL)
+      break; // queued again: every worker is busy
+  }
+}
+
+// Unregisters a CGI pipe; EPoll closes it
+void Server::close_cgi_pipe(const FileDescriptor *&pipe_fd) {
+  if (pipe_fd == NULL)
+    return;
+  cgi_pipes.erase(pipe_fd);
+  epoll.del_fd(*pipe_fd);
+  pipe_fd = NULL;
+}
+
+// Progress on one of the pipes of a running script, or on the socket of the
+// pooled worker serving the request
+void Server::cgi_event(const FileDescriptor *pipe_fd, const Event &event) {
+  const FileDescriptor *client_fd = cgi_pipes.at(pipe_fd);
+  CgiJob *job = clients.at(client_fd).cgi;
+
+  if (job->worker != NULL) {
+    if (event.out) {
+      Result<bool> sent = job->delegate->write_body(*pipe_fd);
+      if (!sent.has_value()) {
+        std::cerr << "ERROR: CGI worker: " << sent.error() << std::endl;
+        worker_done(client_fd, false);
+        return;
+      }
+    }
+    if (event.in || event.hup || event.err)
+      pump_cgi(client_fd);
+    return;
+  }
+
+  if (pipe_fd == job->stdin_fd) {
+    // A script may answer without reading all of its input (EPOLLERR); the
+    // rest of the body is then dropped
+    if (event.err)
+      close_cgi_pipe(job->stdin_fd);
+    pump_upload(client_fd);
+    return;
+  }
+  pump_cgi(client_fd);
+}
+
+// Reads the script's output as far as the client's out_queue allows and
+// relays it. Once out_queue holds OUTPUT_HIGH_WATER bytes the rest is left in
+// the pipe, which in turn blocks the script, until flush_output() drains the
+// backlog and queues the client on cgi_resume.
+void Server::pump_cgi(const FileDescriptor *client_fd) {
+  ClientSession &session = clients.at(client_fd);
+  CgiJob *job = session.cgi;
+  const FileDescriptor *out =
+      job->worker != NULL ? job->worker->sock : job->stdout_fd;
+  job->output_held = false;
+  if (out == NULL)
+    return; // waiting for the worker, or for the script to exit
+
+  size_t queued = session.out_queue.size();
+  size_t limit = queued < OUTPUT_HIGH_WATER ? OUTPUT_HIGH_WATER - queued : 0;
+  Result<bool> res = job->delegate->read_output(*out, limit);
+  if (res.has_value() && !res.value()) {
+    job->output_held = job->delegate->buffered() >= limit;
+    int error_status = relay_cgi(session, false);
+    if (error_status != 0)
+      finish_cgi(client_fd, error_status);
+    else
+      flush_output(client_fd);
+    return;
+  }
+
+  if (job->worker != NULL) {
+    if (!res.has_value())
+      std::cerr << "ERROR: CGI worker: " << res.error() << std::endl;
+    worker_done(client_fd, res.has_value());
+    return;
+  }
+  if (!res.has_value()) {
+    std::cerr << "ERROR: CGI: " << res.error() << std::endl;
+    finish_cgi(client_fd, 502);
+    return;
+  }
+  // EOF: the response is complete once the exit status is known. A script
+  // still exiting is picked up by child_exited().
+  close_cgi_pipe(job->stdout_fd);
+  if (job->delegate->child() <= 0)
+    finish_cgi(client_fd, 0);
+}
+
+// The pooled worker of the request answered (ok) or failed; it goes back to
+// its pool, or is replaced, and the next queued request gets a worker
+void Server::worker_done(const FileDescriptor *client_fd, bool ok) {
+  CgiJob *job = clients.at(client_fd).cgi;
+  CgiPool *pool = job->pool;
+
+  cgi_pipes.erase(job->worker->sock);
+  if (ok)
+    pool->release(job->worker, monotonic_ms());
+  else
+    pool->discard(job->worker, monotonic_ms());
+  job->worker = NULL;
+  finish_cgi(client_fd, ok ? 0 : 502);
+  serve_waiting(pool);
+}
+
+// Queues what the script has written so far: the head once its header block
+// is complete, then the body framed the way the head announced. Returns the
+// error status for output that is not a valid response, or 0.
+int Server::relay_cgi(ClientSession &session, bool at_eof) {
+  CgiJob *job = session.cgi;
+  CgiDelegate *delegate = job->delegate;
+  CacheFill *fill = job->fill;
+  // A background refresh only feeds the cache; its client got the stale copy
+  OutputQueue discarded;
+  OutputQueue &out =
+      fill != NULL && fill->background ? discarded : session.out_queue;
+
+  if (job->relay == CgiJob::Head) {
+    Result<bool> parsed = delegate->parse_head(at_eof);
+    if (!parsed.has_value()) {
+      std::cerr << "ERROR: CGI: " << parsed.error() << std::endl;
+      return 502;
+    }
+    if (!parsed.value()) {
+      if (delegate->buffered() < OUTPUT_HIGH_WATER)
+        return 0;
+      std::cerr << "ERROR: CGI: header block too large" << std::endl;
+      return 502;
+    }
+
+    Http::Response head = delegate->head();
+    std::map<std::string, std::string> &headers = head.headers_mut();
+    int status = head.status_code();
+    std::string length;
+    bool has_length = take_header(headers, "content-length", &length);
+    // The script's own framing can't be trusted on this connection
+    take_header(headers, "transfer-encoding", NULL);
+    if (fill != NULL) {
+      fill->status = status;
+      fill->headers = headers;
+    }
+
+    if ((status >= 100 && status < 200) || status == 204 || status == 304) {
+      job->relay = CgiJob::NoBody;
+    } else if (has_length) {
+      if (length.empty() ||
+          length.find_first_not_of("0123456789") != std::string::npos) {
+        std::cerr << "ERROR: CGI: invalid Content-Length" << std::endl;
+        return 502;
+      }
+      job->relay = CgiJob::Length;
+      job->body_left = std::strtoul(length.c_str(), NULL, 10);
+    } else if (at_eof) {
+      // Whole body already known (a quick script): no need for chunking
+      std::ostringstream oss;
+      oss << delegate->buffered();
+      length = oss.str();
+      job->relay = CgiJob::Length;
+      job->body_left = delegate->buffered();
+    } else {
+      job->relay = CgiJob::Chunked;
+      headers["Transfer-Encoding"] = "chunked";
+    }
+    if (job->relay == CgiJob::Length)
+      headers["Content-Length"] = length;
+    out.push(head.serialize_head());
+    output_progress(session);
+  }
+
+  std::string data = delegate->take_output();
+  if (!data.empty())
+    output_progress(session);
+  if (job->relay == CgiJob::Length && data.length() > job->body_left)
+    data.resize(job->body_left);
+  if (fill != NULL && !fill->overflow && job->relay != CgiJob::NoBody) {
+    fill->overflow = fill->body.length() + data.length() > CGI_CACHE_MAX_ENTRY;
+    if (fill->overflow)
+      std::string().swap(fill->body);
+    else
+      fill->body += data;
+  }
+  switch (job->relay) {
+  case CgiJob::Length:
+    job->body_left -= data.length();
+    out.push(data);
+    break;
+  case CgiJob::Chunked:
+    if (!data.empty()) {
+      std::ostringstream size;
+      size << std::hex << data.length() << "\r\n";
+      out.push(size.str());
+      out.push(data);
+      out.push(std::string("\r\n"));
+    }
+    if (at_eof)
+      out.push(std::string("0\r\n\r\n"));
+    break;
+  case CgiJob::Head:
+  case CgiJob::NoBody:
+    break;
+  }
+  if (at_eof && job->relay == CgiJob::Length && job->body_left > 0) {
+    std::cerr << "ERROR: CGI: body shorter than Content-Length" << std::endl;
+    return 502;
+  }
+  return 0;
+}
+
+// Completes the response with the rest of the script's output, or answers
+// with a bodyless error_status (502 for a failed script, 504 past its
+// deadline), and resumes the requests pipelined behind it. Once the head went
+// out an error can only cut the connection, so the client sees the response
+// is incomplete.
+void Server::finish_cgi(const FileDescriptor *client_fd, int error_status) {
+  ClientSession &session = clients.at(client_fd);
+  CgiJob *job = session.cgi;
+
+  if (error_status == 0 && !job->delegate->succeeded()) {
+    std::cerr << "ERROR: CGI: CGI script failed" << std::endl;
+    error_status = 502;
+  }
+  if (error_status == 0)
+    error_status = relay_cgi(session, true);
+  if (error_status == 0 && job->fill != NULL)
+    cgi_cache.store(*job->fill, monotonic_ms());
+  if (error_status != 0 && job->fill != NULL && job->fill->background) {
+    // The stale entry stays until its stale window ends
+    std::cerr << "WARNING: CGI cache refresh failed" << std::endl;
+  } else if (error_status != 0) {
+    if (job->relay != CgiJob::Head) {
+      std::cerr << "WARNING: CGI response cut short" << std::endl;
+      disconnect(client_fd);
+      return;
+    }
+    session.out_queue.push(gateway_error(error_status));
+  }
+  close_cgi(client_fd);
+  if (session.closed) {
+    disconnect(client_fd);
+    return;
+  }
+
+  handle_requests(client_fd);
+  flush_output(client_fd);
+}
+
+// Releases the CGI job of a session; a script that is still running is
+// terminated and reaped later, and a worker abandoned mid-request is replaced
+void Server::close_cgi(const FileDescriptor *client_fd) {
+  ClientSession &session = clients.at(client_fd);
+  CgiJob *job = session.cgi;
+  if (job == NULL)
+    return;
+  close_cgi_pipe(job->stdin_fd);
+  close_cgi_pipe(job->stdout_fd);
+  pid_t pid = job->delegate->release_child();
+  if (pid > 0) {
+    cgi_pids[pid] = NULL;
+    children.terminate(pid, monotonic_ms());
+  }
+  if (job->worker != NULL) {
+    cgi_pipes.erase(job->worker->sock);
+    job->pool->discard(job->worker, monotonic_ms());
+  } else if (job->pool != NULL) {
+    std::deque<const FileDescriptor *> &waiting = job->pool->waiting;
+    waiting.erase(std::remove(waiting.begin(), waiting.end(), client_fd),
+                  waiting.end());
+  }
+  cgi_admission.release(*job->slot);
+  if (job->fill != NULL)
+    end_fill(job->fill);
+  delete job->delegate;
+  delete job;
+  session.cgi = NULL;
+  cgi_clients.erase(client_fd);
+  cgi_resume.erase(client_fd);
+}
+
+// Logs the exit of a child process. The response of a script is complete
+// once it has exited and closed stdout, in either order.
+void Server::child_exited(const ChildExit &exit) {
+  std::ostringstream how;
+  if (exit.status == -1)
+    how << "lost";
+  else if (WIFEXITED(exit.status))
+    how << "exit " << WEXITSTATUS(exit.status);
+  else if (WIFSIGNALED(exit.status))
+    how << "signal " << WTERMSIG(exit.status);
+  std::cout << "[CGI] " << exit.name << " (pid " << exit.pid
+            << "): " << how.str() << (exit.terminated ? " (terminated)" : "")
+            << ", " << exit.wall_ms << " ms, cpu "
+            << static_cast<double>(exit.user_us) / 1000 << " ms user "
+            << static_cast<double>(exit.sys_us) / 1000 << " ms sys"
+            << std::endl;
+
+  std::map<pid_t, const FileDescriptor *>::iterator it =
+      cgi_pids.find(exit.pid);
+  if (it == cgi_pids.end())
+    return; // a pooled worker
+  const FileDescriptor *client_fd = it->second;
+  cgi_pids.erase(it);
+  cgi_admission.record_exit(exit.name, exit.wall_ms,
+                            exit.user_us + exit.sys_us);
+  if (client_fd == NULL)
+    return; // its request is gone already
+
+  CgiJob *job = clients.at(client_fd).cgi;
+  job->delegate->set_exit_status(exit.status);
+  if (job->stdout_fd == NULL)
+    finish_cgi(client_fd, 0);
+}
+
+// Kills the scripts past their deadline, reaps children that have no pidfd
+// and keeps the worker pools at size
+void Server::sweep_cgi() {
+  long long now = monotonic_ms();
+  std::vector<const FileDescriptor *> running(cgi_clients.begin(),
+                                              cgi_clients.end());
+
+  for (size_t i = 0; i < running.size(); ++i) {
+    // finish_cgi() may disconnect its own client, never another one
+    if (clients.find(running[i]) == clients.end())
+      continue;
+    CgiJob *job = clients.at(running[i]).cgi;
+    if (job != NULL && now >= job->deadline_ms) {
+      std::cerr << "WARNING: CGI timed out" << std::endl;
+      finish_cgi(running[i], 504);
+    }
+  }
+
+  std::vector<ChildExit> exits;
+  children.sweep(now, exits);
+  for (size_t i = 0; i < exits.size(); ++i)
+    child_exited(exits[i]);
+
+  for (std::map<std::string, CgiPool *>::iterator it = cgi_pools.begin();
+       it != cgi_pools.end(); ++it) {
+    it->second->maintain(now);
+    serve_waiting(it->second);
+  }
+}
+
+// epoll.wait() timeout: until the nearest CGI, queue, SIGKILL, uWSGI probe
+// or accept retry deadline.
+// Worker pools are maintained at least every CGI_POOL_INTERVAL.
+int Server::wait_timeout() const {
+  if (!accept_pending.empty() || !cgi_resume.empty() ||
+      !uwsgi_resume.empty() || !upload_resume.empty() ||
+      !cache_resume.empty())
+    return 0;
+  long long now = monotonic_ms();
+  long long timeout = cgi_pools.empty() ? -1 : CGI_POOL_INTERVAL;
+  long long deadlines[] = {
+      cgi_admission.next_deadline(), children.next_deadline(now),
+      paused_listeners.empty() ? -1 : accept_retry_ms};
+  for (size_t i = 0; i < 3; ++i) {
+    if (deadlines[i] >= 0 && (timeout < 0 || deadlines[i] - now < timeout))
+      timeout = MAX(deadlines[i] - now, 0LL);
+  }
+  for (std::map<std::string, UwsgiGroup *>::const_iterator it =
+           uwsgi_groups.begin();
+       it != uwsgi_groups.end(); ++it) {
+    long long deadline = it->second->next_deadline();
+    if (deadline >= 0 && (timeout < 0 || deadline - now < timeout))
+      timeout = MAX(deadline - now, 0LL);
+  }
+  for (std::set<const FileDescriptor *>::const_iterator it =
+           cgi_clients.begin();
+       it != cgi_clients.end(); ++it) {
+    const CgiJob *job = clients.at(*it).cgi;
+    long long left = MAX(job->deadline_ms - now, 0LL);
+    if (timeout < 0 || left < timeout)
+      timeout = left;
+  }
+  for (std::map<const FileDescriptor *, const FileDescriptor *>::const_iterator
+           it = uwsgi_socks.begin();
+       it != uwsgi_socks.end(); ++it) {
+    const UwsgiJob *job = clients.at(it->second).uwsgi;
+    long long left = MAX(job->deadline_ms - now, 0LL);
+    if (timeout < 0 || left < timeout)
+      timeout = left;
+  }
+  return static_cast<int>(timeout);
+}
+
+// One admission queue per script or uWSGI backend and one pool per pooled
+// script, shared by every route that names it. The min_workers are started
+// right away.
+Result<Void> Server::create_pools(const ServerConfig &server) {
+  const std::vector<RouteRule> &routes = server.Get_Routes();
+  for (size_t i = 0; i < routes.size(); ++i) {
+    const Config_CGI &cgi = routes[i].cgi;
+    if (routes[i].op != CGI && routes[i].op != UWSGI)
+      continue;
+    // Routes naming the same script share its queue and its workers, so
+    // they must not ask for different ones
+    CgiQueue *queue = cgi_admission.find(cgi.Get_executable());
+    if (queue != NULL && !(queue->options == cgi.Get_queue()))
+      return ERR(Void, cgi.Get_executable() +
+                           ": routes set different concurrency, queue or "
+                           "queue_timeout options");
+    cgi_admission.add_script(cgi);
+    if (cgi.Get_pool().max_workers == 0)
+      continue;
+    std::map<std::string, CgiPool *>::iterator it =
+        cgi_pools.find(cgi.Get_executable());
+    if (it != cgi_pools.end()) {
+      if (!it->second->matches(cgi))
+        return ERR(Void, cgi.Get_executable() +
+                             ": pooled routes set different workers, "
+                             "max_requests, idle_timeout or variables");
+      continue;
+    }
+    CgiPool *pool = new CgiPool(cgi, epoll, children);
+    cgi_pools[cgi.Get_executable()] = pool;
+    pool->maintain(monotonic_ms());
+  }
+  return OKV;
+}
+
+// Loads the plugin of every `&library.so` route of every server block
+Result<Void> Server::load_plugins() {
+  std::vector<const Config_Plugin *> routes;
+  const std::map<unsigned int, ServerConfig> &servers =
+      config.Get_ServerConfig_map();
+  for (std::map<unsigned int, ServerConfig>::const_iterator it =
+           servers.begin();
+       it != servers.end(); ++it) {
+    const std::vector<RouteRule> &rules = it->second.Get_Routes();
+    for (size_t i = 0; i < rules.size(); ++i)
+      if (rules[i].op == PLUGIN)
+        routes.push_back(&rules[i].plugin);
+  }
+  const std::map<std::string, ServerConfig> &unix_servers =
+      config.Get_UnixServerConfig_map();
+  for (std::map<std::string, ServerConfig>::const_iterator it =
+           unix_servers.begin();
+       it != unix_servers.end(); ++it) {
+    const std::vector<RouteRule> &rules = it->second.Get_Routes();
+    for (size_t i = 0; i < rules.size(); ++i)
+      if (rules[i].op == PLUGIN)
+        routes.push_back(&rules[i].plugin);
+  }
+  return plugins.load(routes, config.Get_Limits().plugin_threads);
+}
+
+// Applies the ListenOptions of a server block. A failing option only warns,
+// like SO_REUSEADDR: the listener still works with the system default. The
+// config of a unix listener sets no TCP option.
+static void set_listen_options(FileDescriptor &server_fd,
+                               const ListenOptions &listen) {
+  struct {
+    bool enabled;
+    int level;
+    int name;
+    int value;
+    const char *label;
+  } options[] = {
+      {listen.reuseport, SOL_SOCKET, SO_REUSEPORT, 1, "SO_REUSEPORT"},
+      {listen.rcvbuf > 0, SOL_SOCKET, SO_RCVBUF, listen.rcvbuf, "SO_RCVBUF"},
+      {listen.sndbuf > 0, SOL_SOCKET, SO_SNDBUF, listen.sndbuf, "SO_SNDBUF"},
+      {listen.tcp_nodelay, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY"},
+      {listen.tcp_defer_accept > 0, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+       listen.tcp_defer_accept, "TCP_DEFER_ACCEPT"},
+      {listen.tcp_fastopen > 0, IPPROTO_TCP, TCP_FASTOPEN, listen.tcp_fastopen,
+       "TCP_FASTOPEN"},
+  };
+
+  for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); ++i) {
+    if (!options[i].enabled)
+      continue;
+    Result<Void> res = server_fd.set_socket_option(
+        options[i].level, options[i].name, &options[i].value, sizeof(int));
+    if (!res.has_value())
+      std::cerr << "WARNING: " << options[i].label << " failed: " << res.error()
+                << std::endl;
+  }
+}
+
+// listen() and register the socket with EPoll as a listener of server
+Result<Void> Server::start_listening(FileDescriptor &server_fd,
+                                     const ServerConfig &server,
+                                     const std::string &port) {
+  // Listen (max queue length)
+  int backlog = server.Get_Listen().backlog;
+  if (backlog == 0)
+    backlog = SOMAXCONN;
+  Result<Void> listen_result =
+      server_fd.socket_listen(static_cast<unsigned short>(backlog));
+  if (!listen_result.has_value())
+    return ERR(Void, listen_result.error());
+
+  // EPoll event and option setting
+  Event event(&server_fd, true, false, false, false, false, false); // in=true
+  Option op(true, false, false, false);                             // et=true
+
+  // Add server socket to EPoll
+  Result<FileDescriptor *> add_result = epoll.add_fd(server_fd, event, op);
+  if (!add_result.has_value())
+    return ERR(Void, add_result.error());
+
+  // Save pointer to distinguish server sockets from client sockets
+  FileDescriptor *fd_ptr = add_result.value();
+  listeners[fd_ptr] = &server;
+  listener_ports[fd_ptr] = port;
+  return OK(Void, Void());
 }
 
 Result<Void> Server::init() {
+  // A client resetting during sendfile() (which has no MSG_NOSIGNAL) or a CGI
+  // script exiting before reading its input must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+  // Handler plugins are loaded again from disk on SIGHUP
+  signal(SIGHUP, request_reload);
+
   // EPoll init
   Result<EPoll> epoll_result = EPoll::create(1024);
   if (!epoll_result.has_value())
     return ERR(Void, epoll_result.error());
   epoll = epoll_result.value();
 
+  // Serialized once; sent as-is to connections refused under overload
+  std::ostringstream overload;
+  overload << "HTTP/1.1 503 Service Unavailable\r\n";
+  overload << "Retry-After: " << config.Get_Limits().retry_after << "\r\n";
+  overload << "Content-Length: 0\r\n";
+  overload << "Connection: close\r\n\r\n";
+  overload_response = overload.str();
+  std::map<std::string, std::string> busy_headers;
+  std::ostringstream retry_after;
+  retry_after << config.Get_Limits().retry_after;
+  busy_headers["Retry-After"] = retry_after.str();
+  cgi_busy_response = gateway_error(503, busy_headers);
+  cgi_admission.set_limits(config.Get_Limits().max_cgi,
+                           config.Get_Limits().max_cgi_queued);
+  cgi_cache.set_limit(config.Get_Limits().cgi_cache);
+  const std::map<std::string, UwsgiBackend> &backends = config.Get_Uwsgi_map();
+  for (std::map<std::string, UwsgiBackend>::const_iterator it =
+           backends.begin();
+       it != backends.end(); ++it)
+    uwsgi_groups[it->first] = new UwsgiGroup(epoll, it->second);
+
   // Init server socket for every port listed on configuration file
   const std::map<unsigned int, ServerConfig> &servers =
       config.Get_ServerConfig_map();
@@ -161,41 +2161,90 @@ Result<Void> Server::init() {
       std::cerr << "WARNING: SO_REUSEADDR failed: " << reuseaddr_result.error()
                 << std::endl;
 
+    // Per-server tuning from the config, set before bind()/listen()
+    const ListenOptions &listen = it->second.Get_Listen();
+    set_listen_options(server_fd, listen);
+
     // Bind (associate IP and port)
-    struct in_addr addr;
-    addr.s_addr = htonl(INADDR_ANY); // All IPs
-    Result<Void> bind_result = server_fd.socket_bind(addr, port);
+    Result<Void> bind_result = server_fd.socket_bind(listen.address, port);
     if (!bind_result.has_value())
       return ERR(Void, bind_result.error());
 
-    // Listen (max queue length)
-    Result<Void> listen_result = server_fd.socket_listen(SOMAXCONN);
+    std::ostringstream port_text;
+    port_text << port;
+    Result<Void> listen_result =
+        start_listening(server_fd, it->second, port_text.str());
     if (!listen_result.has_value())
       return ERR(Void, listen_result.error());
 
-    // EPoll event and option setting
-    Event event(&server_fd, true, false, false, false, false, false); // in=true
-    Option op(true, false, false, false);                             // et=true
+    Result<Void> pools_result = create_pools(it->second);
+    if (!pools_result.has_value())
+      return ERR(Void, pools_result.error());
+
+    std::cout << "Server listening on " << inet_ntoa(listen.address) << ":"
+              << port << std::endl;
+  }
+
+  // Unix domain socket listeners share routing and session handling; only
+  // the socket family differs
+  const std::map<std::string, ServerConfig> &unix_servers =
+      config.Get_UnixServerConfig_map();
+  for (std::map<std::string, ServerConfig>::const_iterator it =
+           unix_servers.begin();
+       it != unix_servers.end(); ++it) {
+    const std::string &path = it->first;
+
+    Result<FileDescriptor> sock_result = FileDescriptor::socket_new(AF_UNIX);
+    if (!sock_result.has_value())
+      return ERR(Void, sock_result.error());
+    FileDescriptor server_fd = sock_result.value();
+
+    Result<Void> nb_result = server_fd.set_nonblocking();
+    if (!nb_result.has_value())
+      return ERR(Void, nb_result.error());
+
+    const ListenOptions &listen = it->second.Get_Listen();
+    set_listen_options(server_fd, listen);
 
-    // Add server socket to EPoll
-    Result<FileDescriptor *> add_result = epoll.add_fd(server_fd, event, op);
-    if (!add_result.has_value())
-      return ERR(Void, add_result.error());
+    // bind() creates the file with the mode already, through the umask: a
+    // chmod() afterwards would leave a window with the default permissions
+    mode_t umask_kept = 0;
+    if (listen.mode != 0)
+      umask_kept = umask(static_cast<mode_t>(~listen.mode & 0777));
+    Result<Void> bind_result = server_fd.socket_bind(path);
+    if (listen.mode != 0)
+      umask(umask_kept);
+    if (!bind_result.has_value())
+      return ERR(Void, path + ": " + bind_result.error());
+    unix_paths.push_back(path);
+
+    Result<Void> listen_result = start_listening(server_fd, it->second, "");
+    if (!listen_result.has_value())
+      return ERR(Void, listen_result.error());
 
-    // Save pointer to distinguish server sockets from client sockets
-    FileDescriptor *fd_ptr = add_result.value();
-    listeners[fd_ptr] = &it->second;
+    Result<Void> pools_result = create_pools(it->second);
+    if (!pools_result.has_value())
+      return ERR(Void, pools_result.error());
 
-    std::cout << "Server listening on port " << port << std::endl;
+    std::cout << "Server listening on unix:" << path << std::endl;
   }
 
-  return OK(Void, Void());
+  return load_plugins();
 }
 
 Result<Void> Server::start() {
   while (true) {
-    // Waiting for events using epoll
-    Result<Events> events_result = epoll.wait(-1);
+    if (g_reloadPlugins) {
+      g_reloadPlugins = 0;
+      Result<Void> reloaded = plugins.reload();
+      if (!reloaded.has_value())
+        std::cerr << "ERROR: plugin reload: " << reloaded.error()
+                  << ", keeping the loaded plugins" << std::endl;
+    }
+
+    // Waiting for events using epoll; don't block while listeners that hit
+    // accept_batch still have connections queued, nor past a CGI deadline
+    Result<Events> events_result = epoll.wait(wait_timeout());
     if (!events_result.has_value()) {
       if (events_result.error() == Errors::interrupted)
         continue;
@@ -220,8 +2269,31 @@ Result<Void> Server::start() {
       if (listeners.find(fd) != listeners.end()) {
         new_connection(fd);
       }
-      // 2. 이미 연결된 클라이언트 소켓인 경우
-      else {
+      // 2. CGI 스크립트의 stdin/stdout 파이프 (또는 요청 중인 worker)
+      else if (cgi_pipes.find(fd) != cgi_pipes.end()) {
+        cgi_event(fd, *event);
+      }
+      // 3. uWSGI 백엔드로 보낸 요청의 소켓
+      else if (uwsgi_socks.find(fd) != uwsgi_socks.end()) {
+        uwsgi_event(fd);
+      }
+      // 4. uWSGI 백엔드 instance의 health probe (connect 결과)
+      else if (UwsgiGroup *group = probe_owner(fd)) {
+        group->probe_event(fd, monotonic_ms());
+      }
+      // 5. 종료된 자식 프로세스의 pidfd
+      else if (children.owns(fd)) {
+        ChildExit exit;
+        if (children.reap(fd, monotonic_ms(), exit))
+          child_exited(exit);
+      }
+      // 6. plugin worker threads가 끝낸 요청 (eventfd)
+      else if (plugins.owns(fd)) {
+        plugin_done();
+      }
+      // 7. 이미 연결된 클라이언트 소켓인 경우 (idle CGI workers are watched
+      // by CgiPool::maintain())
+      else if (clients.find(fd) != clients.end()) {
         if (event->err || event->hup || event->rdhup) {
           disconnect(fd);
         } else {
@@ -233,6 +2305,54 @@ Result<Void> Server::start() {
       }
       ++events;
     }
+
+    if (!paused_listeners.empty() && monotonic_ms() >= accept_retry_ms)
+      resume_listeners();
+
+    std::set<const FileDescriptor *> pending;
+    pending.swap(accept_pending);
+    for (std::set<const FileDescriptor *>::iterator it = pending.begin();
+         it != pending.end(); ++it)
+      new_connection(*it);
+
+    std::set<const FileDescriptor *> resume;
+    resume.swap(cgi_resume);
+    for (std::set<const FileDescriptor *>::iterator it = resume.begin();
+         it != resume.end(); ++it) {
+      if (clients.find(*it) != clients.end() && clients.at(*it).cgi != NULL)
+        pump_cgi(*it);
+    }
+
+    resume.clear();
+    resume.swap(uwsgi_resume);
+    for (std::set<const FileDescriptor *>::iterator it = resume.begin();
+         it != resume.end(); ++it) {
+      if (clients.find(*it) != clients.end() && clients.at(*it).uwsgi != NULL)
+        pump_uwsgi(*it);
+    }
+
+    std::set<const FileDescriptor *> uploads;
+    uploads.swap(upload_resume);
+    for (std::set<const FileDescriptor *>::iterator it = uploads.begin();
+         it != uploads.end(); ++it) {
+      if (clients.find(*it) != clients.end() && clients.at(*it).uploading &&
+          pump_upload(*it))
+        flush_output(*it);
+    }
+
+    std::set<const FileDescriptor *> cached;
+    cached.swap(cache_resume);
+    for (std::set<const FileDescriptor *>::iterator it = cached.begin();
+         it != cached.end(); ++it) {
+      if (clients.find(*it) != clients.end()) {
+        handle_requests(*it);
+        flush_output(*it);
+      }
+    }
+
+    sweep_cgi();
+    sweep_uwsgi();
+    serve_cgi_queue();
   }
 
   clients.clear();
@@ -5,10 +5,15 @@
 #include "../epoll_kqueue.h"
 #include "../errors.h"
 #include "../http_1_1.h"
+#include "../uwsgi_group.h"
 
+#include "CgiPool.hpp"
+#include "ChildManager.hpp"
+#include "PluginHost.hpp"
 #include "Response.hpp"
 #include "Session.hpp"
 
+#include <algorithm>
 #include <arpa/inet.h>
 #include <csignal>
 #include <fcntl.h>
@@ -16,33 +21,152 @@
 #include <iostream>
 #include <map>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <set>
 #include <sstream>
 #include <string>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <utility>
+#include <vector>
 
 class Server {
 private:
   EPoll epoll;
+  // Reaps CGI scripts and pooled workers through pidfds on epoll
+  ChildManager children;
   WebserverConfig config;
   std::set<const FileDescriptor *> server_fds;
   // Listening socket
   // key: server socket fds, value: ports ServerConfig
   std::map<const FileDescriptor *, const ServerConfig *> listeners;
+  // Port of each listener, as text; empty for a unix socket
+  std::map<const FileDescriptor *, std::string> listener_ports;
   // Manage client sessions
   // key: client fds, value: session info
   std::map<const FileDescriptor *, ClientSession> clients;
+  // Listeners that stopped at accept_batch with connections still queued
+  std::set<const FileDescriptor *> accept_pending;
+  // Listeners with EPOLLIN disabled after running out of file descriptors
+  std::set<const FileDescriptor *> paused_listeners;
+  // When they try again, as descriptors are also freed by scripts and
+  // backends; 0 if none was paused since the last accepted connection
+  long long accept_retry_ms;
+  // Sum of in_buff and out_queue bytes over all sessions
+  size_t buffered_bytes;
+  // Pre-serialized 503 sent when over ServerLimits
+  std::string overload_response;
+  // Socket files of unix listeners, removed on shutdown
+  std::vector<std::string> unix_paths;
+  // CGI pipes registered with EPoll
+  // key: stdin/stdout pipe fds, value: client fd the script answers
+  std::map<const FileDescriptor *, const FileDescriptor *> cgi_pipes;
+  // Clients with a running CgiJob
+  std::set<const FileDescriptor *> cgi_clients;
+  // Scripts not reaped yet
+  // key: pid, value: client fd the script answers, NULL once it was released
+  std::map<pid_t, const FileDescriptor *> cgi_pids;
+  // Worker pools of pooled CGI scripts, by executable
+  std::map<std::string, CgiPool *> cgi_pools;
+  // Clients whose script output was held back and whose out_queue drained
+  std::set<const FileDescriptor *> cgi_resume;
+  // Clients whose uWSGI response was held back and whose out_queue drained
+  std::set<const FileDescriptor *> uwsgi_resume;
+  // Clients dropping the body of a refused CGI request that is already in
+  // in_buff
+  std::set<const FileDescriptor *> upload_resume;
+  // Concurrency caps and wait queues of the CGI scripts
+  CgiAdmission cgi_admission;
+  // Pre-serialized 503 for a CGI request over its script's limits
+  std::string cgi_busy_response;
+  // Micro-cache of CGI GET responses, on routes with `cache`
+  CgiCache cgi_cache;
+  // Clients whose cache fill ended, routed again in start()
+  std::set<const FileDescriptor *> cache_resume;
+  // Handler plugins of `&library.so` routes
+  PluginHost plugins;
+  // Instances of the backends of the uwsgi block, by address
+  std::map<std::string, UwsgiGroup *> uwsgi_groups;
+  // Backend sockets of the uWSGI requests in flight
+  // key: socket fd, value: client fd the backend answers
+  std::map<const FileDescriptor *, const FileDescriptor *> uwsgi_socks;
 
+  Result<Void> start_listening(FileDescriptor &server_fd,
+                               const ServerConfig &server,
+                               const std::string &port);
   void new_connection(const FileDescriptor *server_fd);
+  void reject_overloaded(const FileDescriptor &client_fd);
+  void pause_listener(const FileDescriptor *server_fd);
+  void resume_listeners();
+  void account(ClientSession &session);
   void disconnect(const FileDescriptor *client_fd);
   void client_read(const FileDescriptor *client_fd);
   void client_write(const FileDescriptor *client_fd);
+  void handle_requests(const FileDescriptor *client_fd);
+  bool route_head(const FileDescriptor *client_fd);
+  bool pump_upload(const FileDescriptor *client_fd);
+  void close_upload_sink(const FileDescriptor *client_fd);
+  bool flush_output(const FileDescriptor *client_fd);
+  void update_interest(const FileDescriptor *client_fd);
+  void send_metrics(ClientSession &session);
+  CgiCache::Lookup lookup_cache(const FileDescriptor *client_fd,
+                                const Http::Request &request,
+                                const RouteRule &rule);
+  void send_cached(ClientSession &session, const CachedResponse &entry,
+                   bool head_only, long long now);
+  void end_fill(CacheFill *fill);
+  void send_plugin(ClientSession &session, const PluginCall &call);
+  void plugin_done();
+  bool start_uwsgi(const FileDescriptor *client_fd,
+                   const Http::Request &request, const Config_CGI &cgi,
+                   std::string &body, bool stream_body);
+  bool connect_uwsgi(const FileDescriptor *client_fd);
+  void uwsgi_event(const FileDescriptor *sock_fd);
+  void uwsgi_failed(const FileDescriptor *client_fd, const std::string &error);
+  void pump_uwsgi(const FileDescriptor *client_fd);
+  int relay_uwsgi(ClientSession &session);
+  void finish_uwsgi(const FileDescriptor *client_fd, int error_status);
+  void close_uwsgi(const FileDescriptor *client_fd);
+  UwsgiGroup *probe_owner(const FileDescriptor *fd) const;
+  void sweep_uwsgi();
+  CgiAdmission::Verdict admit_cgi(const FileDescriptor *client_fd,
+                                  const Config_CGI &cgi);
+  void refuse_cgi(const FileDescriptor *client_fd,
+                  const Http::Request &request, int status, bool drain_body);
+  void serve_cgi_queue();
+  bool start_cgi(const FileDescriptor *client_fd, const Http::Request &request,
+                 const Config_CGI &cgi);
+  bool assign_worker(const FileDescriptor *client_fd);
+  void serve_waiting(CgiPool *pool);
+  void cgi_event(const FileDescriptor *pipe_fd, const Event &event);
+  void pump_cgi(const FileDescriptor *client_fd);
+  int relay_cgi(ClientSession &session, bool at_eof);
+  void worker_done(const FileDescriptor *client_fd, bool ok);
+  void close_cgi_pipe(const FileDescriptor *&pipe_fd);
+  void finish_cgi(const FileDescriptor *client_fd, int error_status);
+  void close_cgi(const FileDescriptor *client_fd);
+  void child_exited(const ChildExit &exit);
+  void sweep_cgi();
+  int wait_timeout() const;
+  Result<Void> create_pools(const ServerConfig &server);
+  Result<Void> load_plugins();
 
 public:
-  Server(const WebserverConfig &config) : config(config){};
-  ~Server(){};
+  Server(const WebserverConfig &config)
+      : children(epoll), config(config), accept_retry_ms(0), buffered_bytes(0),
+        plugins(epoll){};
+  ~Server() {
+    for (size_t i = 0; i < unix_paths.size(); ++i)
+      unlink(unix_paths[i].c_str());
+    for (std::map<std::string, CgiPool *>::iterator it = cgi_pools.begin();
+         it != cgi_pools.end(); ++it)
+      delete it->second;
+    for (std::map<std::string, UwsgiGroup *>::iterator it =
+             uwsgi_groups.begin();
+         it != uwsgi_groups.end(); ++it)
+      delete it->second;
+  };
 
   Result<Void> init();
   Result<Void> start();
@@ -2,15 +2,139 @@
 #define SESSION_HPP
 
 #include "../ServerConfig.hpp"
+#include "../cgi_1_1.h"
+#include "../uwsgi.h"
+#include "BodyStream.hpp"
+#include "CgiAdmission.hpp"
+#include "CgiCache.hpp"
+#include "CgiPool.hpp"
+#include "OutputQueue.hpp"
+#include "PluginHost.hpp"
 #include <string>
 
+// CGI script answering the request at the head of the connection. The pipes
+// are owned by EPoll; a pointer is cleared once its pipe is closed.
+struct CgiJob {
+  // How the script's output reaches the client
+  enum Relay {
+    Head,    // header block not complete yet, nothing sent
+    Length,  // body passed through up to the script's Content-Length
+    Chunked, // body sent as it comes with Transfer-Encoding: chunked
+    NoBody,  // 1xx, 204 and 304: the body is dropped
+  };
+
+  CgiDelegate *delegate;
+  const FileDescriptor *stdin_fd;  // until the request body is written
+  const FileDescriptor *stdout_fd; // until the script closes its stdout
+  CgiPool *pool;                   // pooled script, instead of the pipes
+  CgiWorker *worker;               // NULL while queued on the pool
+  CgiQueue *slot;                  // admission slot, released with the job
+  long long deadline_ms;           // CLOCK_MONOTONIC, then the script is killed
+  long long timeout_ms;            // the route's timeout, counted again after
+                                   // each piece of a streamed request body
+                                   // and of the response
+  Relay relay;
+  size_t body_left;  // Length: body bytes still to send
+  bool output_held;  // stopped reading at OUTPUT_HIGH_WATER, data may be left
+  CacheFill *fill;   // the response also goes to the cache, NULL if not
+};
+
+// Request forwarded to the backend of a `$PORT` route. The socket is owned by
+// EPoll; it is NULL once closed or back in the pool.
+struct UwsgiJob {
+  UwsgiDelegate *delegate;
+  UwsgiGroup *group; // NULL once the outcome is counted
+  size_t instance;
+  CgiQueue *slot; // admission slot of the backend, released with the job
+  long long started_ms;
+  const FileDescriptor *sock;
+  bool sending;          // EPOLLOUT until the packet is written, then EPOLLIN
+  bool head_only;        // a HEAD request: the response has no body
+  long long deadline_ms; // CLOCK_MONOTONIC, then 504
+  long long timeout_ms;  // the route's timeout, counted again after each
+                         // piece of a streamed request body and of the
+                         // response
+  bool streaming;        // the body follows the packet, see pump_upload()
+  bool body_sent;        // a byte of it went out: no retry on a new socket
+  bool head_sent;        // the status and headers are queued
+  bool chunked;          // the body goes out with Transfer-Encoding: chunked
+  bool output_held;      // stopped reading at OUTPUT_HIGH_WATER
+  CacheFill *fill;       // the response also goes to the cache, NULL if not
+};
+
 struct ClientSession {
   std::string in_buff;
-  std::string out_buff;
+  OutputQueue out_queue;
 
   const ServerConfig *config;
+  // SERVER_PORT and REMOTE_ADDR of the connection, empty on a unix socket
+  std::string server_port;
+  std::string remote_addr;
+
+  // Reading stops once out_queue crosses OUTPUT_HIGH_WATER
+  bool read_paused;
+  // Interest currently registered with EPoll; EPOLLOUT is armed only while
+  // the socket send buffer is full
+  bool in_armed;
+  bool out_armed;
+  // Bytes of this session counted in Server::buffered_bytes
+  size_t accounted;
+  // Running CGI script; later requests wait in in_buff until it finishes
+  CgiJob *cgi;
+  // Headers of the incomplete request at the front of in_buff were already
+  // looked at by Server::route_head()
+  bool head_routed;
+  // Body of a CGI or uWSGI request, passed to the script's stdin or to the
+  // backend as it arrives (and dropped once it stopped reading); the next
+  // request waits until the whole body is consumed
+  bool uploading;
+  BodyStream upload;
+  std::string upload_buf; // decoded body bytes not written to stdin yet
+  // A chunked body, which no route gets before its length is known: it is
+  // decoded into upload_buf, then put back in in_buff after collect_head with
+  // a Content-Length (Server::pump_upload())
+  bool collecting;
+  std::string collect_head;
+  // Largest body the request at the front of in_buff may have, from the
+  // `->{}` of its route
+  size_t body_limit;
+  // CLOCK_MONOTONIC, after which the streamed body no longer pushes back the
+  // deadline of the script or backend
+  long long upload_until_ms;
+  // Queue of the CGI request at the front of in_buff while it waits for a
+  // slot; the request is routed again once it got one (cgi_admitted) or
+  // waited past queue_timeout (cgi_expired)
+  CgiQueue *cgi_queue;
+  bool cgi_admitted;
+  bool cgi_expired;
+  // Cache fill started by the CGI request at the front of in_buff, handed to
+  // its CgiJob once the script runs
+  CacheFill *cache_fill;
+  // Key whose fill that request waits for, empty if none. The request is
+  // routed again once the fill ended; cache_bypass then runs it without the
+  // cache if the fill stored nothing.
+  std::string cache_wait;
+  bool cache_bypass;
+  // The client left while the session refreshes a cache entry: the socket is
+  // shut down and closed once the script finished
+  bool closed;
+  // Request handed to the plugin worker threads; later requests wait in
+  // in_buff until it is answered
+  PluginCall *plugin_call;
+  // Request at a uWSGI backend; later requests wait in in_buff until it is
+  // answered
+  UwsgiJob *uwsgi;
+  // A request whose body can't be delimited was answered with 400: nothing
+  // more is read, and the connection is closed once out_queue is sent
+  bool closing;
 
-  ClientSession() : config(NULL) {}
+  ClientSession()
+      : config(NULL), read_paused(false), in_armed(true), out_armed(false),
+        accounted(0), cgi(NULL), head_routed(false), uploading(false),
+        collecting(false), body_limit(0), upload_until_ms(0), cgi_queue(NULL),
+        cgi_admitted(false), cgi_expired(false), cache_fill(NULL),
+        cache_wait(), cache_bypass(false), closed(false), plugin_call(NULL),
+        uwsgi(NULL), closing(false) {}
 };
 
 #endif
\ No newline at end of file
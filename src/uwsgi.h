@@ -1,108 +1,82 @@
 #ifndef UWSGI_H
 #define UWSGI_H
 
+#include "file_descriptor.h"
 #include "http_1_1.h"
+#include "response_parser.h"
 #include "result.h"
 #include <list>
 #include <map>
 #include <string>
 #include <vector>
 
-// Forward declarations
-class UwsgiInput;
-class EPoll;
-
-class UwsgiMetaVar {
-public:
-  enum Name {
-    REQUEST_METHOD,
-    SCRIPT_NAME,
-    PATH_INFO,
-    QUERY_STRING,
-    CONTENT_TYPE,
-    CONTENT_LENGTH,
-    SERVER_NAME,
-    SERVER_PORT,
-    SERVER_PROTOCOL,
-    HTTP_, // HTTP headers
-    REMOTE_ADDR,
-    WSGI_VERSION,
-    WSGI_URL_SCHEME,
-    WSGI_INPUT,
-    WSGI_ERRORS,
-    WSGI_MULTITHREAD,
-    WSGI_MULTIPROCESS,
-    WSGI_RUN_ONCE,
-  };
-
-  class Parser {
-    virtual void phantom() = 0;
-
-  public:
-    static Result<std::pair<UwsgiMetaVar, size_t> > parse(std::string const &,
-                                                          std::string const &);
-  };
-
-  friend class UwsgiInput;
-
-public:
-  UwsgiMetaVar(const UwsgiMetaVar &other);
-  UwsgiMetaVar &operator=(const UwsgiMetaVar &other);
-  ~UwsgiMetaVar();
-
-  Name const &get_name() const { return name; }
-  std::string const &get_value() const { return value; }
-
-private:
-  Name name;
-  std::string value;
-
-  UwsgiMetaVar(Name n, std::string v) : name(n), value(v) {}
-  static UwsgiMetaVar create(Name n, std::string v);
-};
-
-class UwsgiInput {
-  std::vector<UwsgiMetaVar> mvars;
-  Http::Body req_body;
-
-private:
-  UwsgiInput();
-  UwsgiInput(std::vector<UwsgiMetaVar>, Http::Body);
-  UwsgiInput(Http::Request const &);
-
-public:
-  class Parser {
-    virtual void phantom() = 0;
-
-  public:
-    static Result<UwsgiInput> parse(Http::Request const &);
-  };
-
-  friend class Parser;
-  friend class UwsgiDelegate;
-
-  UwsgiInput(const UwsgiInput &other)
-      : mvars(other.mvars), req_body(other.req_body) {}
-  UwsgiInput &operator=(const UwsgiInput &other) {
-    if (this != &other) {
-      mvars = other.mvars;
-      req_body = other.req_body;
-    }
-    return *this;
-  }
-  void add_mvar(std::string const &, std::string const &);
-  char **to_envp() const;
-  std::map<std::string, std::string> to_map() const;
-};
-
+class UwsgiPool;
+
+/**
+ * @class UwsgiDelegate
+ * @brief Forwards a request to a uWSGI backend.
+ *
+ * The exchange is split into non-blocking steps so that the server can run
+ * it on its event loop: encode() the packet, connect(), send() on EPOLLOUT
+ * until it returns true, then receive() on EPOLLIN until it returns true.
+ * The response is parsed as it is read (output()): its head is available as
+ * soon as it is complete and the body can be taken in pieces meanwhile. If
+ * a step fails while stale() is set (a pooled connection the backend had
+ * closed), connect() again once; otherwise reusable() tells whether the
+ * connection may go back to the pool.
+ *
+ * The vars block is encoded straight from the request into a buffer of the
+ * pool, and the body goes out next to it in the same gathered write, so the
+ * packet is never assembled in one piece. A body that is not held can be
+ * streamed by the caller instead: encode() is given its length, send() then
+ * writes the header and vars block only, and the body follows on the socket.
+ */
 class UwsgiDelegate {
-  UwsgiInput env;
-  int _uwsgi_port;
+  UwsgiPool &_pool;
   Http::Request request;
+  std::map<std::string, std::string> _vars; // of the route, see add_var()
+  std::vector<unsigned char> *_head; // header + vars block, from the pool
+  std::string _body;                 // sent after _head, as it is
+  size_t _sent;                      // of _head, then of _body
+  ResponseParser _output;
+  bool _received; // a byte of the response was read
+  bool _fresh;    // the connection was opened for this request
+  bool _reusable; // the response ended where its framing said
+  unsigned int _attempts;
+
+  bool put_var(const char *name, size_t name_len, const char *value,
+               size_t value_len);
+
+  UwsgiDelegate(const UwsgiDelegate &);
+  UwsgiDelegate &operator=(const UwsgiDelegate &);
 
 public:
-  UwsgiDelegate(const Http::Request &req, int uwsgi_port);
-  Result<Http::Response> execute(int timeout_ms, EPoll *epoll);
+  // Sends the request to the pool's backend, on a kept-alive connection if
+  // there is one
+  UwsgiDelegate(const Http::Request &req, UwsgiPool &pool);
+  // A var of the route, overriding the one taken from the request
+  void add_var(std::string const &name, std::string const &value);
+  // Builds the packet sent by send(). The body is taken over rather than
+  // copied: body is left empty. streamed bytes of body are written by the
+  // caller after the packet and count in CONTENT_LENGTH. server_port and
+  // remote_addr are those of the client's connection, empty on a unix
+  // socket.
+  Result<Void> encode(std::string &body, size_t streamed,
+                      const std::string &server_port,
+                      const std::string &remote_addr);
+
+  // A non-blocking socket, connecting or taken from the pool
+  Result<FileDescriptor> connect();
+  // Writes the packet; true once all of it was sent
+  Result<bool> send(const FileDescriptor &sock);
+  // Reads the response, stopping early once output() holds limit bytes;
+  // true once it is complete
+  Result<bool> receive(const FileDescriptor &sock,
+                       size_t limit = static_cast<size_t>(-1));
+  ResponseParser &output() { return _output; }
+  bool stale() const;
+  bool reusable() const { return _reusable; }
+  UwsgiPool &pool() const { return _pool; }
   ~UwsgiDelegate();
 };
 
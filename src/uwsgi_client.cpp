@@ -1,4 +1,5 @@
 #include "uwsgi_client.h"
+#include "response_parser.h"
 
 #include <arpa/inet.h>
 #include <climits>
@@ -7,11 +8,53 @@
 #include <sstream>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <vector>
 
 UwsgiClient::UwsgiClient(const std::string &host, int port)
-    : _host(host), _port(port) {}
+    : _host(host), _port(port), _path() {}
+
+UwsgiClient::UwsgiClient(const std::string &path)
+    : _host(), _port(0), _path(path) {}
+
+// A connected socket, -1 on failure
+int UwsgiClient::connect_tcp() const {
+  struct addrinfo hints, *res = NULL;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+
+  std::ostringstream port_ss;
+  port_ss << _port;
+  if (getaddrinfo(_host.c_str(), port_ss.str().c_str(), &hints, &res) != 0)
+    return -1;
+  int sock_fd = socket(res->ai_family, res->ai_socktype | SOCK_CLOEXEC,
+                       res->ai_protocol);
+  if (sock_fd >= 0 && connect(sock_fd, res->ai_addr, res->ai_addrlen) < 0) {
+    close(sock_fd);
+    sock_fd = -1;
+  }
+  freeaddrinfo(res);
+  return sock_fd;
+}
+
+int UwsgiClient::connect_unix() const {
+  struct sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  if (_path.length() >= sizeof(addr.sun_path))
+    return -1;
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, _path.c_str(), _path.length());
+  int sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock_fd >= 0 &&
+      connect(sock_fd, reinterpret_cast<const struct sockaddr *>(&addr),
+              sizeof(addr)) < 0) {
+    close(sock_fd);
+    sock_fd = -1;
+  }
+  return sock_fd;
+}
 
 // Build uwsgi vars block: repeated [key_len: 2B LE][key][val_len: 2B LE][val]
 static std::vector<unsigned char>
@@ -63,28 +106,9 @@ UwsgiClient::send(const std::map<std::string, std::string> &vars,
   header[2] = static_cast<unsigned char>((datasize >> 8) & 0xFF);
   header[3] = 0; // modifier2
 
-  // Resolve and connect
-  struct addrinfo hints, *res = NULL;
-  std::memset(&hints, 0, sizeof(hints));
-  hints.ai_family = AF_INET;
-  hints.ai_socktype = SOCK_STREAM;
-
-  std::ostringstream port_ss;
-  port_ss << _port;
-  if (getaddrinfo(_host.c_str(), port_ss.str().c_str(), &hints, &res) != 0)
-    return ERR(std::string, "uwsgi: failed to resolve server address");
-
-  int sock_fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-  if (sock_fd < 0) {
-    freeaddrinfo(res);
-    return ERR(std::string, "uwsgi: failed to create socket");
-  }
-  if (connect(sock_fd, res->ai_addr, res->ai_addrlen) < 0) {
-    freeaddrinfo(res);
-    close(sock_fd);
+  int sock_fd = _path.empty() ? connect_tcp() : connect_unix();
+  if (sock_fd < 0)
     return ERR(std::string, "uwsgi: failed to connect to server");
-  }
-  freeaddrinfo(res);
 
   // Send header, vars block, and body
   if (!write_all(sock_fd, header, sizeof(header)) ||
@@ -98,19 +122,30 @@ UwsgiClient::send(const std::map<std::string, std::string> &vars,
   // Half-close the write side so the server sees EOF on the request stream
   shutdown(sock_fd, SHUT_WR);
 
-  // Read back the raw HTTP response until the server closes the connection
+  // Read back the raw HTTP response until it ends where its framing says, or
+  // until the server closes the connection
+  std::map<std::string, std::string>::const_iterator method =
+      vars.find("REQUEST_METHOD");
+  ResponseParser parser =
+      ResponseParser::http(method != vars.end() && method->second == "HEAD");
   std::string response;
   char buf[4096];
-  while (true) {
+  while (!parser.done()) {
     ssize_t n = read(sock_fd, buf, sizeof(buf));
+    Result<Void> parsed = OKV;
     if (n > 0) {
       response.append(buf, static_cast<size_t>(n));
+      parsed = parser.feed(buf, static_cast<size_t>(n));
     } else if (n == 0) {
-      break; // EOF: server closed connection
+      parsed = parser.finish(); // EOF: server closed connection
     } else {
       close(sock_fd);
       return ERR(std::string, "uwsgi: read error receiving response");
     }
+    if (!parsed.has_value()) {
+      close(sock_fd);
+      return ERR(std::string, "uwsgi: " + parsed.error());
+    }
   }
   close(sock_fd);
   return OK(std::string, response);
@@ -5,22 +5,30 @@
 #include <map>
 #include <string>
 
-// UwsgiClient speaks the uWSGI binary protocol over a TCP connection.
-// It encodes a WSGI/CGI vars block and an optional request body, sends them to
-// a running uwsgi_server, and returns the raw HTTP response output produced by
-// the WSGI script.
+// UwsgiClient speaks the uWSGI binary protocol over a TCP connection or a
+// Unix domain socket. It encodes a WSGI/CGI vars block and an optional
+// request body, sends them to a running uwsgi_server, and returns the raw
+// HTTP response output produced by the WSGI script, read up to the end its
+// framing announces.
 class UwsgiClient {
   std::string _host;
   int _port;
+  std::string _path; // of the Unix socket, empty for TCP
 
   UwsgiClient(const UwsgiClient &);
   UwsgiClient &operator=(const UwsgiClient &);
 
+  int connect_tcp() const;
+  int connect_unix() const;
+
 public:
   UwsgiClient(const std::string &host, int port);
+  // A backend listening on the Unix socket at path
+  explicit UwsgiClient(const std::string &path);
 
   // Encode vars + body as a uwsgi binary request, send to host:port,
-  // and return the raw HTTP response (as produced by the WSGI script).
+  // and return the raw HTTP response (as produced by the WSGI script), read
+  // up to its end.
   Result<std::string> send(const std::map<std::string, std::string> &vars,
                            const std::string &body) const;
 };
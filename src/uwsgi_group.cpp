@@ -0,0 +1,235 @@
+#include "uwsgi_group.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+// A probe that didn't connect by then failed
+static const long long PROBE_TIMEOUT_MS = 2000;
+
+UwsgiGroup::UwsgiGroup(EPoll &epoll, const UwsgiBackend &backend)
+    : _epoll(epoll), _backend(backend), _instances(), _next(0),
+      _next_probe(backend.health_interval > 0 ? 0 : -1) {
+  for (size_t i = 0; i < backend.instances.size(); ++i)
+    _instances.push_back(
+        UwsgiInstance(new UwsgiPool(backend, backend.instances[i])));
+}
+
+UwsgiGroup::~UwsgiGroup() {
+  for (size_t i = 0; i < _instances.size(); ++i) {
+    if (_instances[i].probe != NULL)
+      _epoll.del_fd(*_instances[i].probe);
+    delete _instances[i].pool;
+  }
+}
+
+bool UwsgiGroup::in_rotation(const UwsgiInstance &instance,
+                             long long now_ms) const {
+  return !instance.probe_failed && instance.ejected_until <= now_ms;
+}
+
+// Index of the nth instance in rotation, or of all of them
+size_t UwsgiGroup::nth(size_t n, bool all, long long now_ms) const {
+  for (size_t i = 0; i < _instances.size(); ++i) {
+    if (!all && !in_rotation(_instances[i], now_ms))
+      continue;
+    if (n-- == 0)
+      return i;
+  }
+  return 0;
+}
+
+size_t UwsgiGroup::pick(long long now_ms) {
+  size_t count = _instances.size();
+  size_t up = 0;
+  for (size_t i = 0; i < count; ++i)
+    up += in_rotation(_instances[i], now_ms) ? 1 : 0;
+  bool all = up == 0;
+  if (all)
+    up = count;
+
+  size_t chosen = count;
+  if (_backend.balance == UwsgiBackend::POWER_OF_TWO && up > 2) {
+    size_t a = static_cast<size_t>(std::rand()) % up;
+    size_t b = static_cast<size_t>(std::rand()) % (up - 1);
+    if (b >= a)
+      ++b;
+    a = nth(a, all, now_ms);
+    b = nth(b, all, now_ms);
+    chosen = _instances[b].in_flight < _instances[a].in_flight ? b : a;
+  } else {
+    // Ties go to the instance after the last one chosen
+    for (size_t k = 0; k < count; ++k) {
+      size_t i = (_next + k) % count;
+      if ((all || in_rotation(_instances[i], now_ms)) &&
+          (chosen == count ||
+           _instances[i].in_flight < _instances[chosen].in_flight))
+        chosen = i;
+    }
+    _next = (chosen + 1) % count;
+  }
+  _instances[chosen].in_flight++;
+  _instances[chosen].requests++;
+  return chosen;
+}
+
+// Takes an instance out of the rotation, counting it once
+void UwsgiGroup::leave(UwsgiInstance &instance, long long now_ms,
+                       const char *why) {
+  if (!in_rotation(instance, now_ms))
+    return;
+  instance.ejections++;
+  std::cerr << "WARNING: uWSGI instance " << instance.pool->instance().address
+            << " of " << _backend.address << " ejected: " << why << std::endl;
+}
+
+void UwsgiGroup::done(size_t index, bool ok, long long latency_ms,
+                      long long now_ms) {
+  UwsgiInstance &instance = _instances[index];
+  instance.in_flight--;
+  if (ok) {
+    instance.fails = 0;
+    instance.responses++;
+    instance.latency_ms_sum += latency_ms;
+    if (latency_ms > instance.latency_ms_max)
+      instance.latency_ms_max = latency_ms;
+    return;
+  }
+  instance.failures++;
+  if (_backend.max_fails == 0 || ++instance.fails < _backend.max_fails)
+    return;
+  leave(instance, now_ms, "failed requests");
+  instance.fails = 0;
+  instance.ejected_until =
+      now_ms + static_cast<long long>(_backend.fail_timeout) * 1000;
+}
+
+void UwsgiGroup::abandon(size_t index) { _instances[index].in_flight--; }
+
+// A non-blocking connect() to the instance, on a socket of its own so that
+// the pool's counters only count requests
+void UwsgiGroup::start_probe(UwsgiInstance &instance, long long now_ms) {
+  const UwsgiAddress &address = instance.pool->instance();
+  Result<FileDescriptor> sock =
+      FileDescriptor::socket_new(address.addr.ss_family);
+  if (!sock.has_value()) {
+    std::cerr << "ERROR: uWSGI probe: " << sock.error() << std::endl;
+    return;
+  }
+  FileDescriptor fd = sock.value();
+  Result<Void> started = fd.set_nonblocking();
+  if (started.has_value())
+    started = fd.socket_connect(
+        reinterpret_cast<const struct sockaddr *>(&address.addr),
+        address.addr_len);
+  if (!started.has_value()) {
+    end_probe(instance, false, now_ms);
+    return;
+  }
+  Event event(&fd, false, true, false, false, true, true);
+  Option option(true, false, false, false);
+  Result<FileDescriptor *> res = _epoll.add_fd(fd, event, option);
+  if (!res.has_value()) {
+    std::cerr << "ERROR: uWSGI probe: " << res.error() << std::endl;
+    return;
+  }
+  instance.probe = res.value();
+  instance.probe_deadline = now_ms + PROBE_TIMEOUT_MS;
+}
+
+void UwsgiGroup::end_probe(UwsgiInstance &instance, bool ok,
+                           long long now_ms) {
+  if (instance.probe != NULL) {
+    _epoll.del_fd(*instance.probe);
+    instance.probe = NULL;
+  }
+  if (ok && instance.probe_failed) {
+    instance.probe_failed = false;
+    std::cerr << "uWSGI instance " << instance.pool->instance().address
+              << " of " << _backend.address << " is back" << std::endl;
+  } else if (!ok) {
+    leave(instance, now_ms, "probe failed");
+    instance.probe_failed = true;
+  }
+}
+
+bool UwsgiGroup::owns(const FileDescriptor *fd) const {
+  for (size_t i = 0; i < _instances.size(); ++i)
+    if (fd != NULL && _instances[i].probe == fd)
+      return true;
+  return false;
+}
+
+void UwsgiGroup::probe_event(const FileDescriptor *fd, long long now_ms) {
+  for (size_t i = 0; i < _instances.size(); ++i) {
+    if (_instances[i].probe == fd) {
+      end_probe(_instances[i], fd->socket_error().has_value(), now_ms);
+      return;
+    }
+  }
+}
+
+void UwsgiGroup::tick(long long now_ms) {
+  for (size_t i = 0; i < _instances.size(); ++i) {
+    _instances[i].pool->expire(now_ms);
+    if (_instances[i].probe != NULL && now_ms >= _instances[i].probe_deadline)
+      end_probe(_instances[i], false, now_ms);
+  }
+  if (_next_probe < 0 || now_ms < _next_probe)
+    return;
+  for (size_t i = 0; i < _instances.size(); ++i)
+    if (_instances[i].probe == NULL)
+      start_probe(_instances[i], now_ms);
+  _next_probe =
+      now_ms + static_cast<long long>(_backend.health_interval) * 1000;
+}
+
+long long UwsgiGroup::next_deadline() const {
+  long long deadline = _next_probe;
+  for (size_t i = 0; i < _instances.size(); ++i) {
+    if (_instances[i].probe != NULL &&
+        (deadline < 0 || _instances[i].probe_deadline < deadline))
+      deadline = _instances[i].probe_deadline;
+  }
+  return deadline;
+}
+
+std::string
+UwsgiGroup::metrics(const std::map<std::string, UwsgiGroup *> &groups,
+                    long long now_ms) {
+  static const char *const types[][2] = {
+      {"in_flight", "gauge"},         {"up", "gauge"},
+      {"requests_total", "counter"},  {"failures_total", "counter"},
+      {"ejections_total", "counter"}, {"latency_ms_count", "counter"},
+      {"latency_ms_sum", "counter"},  {"latency_ms_max", "gauge"},
+      {"connects_total", "counter"},  {"reuses_total", "counter"},
+  };
+  std::ostringstream os;
+  for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); ++t) {
+    os << "# TYPE webserv_uwsgi_" << types[t][0] << " " << types[t][1] << "\n";
+    for (std::map<std::string, UwsgiGroup *>::const_iterator it =
+             groups.begin();
+         it != groups.end(); ++it) {
+      const UwsgiGroup &group = *it->second;
+      for (size_t i = 0; i < group._instances.size(); ++i) {
+        const UwsgiInstance &instance = group._instances[i];
+        const long long values[] = {
+            instance.in_flight,
+            group.in_rotation(instance, now_ms) ? 1 : 0,
+            static_cast<long long>(instance.requests),
+            static_cast<long long>(instance.failures),
+            static_cast<long long>(instance.ejections),
+            static_cast<long long>(instance.responses),
+            instance.latency_ms_sum,
+            instance.latency_ms_max,
+            static_cast<long long>(instance.pool->connects()),
+            static_cast<long long>(instance.pool->reuses()),
+        };
+        os << "webserv_uwsgi_" << types[t][0] << "{backend=\"" << it->first
+           << "\",instance=\"" << instance.pool->instance().address << "\"} "
+           << values[t] << "\n";
+      }
+    }
+  }
+  return os.str();
+}
@@ -0,0 +1,94 @@
+#ifndef UWSGI_GROUP_H
+#define UWSGI_GROUP_H
+
+#include "WebserverConfig.hpp"
+#include "epoll_kqueue.h"
+#include "uwsgi_pool.h"
+#include <map>
+#include <string>
+#include <vector>
+
+// One instance of a group, with its health and counters
+struct UwsgiInstance {
+  UwsgiPool *pool;
+  unsigned int in_flight;
+  unsigned int fails;          // failed requests in a row
+  long long ejected_until;     // CLOCK_MONOTONIC ms, out of rotation till then
+  bool probe_failed;           // out of rotation until a probe connects
+  const FileDescriptor *probe; // connect probe in flight, owned by EPoll
+  long long probe_deadline;
+
+  unsigned long long requests;
+  unsigned long long responses;
+  unsigned long long failures; // errors and timeouts
+  unsigned long long ejections;
+  long long latency_ms_sum; // of the responses
+  long long latency_ms_max;
+
+  explicit UwsgiInstance(UwsgiPool *pool)
+      : pool(pool), in_flight(0), fails(0), ejected_until(0),
+        probe_failed(false), probe(NULL), probe_deadline(0), requests(0),
+        responses(0), failures(0), ejections(0), latency_ms_sum(0),
+        latency_ms_max(0) {}
+};
+
+/**
+ * @class UwsgiGroup
+ * @brief Balances the requests of a uWSGI backend over its instances.
+ *
+ * Every instance has its own UwsgiPool. pick() chooses among the instances
+ * in rotation by the requests they have in flight: the less loaded of two
+ * picked at random (`balance p2c`), or the least loaded of all (`balance
+ * least`). If none is in rotation, all of them are tried rather than none.
+ *
+ * An instance leaves the rotation for fail_timeout seconds after max_fails
+ * failed requests in a row (passive ejection), and until the next probe that
+ * connects when a connect probe fails. Probes run every health_interval
+ * seconds on the server's EPoll.
+ */
+class UwsgiGroup {
+  EPoll &_epoll;
+  UwsgiBackend _backend;
+  std::vector<UwsgiInstance> _instances;
+  size_t _next;          // where least-outstanding ties start, rotating
+  long long _next_probe; // CLOCK_MONOTONIC ms, -1: no probes
+
+  bool in_rotation(const UwsgiInstance &instance, long long now_ms) const;
+  size_t nth(size_t n, bool all, long long now_ms) const;
+  void start_probe(UwsgiInstance &instance, long long now_ms);
+  void end_probe(UwsgiInstance &instance, bool ok, long long now_ms);
+  void leave(UwsgiInstance &instance, long long now_ms, const char *why);
+
+  UwsgiGroup(const UwsgiGroup &);
+  UwsgiGroup &operator=(const UwsgiGroup &);
+
+public:
+  UwsgiGroup(EPoll &epoll, const UwsgiBackend &backend);
+  // Closes the probes in flight and the pools
+  ~UwsgiGroup();
+
+  const UwsgiBackend &backend() const { return _backend; }
+  // The instance for the next request, counted in flight until done() or
+  // abandon()
+  size_t pick(long long now_ms);
+  UwsgiPool &pool(size_t instance) { return *_instances[instance].pool; }
+  // The request got a response (ok) or failed: an error or a timeout
+  void done(size_t instance, bool ok, long long latency_ms, long long now_ms);
+  // The client went away before the request ended
+  void abandon(size_t instance);
+
+  bool owns(const FileDescriptor *fd) const;
+  // EPOLLOUT or an error on a probe: the connect() ended
+  void probe_event(const FileDescriptor *fd, long long now_ms);
+  // Starts the probes that are due, fails those past their time and closes
+  // the idle connections past keepalive_timeout
+  void tick(long long now_ms);
+  // When tick() next has something to do, -1 if never
+  long long next_deadline() const;
+
+  // Prometheus text of every instance of the groups
+  static std::string metrics(const std::map<std::string, UwsgiGroup *> &groups,
+                             long long now_ms);
+};
+
+#endif // UWSGI_GROUP_H
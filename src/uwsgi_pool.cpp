@@ -0,0 +1,83 @@
+#include "uwsgi_pool.h"
+#include "errors.h"
+
+#include <fcntl.h>
+
+// Buffers kept beyond the requests in flight; the vars block is at most
+// 64 KiB, so this bounds what an idle pool holds
+static const size_t MAX_BUFFERS = 16;
+
+UwsgiPool::UwsgiPool(const UwsgiBackend &backend, const UwsgiAddress &instance)
+    : _backend(backend), _instance(instance), _idle(), _buffers(),
+      _connects(0), _reuses(0), _dropped(0) {}
+
+UwsgiPool::~UwsgiPool() {
+  for (size_t i = 0; i < _buffers.size(); ++i)
+    delete _buffers[i];
+}
+
+Result<FileDescriptor> UwsgiPool::checkout(long long now_ms) {
+  expire(now_ms);
+  while (!_idle.empty()) {
+    FileDescriptor fd = _idle.front().fd;
+    _idle.pop_front();
+    if (fd.socket_idle()) {
+      _reuses++;
+      return OK(FileDescriptor, fd);
+    }
+    _dropped++; // closed by the backend, or sent something unasked
+  }
+  return ERR(FileDescriptor, Errors::try_again);
+}
+
+Result<FileDescriptor> UwsgiPool::open() {
+  Result<FileDescriptor> sock =
+      FileDescriptor::socket_new(_instance.addr.ss_family);
+  if (!sock.has_value())
+    return sock;
+  FileDescriptor fd = sock.value();
+  Result<Void> nb = fd.set_nonblocking();
+  if (!nb.has_value())
+    return ERR(FileDescriptor, nb.error());
+  Result<Void> conn = fd.socket_connect(
+      reinterpret_cast<const struct sockaddr *>(&_instance.addr),
+      _instance.addr_len);
+  if (!conn.has_value())
+    return ERR(FileDescriptor, conn.error());
+  _connects++;
+  return OK(FileDescriptor, fd);
+}
+
+void UwsgiPool::checkin(FileDescriptor fd, long long now_ms) {
+  if (_backend.keepalive == 0)
+    return;
+  _idle.push_front(Idle(fd, now_ms));
+  while (_idle.size() > _backend.keepalive)
+    _idle.pop_back();
+}
+
+void UwsgiPool::expire(long long now_ms) {
+  long long timeout_ms =
+      static_cast<long long>(_backend.keepalive_timeout) * 1000;
+  while (!_idle.empty() && now_ms - _idle.back().since_ms >= timeout_ms) {
+    _idle.pop_back();
+    _dropped++;
+  }
+}
+
+std::vector<unsigned char> *UwsgiPool::take_buffer() {
+  if (_buffers.empty())
+    return new std::vector<unsigned char>();
+  std::vector<unsigned char> *buffer = _buffers.back();
+  _buffers.pop_back();
+  return buffer;
+}
+
+void UwsgiPool::give_buffer(std::vector<unsigned char> *buffer) {
+  if (_buffers.size() >= MAX_BUFFERS) {
+    delete buffer;
+    return;
+  }
+  buffer->clear(); // keeps the capacity
+  _buffers.push_back(buffer);
+}
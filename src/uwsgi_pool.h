@@ -0,0 +1,70 @@
+#ifndef UWSGI_POOL_H
+#define UWSGI_POOL_H
+
+#include "WebserverConfig.hpp"
+#include "file_descriptor.h"
+#include "result.h"
+#include <list>
+#include <vector>
+
+/**
+ * @class UwsgiPool
+ * @brief Keep-alive connections to one instance of a uWSGI backend.
+ *
+ * A connection whose response was read to its end is checked back in
+ * instead of being closed, and the next request to the backend goes out on
+ * it without a new connect(). At most UwsgiBackend::keepalive connections
+ * are kept, each for keepalive_timeout seconds; checkout() hands out the
+ * most recently used one first and drops those the backend closed in the
+ * meantime.
+ *
+ * It also keeps the packet buffers of finished requests, so that encoding a
+ * request to a warm backend writes into memory already allocated.
+ */
+class UwsgiPool {
+  struct Idle {
+    FileDescriptor fd;
+    long long since_ms; // checked in at, CLOCK_MONOTONIC
+    Idle(const FileDescriptor &fd, long long since_ms)
+        : fd(fd), since_ms(since_ms) {}
+  };
+
+  UwsgiBackend _backend;   // the pool options
+  UwsgiAddress _instance; // connected to
+  std::list<Idle> _idle; // most recently checked in first
+  std::vector<std::vector<unsigned char> *> _buffers; // cleared, for reuse
+
+  unsigned long long _connects;
+  unsigned long long _reuses;
+  unsigned long long _dropped; // idle connections found closed or expired
+
+  UwsgiPool(const UwsgiPool &);
+  UwsgiPool &operator=(const UwsgiPool &);
+
+public:
+  UwsgiPool(const UwsgiBackend &backend, const UwsgiAddress &instance);
+  ~UwsgiPool();
+
+  const UwsgiBackend &backend() const { return _backend; }
+  const UwsgiAddress &instance() const { return _instance; }
+  // An idle connection that is still open; try_again if there is none
+  Result<FileDescriptor> checkout(long long now_ms);
+  // A new non-blocking socket with its connect() started
+  Result<FileDescriptor> open();
+  // Keeps a connection whose response was read to its end
+  void checkin(FileDescriptor fd, long long now_ms);
+  // Closes the idle connections past keepalive_timeout
+  void expire(long long now_ms);
+
+  // An empty buffer for a request packet, with the capacity of a previous one
+  // if there is one
+  std::vector<unsigned char> *take_buffer();
+  // Takes back a buffer of take_buffer()
+  void give_buffer(std::vector<unsigned char> *buffer);
+
+  unsigned long long connects() const { return _connects; }
+  unsigned long long reuses() const { return _reuses; }
+  unsigned long long dropped() const { return _dropped; }
+};
+
+#endif // UWSGI_POOL_H
@@ -4,11 +4,25 @@
 #include <iostream>
 #include <sys/stat.h>
 
+static int usage() {
+  std::cerr << "Usage: uwsgi_server <script.py> [port | unix:/path.sock]"
+            << " [--concurrency N] [--processes N] [--workers N]"
+            << " [--max-requests N] [--timeout S]" << std::endl;
+  return 1;
+}
+
+// A positive count given to an option, or 0 if it is invalid
+static int parse_count(const char *value) {
+  char *end = NULL;
+  long count = std::strtol(value, &end, 10);
+  if (end == value || *end != '\0' || count <= 0 || count > 4096)
+    return 0;
+  return static_cast<int>(count);
+}
+
 int main(int argc, char *argv[]) {
-  if (argc < 2 || argc > 3) {
-    std::cerr << "Usage: uwsgi_server <script.py> [port]" << std::endl;
-    return 1;
-  }
+  if (argc < 2)
+    return usage();
 
   const std::string script_path = argv[1];
 
@@ -19,17 +33,58 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  int port = 9000; // default uWSGI port
-  if (argc == 3) {
-    port = std::atoi(argv[2]);
-    if (port <= 0 || port > 65535) {
-      std::cerr << "Invalid port number: " << argv[2] << std::endl;
-      return 1;
+  std::string listen;
+  // Options taking a count, 0 for the server's default
+  const char *const names[] = {"--concurrency", "--processes", "--workers",
+                               "--max-requests", "--timeout"};
+  int counts[] = {0, 0, 0, 0, 0};
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    int option = 0;
+    while (option < 5 && arg != names[option])
+      ++option;
+    if (option < 5) {
+      int count = i + 1 < argc ? parse_count(argv[i + 1]) : 0;
+      if (count == 0) {
+        std::cerr << "Invalid value for " << arg << std::endl;
+        return usage();
+      }
+      counts[option] = count;
+      ++i;
+    } else if (listen.empty()) {
+      listen = arg;
+    } else {
+      return usage();
+    }
+  }
+
+  UwsgiServer *server;
+  if (listen.compare(0, 6, "unix:/") == 0) {
+    server = new UwsgiServer(script_path, listen.substr(5));
+  } else {
+    int port = 9000; // default uWSGI port
+    if (!listen.empty()) {
+      port = std::atoi(listen.c_str());
+      if (port <= 0 || port > 65535) {
+        std::cerr << "Invalid port number: " << listen << std::endl;
+        return 1;
+      }
     }
+    server = new UwsgiServer(script_path, port);
   }
 
-  UwsgiServer server(script_path, port);
-  server.run();
+  if (counts[0] > 0)
+    server->set_concurrency(counts[0]);
+  if (counts[1] > 0)
+    server->set_processes(counts[1]);
+  if (counts[2] > 0)
+    server->set_workers(counts[2]);
+  if (counts[3] > 0)
+    server->set_max_requests(counts[3]);
+  if (counts[4] > 0)
+    server->set_timeout(counts[4]);
+  server->run();
+  delete server;
 
   return 0;
 }
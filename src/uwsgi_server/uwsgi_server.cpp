@@ -1,6 +1,9 @@
 #include "uwsgi_server.h"
 
+#include <algorithm>
 #include <arpa/inet.h>
+#include <cerrno>
+#include <climits>
 #include <csignal>
 #include <cstdlib>
 #include <cstring>
@@ -8,18 +11,46 @@
 #include <fcntl.h>
 #include <iostream>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sstream>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
-// Maximum allowed request body size (10 MB)
+// Maximum request body size for a worker, which gets it whole (10 MB). A
+// script started per request reads it from its stdin, of any size.
 static const long MAX_BODY_SIZE = 10 * 1024 * 1024;
 
-// Timeout in seconds for child WSGI process
+// Default timeout in seconds for a request to the WSGI script
 static const int CHILD_TIMEOUT_SEC = 30;
 
+// Seconds a connection may wait for its next request. Longer than the
+// front-end's default keepalive_timeout (4 s), so that the front-end is the
+// side that closes an idle connection and never sends on one closed here.
+// A response the caller stops reading is given up after as long.
+static const int KEEPALIVE_TIMEOUT_SEC = 5;
+
+// Events handled per epoll_wait() call
+static const int MAX_EVENTS = 64;
+
+// Bytes read from a socket or pipe at once
+static const size_t READ_CHUNK = 64 * 1024;
+
+// Bytes of a script's output held to find its header block, and then a body
+// without Content-Length, before the response is passed on chunked
+static const size_t RELAY_BUFFER = 64 * 1024;
+
+// Bytes spliced from a script's stdout at once
+static const size_t SPLICE_CHUNK = 1024 * 1024;
+
 // Allowlisted WSGI/CGI environment variable names (exact match).
 // Any key starting with "HTTP_" is also allowed.
 // See https://peps.python.org/pep-3333/ and RFC 3875 for the full list.
@@ -47,48 +78,314 @@ static bool is_allowed_wsgi_var(const std::string &key) {
   return false;
 }
 
+// Allowlisted variables of a request as NAME=VALUE entries, for the script's
+// environment. Keys or values containing NUL bytes are silently dropped to
+// prevent environment injection (e.g. LD_PRELOAD, PYTHONPATH).
+static std::vector<std::string>
+environment(const std::map<std::string, std::string> &vars) {
+  std::vector<std::string> entries;
+  for (std::map<std::string, std::string>::const_iterator it = vars.begin();
+       it != vars.end(); ++it) {
+    if (!is_allowed_wsgi_var(it->first))
+      continue;
+    if (it->second.find('\0') != std::string::npos)
+      continue;
+    entries.push_back(it->first + "=" + it->second);
+  }
+  return entries;
+}
+
+// Run by the persistent workers with the script's path as argument. The
+// script is compiled once. One that defines `application` is loaded once and
+// called as a WSGI application; any other is run again on every request, with
+// its environment, stdin and stdout set up as for a process of its own, and
+// keeps the modules it imported. A request is two frames on fd 0, each with
+// its length as 4 big-endian bytes: the NAME=VALUE entries, each terminated
+// by NUL, then the body. The answer is one frame on fd 1 with the script's
+// output, empty if it raised. The worker exits at the end of fd 0.
+static const char WORKER_SOURCE[] =
+    "import io, os, struct, sys, traceback\n"
+    "\n"
+    "def read_exact(n):\n"
+    "    data = bytearray()\n"
+    "    while len(data) < n:\n"
+    "        chunk = os.read(0, n - len(data))\n"
+    "        if not chunk:\n"
+    "            sys.exit(0)\n"
+    "        data += chunk\n"
+    "    return bytes(data)\n"
+    "\n"
+    "def read_frame():\n"
+    "    return read_exact(struct.unpack('>I', read_exact(4))[0])\n"
+    "\n"
+    "def write_frame(data):\n"
+    "    data = memoryview(struct.pack('>I', len(data)) + data)\n"
+    "    while data:\n"
+    "        data = data[os.write(1, data):]\n"
+    "\n"
+    "path = sys.argv[1]\n"
+    "sys.argv = [path]\n"
+    "sys.path.insert(0, os.path.dirname(os.path.abspath(path)))\n"
+    "with open(path, 'rb') as f:\n"
+    "    code = compile(f.read(), path, 'exec')\n"
+    "application = None\n"
+    "if 'application' in code.co_names:\n"
+    "    module = {'__name__': '__wsgi__', '__file__': path}\n"
+    "    exec(code, module)\n"
+    "    application = module.get('application')\n"
+    "\n"
+    "def run_wsgi(entries, body):\n"
+    "    environ = dict(e.decode('latin-1').split('=', 1) for e in entries)\n"
+    "    environ.update({\n"
+    "        'wsgi.version': (1, 0), 'wsgi.url_scheme': 'http',\n"
+    "        'wsgi.input': io.BytesIO(body), 'wsgi.errors': sys.stderr,\n"
+    "        'wsgi.multithread': False, 'wsgi.multiprocess': True,\n"
+    "        'wsgi.run_once': False})\n"
+    "    head = []\n"
+    "    chunks = []\n"
+    "    def start_response(status, headers, exc_info=None):\n"
+    "        head[:] = [status, headers]\n"
+    "        return chunks.append\n"
+    "    result = application(environ, start_response)\n"
+    "    try:\n"
+    "        for chunk in result:\n"
+    "            chunks.append(chunk)\n"
+    "    finally:\n"
+    "        if hasattr(result, 'close'):\n"
+    "            result.close()\n"
+    "    lines = ['Status: ' + head[0]] + ['%s: %s' % h for h in head[1]]\n"
+    "    head = '\\r\\n'.join(lines) + '\\r\\n\\r\\n'\n"
+    "    return head.encode('latin-1') + b''.join(chunks)\n"
+    "\n"
+    "def run_script(entries, body):\n"
+    "    os.environ.clear()\n"
+    "    os.environ.update(e.decode('utf-8', 'surrogateescape').split('=', 1)\n"
+    "                      for e in entries)\n"
+    "    out = io.BytesIO()\n"
+    "    sys.stdin = io.TextIOWrapper(io.BytesIO(body), 'utf-8',\n"
+    "                                 'surrogateescape')\n"
+    "    sys.stdout = io.TextIOWrapper(out, 'utf-8', write_through=True)\n"
+    "    try:\n"
+    "        exec(code, {'__name__': '__main__', '__file__': path})\n"
+    "    except SystemExit:\n"
+    "        pass\n"
+    "    sys.stdout.flush()\n"
+    "    return out.getvalue()\n"
+    "\n"
+    "while True:\n"
+    "    entries = [e for e in read_frame().split(b'\\0') if e]\n"
+    "    body = read_frame()\n"
+    "    try:\n"
+    "        run = run_wsgi if application else run_script\n"
+    "        response = run(entries, body)\n"
+    "    except Exception:\n"
+    "        traceback.print_exc()\n"
+    "        response = b''\n"
+    "    write_frame(response)\n";
+
+// Milliseconds on the monotonic clock, for deadlines
+static long long now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<long long>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+// A length as the 4 big-endian bytes that start a frame
+static std::string frame_length(size_t length) {
+  char bytes[4];
+  bytes[0] = static_cast<char>((length >> 24) & 0xff);
+  bytes[1] = static_cast<char>((length >> 16) & 0xff);
+  bytes[2] = static_cast<char>((length >> 8) & 0xff);
+  bytes[3] = static_cast<char>(length & 0xff);
+  return std::string(bytes, 4);
+}
+
+// Two requests per core, as a script spends part of its time blocked on I/O
+static int default_concurrency() {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? static_cast<int>(cores) * 2 : 2;
+}
+
+// How the output of a script frames its body
+enum HeadFraming {
+  NoHead,       // no header block (yet)
+  HeadLength,   // Content-Length
+  HeadEncoding, // Transfer-Encoding
+  Unframed,     // neither: the body runs until the end of the output
+};
+
+// Finds the blank line ending the header block of a script's output, and
+// tells how the body after it is framed
+static HeadFraming scan_head(const std::string &response, size_t &blank,
+                             bool &use_crlf) {
+  size_t crlf = response.find("\r\n\r\n");
+  size_t lf = response.find("\n\n");
+  use_crlf = crlf != std::string::npos && (lf == std::string::npos ||
+                                           crlf < lf);
+  blank = use_crlf ? crlf : lf;
+  if (blank == std::string::npos)
+    return NoHead;
+
+  std::istringstream header_stream(response.substr(0, blank));
+  std::string line;
+  while (std::getline(header_stream, line)) {
+    size_t colon = line.find(':');
+    if (colon == std::string::npos)
+      continue;
+    std::string name = line.substr(0, colon);
+    if (strcasecmp(name.c_str(), "Content-Length") == 0)
+      return HeadLength;
+    if (strcasecmp(name.c_str(), "Transfer-Encoding") == 0)
+      return HeadEncoding;
+  }
+  return Unframed;
+}
+
+// Adds Content-Length to a response with a header block that has neither it
+// nor Transfer-Encoding, so that the caller knows where it ends without
+// waiting for the connection to close. Returns false if the end can't be told
+// (no header block, or chunked), and the connection must close after it.
+static bool frame_response(std::string &response) {
+  size_t blank;
+  bool use_crlf;
+  HeadFraming framing = scan_head(response, blank, use_crlf);
+  if (framing != Unframed)
+    return framing == HeadLength;
+
+  std::ostringstream field;
+  field << (use_crlf ? "\r\n" : "\n") << "Content-Length: "
+        << response.size() - blank - (use_crlf ? 4 : 2);
+  response.insert(blank, field.str());
+  return true;
+}
+
+// The line that starts a chunk of length bytes
+static std::string chunk_size_line(size_t length) {
+  std::ostringstream line;
+  line << std::hex << length << "\r\n";
+  return line.str();
+}
+
+UwsgiServer::Connection::Connection(int fd)
+    : fd(fd), state(Reading), in(), head_read(false), vars(), body_length(0),
+      body(), body_left(0), body_wait(false), pid(-1), worker(NULL),
+      stdin_fd(-1), stdin_watched(false), stdout_fd(-1),
+      stdout_watched(false), relay(Buffered), chunk_left(0), out(),
+      out_sent(0), keep_alive(true), deadline_ms(0) {}
+
+UwsgiServer::Worker::Worker(pid_t pid, int fd)
+    : pid(pid), fd(fd), conn(NULL), requests(0), out(), out_sent(0), in() {}
+
 UwsgiServer::UwsgiServer(const std::string &script_path, int port)
-    : _script_path(script_path), _port(port), _server_fd(-1) {}
+    : _script_path(script_path), _port(port), _socket_path(),
+      _socket_bound(false), _server_fd(-1),
+      _concurrency(default_concurrency()), _processes(1), _workers(0),
+      _max_requests(0), _timeout_sec(CHILD_TIMEOUT_SEC), _epoll_fd(-1),
+      _signal_fd(-1), _child_mask(), _running(0), _accepting(false),
+      _connections(), _pipes(), _children(), _waiting(), _worker_fds(),
+      _idle(), _respawn_ms(0) {}
+
+UwsgiServer::UwsgiServer(const std::string &script_path,
+                         const std::string &socket_path)
+    : _script_path(script_path), _port(0), _socket_path(socket_path),
+      _socket_bound(false), _server_fd(-1),
+      _concurrency(default_concurrency()), _processes(1), _workers(0),
+      _max_requests(0), _timeout_sec(CHILD_TIMEOUT_SEC), _epoll_fd(-1),
+      _signal_fd(-1), _child_mask(), _running(0), _accepting(false),
+      _connections(), _pipes(), _children(), _waiting(), _worker_fds(),
+      _idle(), _respawn_ms(0) {}
 
 UwsgiServer::~UwsgiServer() {
+  for (std::map<int, Connection *>::iterator it = _connections.begin();
+       it != _connections.end(); ++it) {
+    close(it->first);
+    delete it->second;
+  }
+  // A worker exits once its socket is closed
+  for (std::map<int, Worker *>::iterator it = _worker_fds.begin();
+       it != _worker_fds.end(); ++it) {
+    close(it->first);
+    delete it->second;
+  }
+  if (_epoll_fd >= 0)
+    close(_epoll_fd);
+  if (_signal_fd >= 0)
+    close(_signal_fd);
   if (_server_fd >= 0) {
     close(_server_fd);
     _server_fd = -1;
+    if (_socket_bound)
+      unlink(_socket_path.c_str());
   }
 }
 
-bool UwsgiServer::setup_socket() {
-  _server_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (_server_fd < 0) {
-    std::cerr << "socket() failed" << std::endl;
-    return false;
+// Binds _server_fd to the TCP port or to the Unix socket path
+bool UwsgiServer::bind_socket() {
+  if (_socket_path.empty()) {
+    int optval = 1;
+    if (setsockopt(_server_fd, SOL_SOCKET, SO_REUSEADDR, &optval,
+                   static_cast<socklen_t>(sizeof(optval))) < 0) {
+      std::cerr << "setsockopt() failed" << std::endl;
+      return false;
+    }
+
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(static_cast<unsigned short>(_port));
+    return bind(_server_fd, reinterpret_cast<struct sockaddr *>(&addr),
+                sizeof(addr)) == 0;
   }
 
-  // Prevent the listening socket from being inherited by child processes
-  if (fcntl(_server_fd, F_SETFD, FD_CLOEXEC) < 0) {
-    std::cerr << "fcntl(FD_CLOEXEC) failed" << std::endl;
-    close(_server_fd);
-    _server_fd = -1;
+  struct sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  if (_socket_path.length() >= sizeof(addr.sun_path)) {
+    std::cerr << "Socket path too long: " << _socket_path << std::endl;
     return false;
   }
-
-  int optval = 1;
-  if (setsockopt(_server_fd, SOL_SOCKET, SO_REUSEADDR, &optval,
-                 static_cast<socklen_t>(sizeof(optval))) < 0) {
-    std::cerr << "setsockopt() failed" << std::endl;
-    close(_server_fd);
-    _server_fd = -1;
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, _socket_path.c_str(), _socket_path.length());
+  if (bind(_server_fd, reinterpret_cast<struct sockaddr *>(&addr),
+           sizeof(addr)) == 0) {
+    _socket_bound = true;
+    return true;
+  }
+  // A socket file left behind by a previous run is replaced, but not one
+  // that a running server still accepts on
+  struct stat info;
+  if (errno != EADDRINUSE || lstat(_socket_path.c_str(), &info) != 0 ||
+      !S_ISSOCK(info.st_mode))
+    return false;
+  int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (probe < 0)
+    return false;
+  bool stale = connect(probe, reinterpret_cast<struct sockaddr *>(&addr),
+                       sizeof(addr)) < 0 &&
+               errno == ECONNREFUSED;
+  close(probe);
+  if (!stale) {
+    std::cerr << "Socket in use: " << _socket_path << std::endl;
     return false;
   }
+  unlink(_socket_path.c_str());
+  _socket_bound = bind(_server_fd, reinterpret_cast<struct sockaddr *>(&addr),
+                       sizeof(addr)) == 0;
+  return _socket_bound;
+}
 
-  struct sockaddr_in addr;
-  std::memset(&addr, 0, sizeof(addr));
-  addr.sin_family = AF_INET;
-  addr.sin_addr.s_addr = INADDR_ANY;
-  addr.sin_port = htons(static_cast<unsigned short>(_port));
+bool UwsgiServer::setup_socket() {
+  // Non-blocking: with several processes on the socket, another one may take
+  // the connection that woke this one up. Close-on-exec: the socket is not
+  // inherited by the scripts.
+  _server_fd = socket(_socket_path.empty() ? AF_INET : AF_UNIX,
+                      SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (_server_fd < 0) {
+    std::cerr << "socket() failed" << std::endl;
+    return false;
+  }
 
-  if (bind(_server_fd, reinterpret_cast<struct sockaddr *>(&addr),
-           sizeof(addr)) < 0) {
+  if (!bind_socket()) {
     std::cerr << "bind() failed" << std::endl;
     return false;
   }
@@ -110,97 +407,367 @@ void UwsgiServer::run() {
   // closes the connection while we are still writing.
   signal(SIGPIPE, SIG_IGN);
 
-  std::cout << "uWSGI server listening on port " << _port << std::endl;
-  std::cout << "WSGI script: " << _script_path << std::endl;
+  if (_socket_path.empty())
+    std::cout << "uWSGI server listening on port " << _port << std::endl;
+  else
+    std::cout << "uWSGI server listening on unix:" << _socket_path
+              << std::endl;
+  std::cout << "WSGI script: " << _script_path << " (" << _processes
+            << " process(es), ";
+  if (_workers > 0)
+    std::cout << _workers << " worker(s) each)" << std::endl;
+  else
+    std::cout << _concurrency << " request(s) each)" << std::endl;
+
+  if (_processes > 1)
+    supervise();
+  else
+    serve();
+}
+
+// The first process of a prefork server: starts the workers and restarts any
+// that dies, until SIGTERM or SIGINT, then stops them and returns so that the
+// Unix socket is removed.
+void UwsgiServer::supervise() {
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGCHLD);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGINT);
+  sigprocmask(SIG_BLOCK, &signals, &_child_mask);
+
+  std::map<pid_t, long long> workers; // pid -> start time
+  for (int i = 0; i < _processes; ++i) {
+    pid_t pid = start_worker();
+    if (pid > 0)
+      workers[pid] = now_ms();
+  }
 
   while (true) {
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    int client_fd =
-        accept(_server_fd, reinterpret_cast<struct sockaddr *>(&client_addr),
-               &client_len);
-    if (client_fd < 0) {
-      std::cerr << "accept() failed" << std::endl;
+    siginfo_t info;
+    int sig = sigwaitinfo(&signals, &info);
+    if (sig < 0)
       continue;
-    }
+    if (sig != SIGCHLD)
+      break;
 
-    // Prevent the client socket from leaking into child processes
-    if (fcntl(client_fd, F_SETFD, FD_CLOEXEC) < 0) {
-      std::cerr << "fcntl(FD_CLOEXEC) failed" << std::endl;
-      close(client_fd);
-      continue;
+    int wstatus;
+    pid_t pid;
+    while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+      std::map<pid_t, long long>::iterator it = workers.find(pid);
+      if (it == workers.end())
+        continue;
+      std::cerr << "Worker " << pid << " exited, restarting" << std::endl;
+      // A worker that dies right away would otherwise be restarted in a loop
+      if (now_ms() - it->second < 1000)
+        sleep(1);
+      workers.erase(it);
+      pid_t started = start_worker();
+      if (started > 0)
+        workers[started] = now_ms();
     }
+  }
+
+  for (std::map<pid_t, long long>::iterator it = workers.begin();
+       it != workers.end(); ++it)
+    kill(it->first, SIGTERM);
+  for (std::map<pid_t, long long>::iterator it = workers.begin();
+       it != workers.end(); ++it)
+    waitpid(it->first, NULL, 0);
+}
 
-    handle_connection(client_fd);
-    close(client_fd);
+pid_t UwsgiServer::start_worker() {
+  pid_t pid = fork();
+  if (pid < 0) {
+    std::cerr << "fork() failed" << std::endl;
+    return -1;
   }
+  if (pid > 0)
+    return pid;
+
+  // Worker: dies with the first process, and leaves the socket file alone
+  prctl(PR_SET_PDEATHSIG, SIGTERM);
+  sigprocmask(SIG_SETMASK, &_child_mask, NULL);
+  serve();
+  _exit(1);
 }
 
-bool UwsgiServer::read_all(int fd, void *buf, size_t len) {
-  size_t total = 0;
-  char *p = reinterpret_cast<char *>(buf);
-  while (total < len) {
-    ssize_t n = read(fd, p + total, len - total);
-    if (n > 0) {
-      total += static_cast<size_t>(n);
-      continue;
-    }
-    // n == 0: EOF before reading all bytes; n < 0: error
+bool UwsgiServer::watch(int fd, unsigned int events, int op) {
+  struct epoll_event ev;
+  std::memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.fd = fd;
+  if (epoll_ctl(_epoll_fd, op, fd, &ev) < 0) {
+    std::cerr << "epoll_ctl() failed: " << std::strerror(errno) << std::endl;
     return false;
   }
   return true;
 }
 
-bool UwsgiServer::parse_uwsgi_vars(const std::vector<unsigned char> &data,
-                                   std::map<std::string, std::string> &vars) {
-  size_t pos = 0;
-  while (pos < data.size()) {
-    // Need at least 4 bytes for key_len + val_len
-    if (pos + 2 > data.size())
-      return false;
+// Closes an fd watched by the loop. It is removed from the epoll set first: a
+// child forked but not yet exec'ed still holds a copy, which would keep it
+// there after close().
+void UwsgiServer::close_fd(int fd) {
+  epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+  close(fd);
+}
 
-    unsigned short key_len = static_cast<unsigned short>(
-        static_cast<unsigned int>(data[pos]) |
-        (static_cast<unsigned int>(data[pos + 1]) << 8));
-    pos += 2;
+// The event loop of one process. Returns only if it can't be set up.
+void UwsgiServer::serve() {
+  // SIGCHLD is read from a signalfd instead of interrupting the loop. The
+  // scripts get the mask from before.
+  sigset_t child;
+  sigemptyset(&child);
+  sigaddset(&child, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &child, &_child_mask);
+  _signal_fd = signalfd(-1, &child, SFD_NONBLOCK | SFD_CLOEXEC);
+  _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (_signal_fd < 0 || _epoll_fd < 0) {
+    std::cerr << "signalfd() or epoll_create1() failed" << std::endl;
+    return;
+  }
 
-    if (pos + key_len > data.size())
-      return false;
-    std::string key(reinterpret_cast<const char *>(&data[pos]), key_len);
-    pos += key_len;
+  if (!watch(_signal_fd, EPOLLIN, EPOLL_CTL_ADD))
+    return;
+  start_workers(now_ms());
+  update_accepting();
 
-    if (pos + 2 > data.size())
-      return false;
-    unsigned short val_len = static_cast<unsigned short>(
-        static_cast<unsigned int>(data[pos]) |
-        (static_cast<unsigned int>(data[pos + 1]) << 8));
-    pos += 2;
+  struct epoll_event events[MAX_EVENTS];
+  while (true) {
+    int n = epoll_wait(_epoll_fd, events, MAX_EVENTS, wait_timeout(now_ms()));
+    if (n < 0 && errno != EINTR) {
+      std::cerr << "epoll_wait() failed: " << std::strerror(errno)
+                << std::endl;
+      return;
+    }
+    for (int i = 0; i < n; ++i) {
+      // An fd may have been closed, or even reused, by an earlier event of
+      // the same batch, so each one is looked up again
+      int fd = events[i].data.fd;
+      if (fd == _server_fd) {
+        accept_clients();
+      } else if (fd == _signal_fd) {
+        reap_children();
+      } else if (_connections.count(fd)) {
+        client_event(_connections[fd], events[i].events);
+      } else if (_pipes.count(fd)) {
+        pipe_event(fd);
+      } else if (_worker_fds.count(fd)) {
+        worker_event(_worker_fds[fd], events[i].events);
+      }
+    }
+    expire(now_ms());
+    start_workers(now_ms());
 
-    if (pos + val_len > data.size())
-      return false;
-    std::string val(reinterpret_cast<const char *>(&data[pos]), val_len);
-    pos += val_len;
+    while (free_slots() > 0 && !_waiting.empty()) {
+      Connection *conn = _waiting.front();
+      _waiting.pop_front();
+      start_request(conn);
+    }
+    update_accepting();
+  }
+}
 
-    vars[key] = val;
+// Requests that may start now: idle workers, or processes to start
+int UwsgiServer::free_slots() const {
+  if (_workers > 0)
+    return static_cast<int>(_idle.size());
+  return _concurrency - _running;
+}
+
+// With several processes on the socket, one that has all its slots taken
+// stops watching it, so that new connections go to the others
+void UwsgiServer::update_accepting() {
+  bool accepting = _processes == 1 ||
+                   free_slots() > static_cast<int>(_waiting.size());
+  if (accepting == _accepting)
+    return;
+  if (!accepting) {
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, _server_fd, NULL);
+    _accepting = false;
+    return;
+  }
+  unsigned int events = EPOLLIN;
+#ifdef EPOLLEXCLUSIVE
+  // Wake one of the processes sharing the socket per connection, not all
+  if (_processes > 1)
+    events |= EPOLLEXCLUSIVE;
+#endif
+  _accepting = watch(_server_fd, events, EPOLL_CTL_ADD);
+}
+
+void UwsgiServer::accept_clients() {
+  // Alone on the socket, every pending connection is taken at once.
+  // Otherwise no more than the free slots, and the rest is left to the
+  // other processes.
+  int limit = _processes == 1
+                  ? INT_MAX
+                  : std::max(1, free_slots() -
+                                    static_cast<int>(_waiting.size()));
+  for (int i = 0; i < limit; ++i) {
+    // Close-on-exec: the client socket is not inherited by the scripts
+    int fd = accept4(_server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        std::cerr << "accept() failed: " << std::strerror(errno)
+                  << std::endl;
+      return;
+    }
+    Connection *conn = new Connection(fd);
+    conn->deadline_ms = now_ms() + KEEPALIVE_TIMEOUT_SEC * 1000;
+    _connections[fd] = conn;
+    if (!watch(fd, EPOLLIN, EPOLL_CTL_ADD))
+      close_connection(conn);
   }
-  return true;
 }
 
-std::string
-UwsgiServer::execute_wsgi(const std::map<std::string, std::string> &vars,
-                          const std::string &body) {
+void UwsgiServer::client_event(Connection *conn, unsigned int events) {
+  // Only a connection closed both ways is given up while its request waits
+  // or runs: the caller may shut down its side once the request is sent.
+  if (events & (EPOLLERR | EPOLLHUP)) {
+    close_connection(conn);
+    return;
+  }
+  if (conn->state == Connection::Reading && (events & EPOLLIN)) {
+    read_request(conn);
+  } else if (conn->state == Connection::Writing && (events & EPOLLOUT)) {
+    write_response(conn);
+  } else if (conn->state == Connection::Running) {
+    // The body comes in while the output may already go out
+    if (conn->body_wait && (events & EPOLLIN) && !pass_body(conn))
+      return;
+    if (conn->relay != Connection::Buffered && (events & EPOLLOUT))
+      relay_output(conn);
+  }
+}
+
+void UwsgiServer::read_request(Connection *conn) {
+  char buf[READ_CHUNK];
+  ssize_t n = recv(conn->fd, buf, sizeof(buf), 0);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return;
+  if (n <= 0) {
+    // Closed between requests, or cut short within one
+    close_connection(conn);
+    return;
+  }
+  conn->in.append(buf, static_cast<size_t>(n));
+  conn->deadline_ms = now_ms() + KEEPALIVE_TIMEOUT_SEC * 1000;
+  parse_request(conn);
+}
+
+// Takes the next request out of conn->in as far as it has arrived. Once its
+// vars block is read (and for a worker its body), the connection waits for a
+// free slot and is not read until the script runs; any bytes after the body
+// are the next request.
+void UwsgiServer::parse_request(Connection *conn) {
+  // What the script of the last request left of its body
+  size_t skip = std::min(conn->body_left, conn->in.size());
+  conn->in.erase(0, skip);
+  conn->body_left -= skip;
+  if (conn->body_left > 0)
+    return;
+
+  if (!conn->head_read) {
+    // The 4-byte uwsgi header
+    if (conn->in.size() < 4)
+      return;
+    const unsigned char *header =
+        reinterpret_cast<const unsigned char *>(conn->in.data());
+    unsigned char modifier1 = header[0];
+    size_t datasize = static_cast<size_t>(
+        static_cast<unsigned int>(header[1]) |
+        (static_cast<unsigned int>(header[2]) << 8));
+    // header[3] is modifier2; reserved / unused here
+
+    // Only WSGI/Python requests (modifier1 == 0) are supported
+    if (modifier1 != 0) {
+      send_error_response(conn, 400, "Unsupported modifier");
+      return;
+    }
+
+    // Parse key/value pairs from vars block once it is all here
+    if (conn->in.size() < 4 + datasize)
+      return;
+    std::vector<unsigned char> vars_data(conn->in.begin() + 4,
+                                         conn->in.begin() + 4 +
+                                             static_cast<long>(datasize));
+    conn->in.erase(0, 4 + datasize);
+    conn->vars.clear();
+    if (!parse_uwsgi_vars(vars_data, conn->vars)) {
+      send_error_response(conn, 400, "Failed to parse vars");
+      return;
+    }
+
+    // Validate that CONTENT_LENGTH contains only digits, and cap it at
+    // MAX_BODY_SIZE for a worker to prevent allocation-based DoS attacks.
+    conn->body_length = 0;
+    std::map<std::string, std::string>::const_iterator cl_it =
+        conn->vars.find("CONTENT_LENGTH");
+    if (cl_it != conn->vars.end() && !cl_it->second.empty()) {
+      const std::string &cl_str = cl_it->second;
+      char *endptr = NULL;
+      long content_length = std::strtol(cl_str.c_str(), &endptr, 10);
+      if (endptr == cl_str.c_str() || *endptr != '\0' || content_length < 0) {
+        send_error_response(conn, 400, "Invalid Content-Length");
+        return;
+      }
+      if (_workers > 0 && content_length > MAX_BODY_SIZE) {
+        send_error_response(conn, 413, "Request Entity Too Large");
+        return;
+      }
+      conn->body_length = static_cast<size_t>(content_length);
+    }
+    conn->head_read = true;
+    conn->body.clear();
+    if (_workers > 0)
+      conn->body.reserve(conn->body_length);
+  }
+
+  if (_workers > 0) {
+    size_t take = std::min(conn->body_length - conn->body.size(),
+                           conn->in.size());
+    conn->body.append(conn->in, 0, take);
+    conn->in.erase(0, take);
+    if (conn->body.size() < conn->body_length)
+      return;
+  }
+
+  conn->state = Connection::Waiting;
+  watch(conn->fd, 0, EPOLL_CTL_MOD);
+  _waiting.push_back(conn);
+}
+
+void UwsgiServer::start_request(Connection *conn) {
+  if (_workers > 0) {
+    send_to_worker(conn);
+  } else if (!spawn_wsgi(conn)) {
+    send_error_response(conn, 500, "Internal Server Error");
+    return;
+  }
+  ++_running;
+  conn->state = Connection::Running;
+  conn->deadline_ms = now_ms() + _timeout_sec * 1000;
+  if (conn->stdin_fd >= 0)
+    pass_body(conn);
+}
+
+// Starts the script on the request of conn, with both pipes non-blocking and
+// watched by the loop: the body is passed to its stdin as it arrives and
+// drains, and its stdout is read until it closes.
+bool UwsgiServer::spawn_wsgi(Connection *conn) {
   int stdin_pipe[2];
   int stdout_pipe[2];
 
-  if (pipe(stdin_pipe) < 0) {
+  if (pipe2(stdin_pipe, O_CLOEXEC) < 0) {
     std::cerr << "pipe() failed" << std::endl;
-    return "";
+    return false;
   }
-  if (pipe(stdout_pipe) < 0) {
+  if (pipe2(stdout_pipe, O_CLOEXEC) < 0) {
     std::cerr << "pipe() failed" << std::endl;
     close(stdin_pipe[0]);
     close(stdin_pipe[1]);
-    return "";
+    return false;
   }
 
   pid_t pid = fork();
@@ -210,39 +777,25 @@ UwsgiServer::execute_wsgi(const std::map<std::string, std::string> &vars,
     close(stdin_pipe[1]);
     close(stdout_pipe[0]);
     close(stdout_pipe[1]);
-    return "";
+    return false;
   }
 
   if (pid == 0) {
     // Child process: explicitly close the listening socket so it is not
-    // held open by the Python process. FD_CLOEXEC set in setup_socket()
-    // provides defense-in-depth on execve; the explicit close is direct
-    // and handles any fd created before F_SETFD was applied.
+    // held open by the Python process. Every other fd of the loop is
+    // close-on-exec.
     if (_server_fd >= 0)
       close(_server_fd);
-    close(stdin_pipe[1]);
-    close(stdout_pipe[0]);
+    sigprocmask(SIG_SETMASK, &_child_mask, NULL);
 
+    // dup2() leaves the new stdin and stdout open across execve
     if (dup2(stdin_pipe[0], STDIN_FILENO) < 0)
       _exit(1);
     if (dup2(stdout_pipe[1], STDOUT_FILENO) < 0)
       _exit(1);
 
-    close(stdin_pipe[0]);
-    close(stdout_pipe[1]);
-
-    // Build environment from allowlisted WSGI/CGI vars only.
-    // Keys or values containing NUL bytes are silently dropped to
-    // prevent environment injection (e.g. LD_PRELOAD, PYTHONPATH).
-    std::vector<std::string> env_strings;
-    for (std::map<std::string, std::string>::const_iterator it = vars.begin();
-         it != vars.end(); ++it) {
-      if (!is_allowed_wsgi_var(it->first))
-        continue;
-      if (it->second.find('\0') != std::string::npos)
-        continue;
-      env_strings.push_back(it->first + "=" + it->second);
-    }
+    // Build environment from allowlisted WSGI/CGI vars only
+    std::vector<std::string> env_strings = environment(conn->vars);
 
     std::vector<char *> envp;
     for (size_t i = 0; i < env_strings.size(); ++i)
@@ -260,158 +813,666 @@ UwsgiServer::execute_wsgi(const std::map<std::string, std::string> &vars,
   // Parent process
   close(stdin_pipe[0]);
   close(stdout_pipe[1]);
+  _children[pid] = now_ms() + _timeout_sec * 1000;
+  conn->pid = pid;
+  conn->out.clear();
+  conn->out_sent = 0;
+  conn->relay = Connection::Buffered;
+  conn->chunk_left = 0;
+  conn->stdout_watched = true;
+
+  fcntl(stdout_pipe[0], F_SETFL, O_NONBLOCK);
+  conn->stdout_fd = stdout_pipe[0];
+  _pipes[conn->stdout_fd] = conn;
+  watch(conn->stdout_fd, EPOLLIN, EPOLL_CTL_ADD);
 
-  // Write request body to child's stdin
-  if (!body.empty()) {
-    size_t written = 0;
-    while (written < body.size()) {
-      ssize_t n =
-          write(stdin_pipe[1], body.c_str() + written, body.size() - written);
-      if (n <= 0)
-        break;
-      written += static_cast<size_t>(n);
+  conn->body_left = conn->body_length;
+  if (conn->body_left == 0) {
+    close(stdin_pipe[1]);
+    return true;
+  }
+  // Watched only while full, see pass_body()
+  fcntl(stdin_pipe[1], F_SETFL, O_NONBLOCK);
+  conn->stdin_fd = stdin_pipe[1];
+  conn->stdin_watched = false;
+  _pipes[conn->stdin_fd] = conn;
+  return true;
+}
+
+void UwsgiServer::pipe_event(int fd) {
+  Connection *conn = _pipes[fd];
+
+  if (fd == conn->stdin_fd) {
+    pass_body(conn);
+    return;
+  }
+
+  if (conn->relay != Connection::Buffered) {
+    relay_output(conn);
+    return;
+  }
+  char buf[READ_CHUNK];
+  ssize_t n = read(fd, buf, sizeof(buf));
+  if (n < 0 && (errno == EAGAIN || errno == EINTR))
+    return;
+  if (n > 0) {
+    conn->out.append(buf, static_cast<size_t>(n));
+    if (start_relay(conn))
+      relay_output(conn);
+    return;
+  }
+  // All of the output is here: it is framed and sent whole
+  finish_request(conn);
+}
+
+// Passes the body on to the script's stdin: what conn->in holds of it first,
+// then the rest spliced straight from the socket, which is read only while
+// the pipe has room. Once the script closed its stdin the rest is read and
+// dropped. Its stdin is closed at the end of the body. The pipe leaves the
+// epoll set while the socket is waited on, as a pipe closed by the script
+// would report EPOLLERR on every wait. Returns false if the connection was
+// closed, the caller having gone before the end of the body.
+bool UwsgiServer::pass_body(Connection *conn) {
+  while (conn->body_left > 0) {
+    size_t held = std::min(conn->body_left, conn->in.size());
+    ssize_t n;
+    if (held > 0) {
+      n = conn->stdin_fd >= 0 ? write(conn->stdin_fd, conn->in.data(), held)
+                              : static_cast<ssize_t>(held);
+      if (n > 0)
+        conn->in.erase(0, static_cast<size_t>(n));
+    } else if (conn->stdin_fd >= 0) {
+      n = splice(conn->fd, NULL, conn->stdin_fd, NULL,
+                 std::min(conn->body_left, SPLICE_CHUNK),
+                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    } else {
+      char buf[READ_CHUNK];
+      n = recv(conn->fd, buf, std::min(conn->body_left, sizeof(buf)), 0);
+    }
+
+    if (n > 0) {
+      conn->body_left -= static_cast<size_t>(n);
+      // A body still arriving holds the script's deadline off, as the
+      // script waits on it
+      long long deadline = now_ms() + _timeout_sec * 1000LL;
+      conn->deadline_ms = std::max(conn->deadline_ms, deadline);
+      std::map<pid_t, long long>::iterator child = _children.find(conn->pid);
+      if (child != _children.end() && child->second > 0)
+        child->second = std::max(child->second, deadline);
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // Either side may be the one that can't go on
+      int pending = 0;
+      if (held == 0)
+        ioctl(conn->fd, FIONREAD, &pending);
+      bool on_pipe = conn->stdin_fd >= 0 && (held > 0 || pending > 0);
+      if (conn->stdin_fd >= 0 && on_pipe != conn->stdin_watched) {
+        conn->stdin_watched = on_pipe;
+        if (on_pipe)
+          watch(conn->stdin_fd, EPOLLOUT, EPOLL_CTL_ADD);
+        else
+          epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, conn->stdin_fd, NULL);
+      }
+      conn->body_wait = !on_pipe;
+      watch_client(conn);
+      return true;
     }
+    if (n < 0 && errno == EPIPE && conn->stdin_fd >= 0) {
+      // The script closed its stdin without reading it all
+      _pipes.erase(conn->stdin_fd);
+      close_fd(conn->stdin_fd);
+      conn->stdin_fd = -1;
+      continue;
+    }
+    // Cut short
+    close_connection(conn);
+    return false;
   }
-  close(stdin_pipe[1]);
 
-  // Read HTTP response from child's stdout
-  std::string response;
-  char buf[4096];
-  while (true) {
-    ssize_t n = read(stdout_pipe[0], buf, sizeof(buf));
-    if (n <= 0)
-      break;
-    response.append(buf, static_cast<size_t>(n));
+  if (conn->stdin_fd >= 0) {
+    _pipes.erase(conn->stdin_fd);
+    close_fd(conn->stdin_fd);
+    conn->stdin_fd = -1;
+  }
+  if (conn->body_wait) {
+    conn->body_wait = false;
+    watch_client(conn);
+  }
+  return true;
+}
+
+// Watches the socket of a running script for what it waits on: more of the
+// body, room for the output, or neither
+void UwsgiServer::watch_client(Connection *conn) {
+  unsigned int events = 0;
+  if (conn->body_wait)
+    events |= EPOLLIN;
+  if (conn->relay != Connection::Buffered && !conn->stdout_watched)
+    events |= EPOLLOUT;
+  watch(conn->fd, events, EPOLL_CTL_MOD);
+}
+
+// Decides from the output held so far whether the rest of it can be
+// spliced: once the header block has a Content-Length or Transfer-Encoding,
+// and once a body without either outgrows RELAY_BUFFER, which is then sent
+// chunked. An output without a header block is passed on as it is, and the
+// connection closes after it.
+bool UwsgiServer::start_relay(Connection *conn) {
+  size_t blank;
+  bool use_crlf;
+  switch (scan_head(conn->out, blank, use_crlf)) {
+  case NoHead:
+    if (conn->out.size() < RELAY_BUFFER)
+      return false;
+    conn->keep_alive = false;
+    break;
+  case HeadLength:
+    conn->keep_alive = true;
+    break;
+  case HeadEncoding:
+    conn->keep_alive = false;
+    break;
+  case Unframed: {
+    size_t body_start = blank + (use_crlf ? 4 : 2);
+    size_t held = conn->out.size() - body_start;
+    if (held < RELAY_BUFFER)
+      return false;
+    std::string body = conn->out.substr(body_start);
+    conn->out.erase(blank);
+    conn->out += use_crlf ? "\r\nTransfer-Encoding: chunked\r\n\r\n"
+                          : "\nTransfer-Encoding: chunked\n\n";
+    conn->out += chunk_size_line(held) + body + "\r\n";
+    conn->keep_alive = true;
+    conn->relay = Connection::Chunked;
+    conn->out_sent = 0;
+    return true;
+  }
   }
-  close(stdout_pipe[0]);
+  conn->relay = Connection::Raw;
+  conn->out_sent = 0;
+  return true;
+}
 
-  // Wait for the child with a timeout to prevent blocking indefinitely
-  // when a WSGI script hangs after producing its output.
-  // Sleep in 100 ms increments up to the remaining deadline to keep
-  // CPU usage low while still reaping promptly.
-  int wstatus = 0;
-  time_t deadline = time(NULL) + CHILD_TIMEOUT_SEC;
+// Passes the script's output on once its framing is known: what out holds
+// first, then the rest straight from the stdout pipe to the socket. Chunks
+// are cut to what the pipe holds, so that their length is known before they
+// are spliced. The response is complete at the end of stdout.
+void UwsgiServer::relay_output(Connection *conn) {
   while (true) {
-    pid_t waited = waitpid(pid, &wstatus, WNOHANG);
-    if (waited != 0)
-      break;
-    time_t now = time(NULL);
-    if (now >= deadline) {
-      kill(pid, SIGKILL);
-      // Loop until the killed child is fully reaped (may be interrupted)
-      while (waitpid(pid, &wstatus, 0) < 0) {
+    if (conn->out_sent < conn->out.size()) {
+      ssize_t n = send(conn->fd, conn->out.data() + conn->out_sent,
+                       conn->out.size() - conn->out_sent, MSG_NOSIGNAL);
+      if (n < 0 &&
+          (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        relay_wait(conn, true);
+        return;
       }
-      break;
+      if (n <= 0) {
+        close_connection(conn);
+        return;
+      }
+      conn->out_sent += static_cast<size_t>(n);
+      continue;
+    }
+    conn->out.clear();
+    conn->out_sent = 0;
+
+    if (conn->stdout_fd < 0) {
+      // Sent whole: the script is reaped whenever it exits
+      end_script(conn, false);
+      conn->state = Connection::Writing;
+      write_response(conn);
+      return;
+    }
+
+    size_t len = SPLICE_CHUNK;
+    if (conn->relay == Connection::Chunked) {
+      if (conn->chunk_left == 0) {
+        int held = 0;
+        ioctl(conn->stdout_fd, FIONREAD, &held);
+        if (held > 0) {
+          conn->chunk_left = static_cast<size_t>(held);
+          conn->out = chunk_size_line(conn->chunk_left);
+          continue;
+        }
+        struct pollfd pfd;
+        pfd.fd = conn->stdout_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        // Empty, and not closed: wait for more
+        if (poll(&pfd, 1, 0) <= 0) {
+          relay_wait(conn, false);
+          return;
+        }
+        if (!(pfd.revents & (POLLHUP | POLLERR)))
+          continue;
+        conn->out = "0\r\n\r\n";
+        _pipes.erase(conn->stdout_fd);
+        close_fd(conn->stdout_fd);
+        conn->stdout_fd = -1;
+        continue;
+      }
+      len = conn->chunk_left;
+    }
+
+    ssize_t n = splice(conn->stdout_fd, NULL, conn->fd, NULL, len,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n > 0) {
+      // A response still moving outlives the script's deadline, which a
+      // slow caller would otherwise run out: the pipe holds the script back
+      conn->deadline_ms = std::max(
+          conn->deadline_ms, now_ms() + KEEPALIVE_TIMEOUT_SEC * 1000LL);
+      if (conn->relay == Connection::Chunked) {
+        conn->chunk_left -= static_cast<size_t>(n);
+        if (conn->chunk_left == 0)
+          conn->out = "\r\n";
+      }
+      continue;
     }
-    // Sleep up to 100 ms, but no more than the remaining timeout
-    long remaining_ms = static_cast<long>((deadline - now) * 1000L);
-    long sleep_ms = (remaining_ms < 100L) ? remaining_ms : 100L;
-    struct timespec ts;
-    ts.tv_sec = 0;
-    ts.tv_nsec = sleep_ms * 1000000L;
-    nanosleep(&ts, NULL);
+    if (n == 0) {
+      // The end of stdout
+      _pipes.erase(conn->stdout_fd);
+      close_fd(conn->stdout_fd);
+      conn->stdout_fd = -1;
+      continue;
+    }
+    if (errno != EAGAIN && errno != EINTR) {
+      close_connection(conn);
+      return;
+    }
+    // Either side may be the one that can't go on
+    int held = 0;
+    ioctl(conn->stdout_fd, FIONREAD, &held);
+    relay_wait(conn, held > 0);
+    return;
   }
+}
 
-  return response;
+// Waits for the client socket to take more, or for the pipe to hold more.
+// The pipe leaves the epoll set meanwhile, as a closed pipe would report
+// EPOLLHUP on every wait.
+void UwsgiServer::relay_wait(Connection *conn, bool on_socket) {
+  if (on_socket == conn->stdout_watched) {
+    conn->stdout_watched = !on_socket;
+    if (on_socket)
+      epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, conn->stdout_fd, NULL);
+    else
+      watch(conn->stdout_fd, EPOLLIN, EPOLL_CTL_ADD);
+  }
+  watch_client(conn);
 }
 
-void UwsgiServer::send_error_response(int fd, int status,
-                                      const std::string &reason) {
-  std::ostringstream oss;
-  oss << "HTTP/1.1 " << status << " " << reason << "\r\n"
-      << "Content-Type: text/plain\r\n"
-      << "Content-Length: " << reason.size() << "\r\n"
-      << "Connection: close\r\n"
-      << "\r\n"
-      << reason;
-  const std::string response = oss.str();
-  size_t sent = 0;
-  while (sent < response.size()) {
-    ssize_t n = write(fd, response.c_str() + sent, response.size() - sent);
-    if (n <= 0)
-      break;
-    sent += static_cast<size_t>(n);
+// Starts workers up to _workers. One that died before serving a request,
+// likely on a script that fails to load, holds the next start back a second.
+void UwsgiServer::start_workers(long long now) {
+  while (static_cast<int>(_worker_fds.size()) < _workers &&
+         now >= _respawn_ms) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+      std::cerr << "socketpair() failed" << std::endl;
+      _respawn_ms = now + 1000;
+      return;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+      std::cerr << "fork() failed" << std::endl;
+      close(fds[0]);
+      close(fds[1]);
+      _respawn_ms = now + 1000;
+      return;
+    }
+
+    if (pid == 0) {
+      if (_server_fd >= 0)
+        close(_server_fd);
+      sigprocmask(SIG_SETMASK, &_child_mask, NULL);
+      if (dup2(fds[1], STDIN_FILENO) < 0 || dup2(fds[1], STDOUT_FILENO) < 0)
+        _exit(1);
+      char *argv[] = {const_cast<char *>("python3"), const_cast<char *>("-c"),
+                      const_cast<char *>(WORKER_SOURCE),
+                      const_cast<char *>(_script_path.c_str()), NULL};
+      char *envp[] = {NULL};
+      execve("/usr/bin/python3", argv, envp);
+      _exit(1);
+    }
+
+    close(fds[1]);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    _children[pid] = 0;
+    Worker *worker = new Worker(pid, fds[0]);
+    _worker_fds[worker->fd] = worker;
+    _idle.push_back(worker);
+    watch(worker->fd, EPOLLIN, EPOLL_CTL_ADD);
   }
 }
 
-void UwsgiServer::handle_connection(int client_fd) {
-  // Read the 4-byte uwsgi header
-  unsigned char header[4];
-  if (!read_all(client_fd, header, sizeof(header))) {
-    send_error_response(client_fd, 400, "Bad Request");
-    return;
+// Hands the request of conn to an idle worker, as the frame of its variables
+// and the frame of its body
+void UwsgiServer::send_to_worker(Connection *conn) {
+  Worker *worker = _idle.front();
+  _idle.pop_front();
+
+  std::vector<std::string> entries = environment(conn->vars);
+  std::string block;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    block += entries[i];
+    block += '\0';
   }
+  worker->out = frame_length(block.size()) + block +
+                frame_length(conn->body.size());
+  worker->out += conn->body;
+  std::string().swap(conn->body);
+  worker->out_sent = 0;
+  worker->in.clear();
+  worker->conn = conn;
+  conn->worker = worker;
+  conn->out.clear();
+  watch(worker->fd, EPOLLIN | EPOLLOUT, EPOLL_CTL_MOD);
+}
 
-  unsigned char modifier1 = header[0];
-  unsigned short datasize =
-      static_cast<unsigned short>(static_cast<unsigned int>(header[1]) |
-                                  (static_cast<unsigned int>(header[2]) << 8));
-  // header[3] is modifier2; reserved / unused here
+void UwsgiServer::worker_event(Worker *worker, unsigned int events) {
+  if (worker->conn != NULL && worker->out_sent < worker->out.size() &&
+      (events & EPOLLOUT)) {
+    ssize_t n = send(worker->fd, worker->out.data() + worker->out_sent,
+                     worker->out.size() - worker->out_sent, MSG_NOSIGNAL);
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      worker_failed(worker);
+      return;
+    }
+    if (n > 0)
+      worker->out_sent += static_cast<size_t>(n);
+    if (worker->out_sent == worker->out.size()) {
+      std::string().swap(worker->out);
+      worker->out_sent = 0;
+      watch(worker->fd, EPOLLIN, EPOLL_CTL_MOD);
+    }
+  }
+  if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+    return;
 
-  // Only WSGI/Python requests (modifier1 == 0) are supported
-  if (modifier1 != 0) {
-    send_error_response(client_fd, 400, "Unsupported modifier");
+  char buf[READ_CHUNK];
+  ssize_t n = recv(worker->fd, buf, sizeof(buf), 0);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return;
+  // Gone, or talking out of turn
+  if (n <= 0 || worker->conn == NULL) {
+    worker_failed(worker);
+    return;
+  }
+  worker->in.append(buf, static_cast<size_t>(n));
+  if (worker->in.size() < 4)
+    return;
+  const unsigned char *header =
+      reinterpret_cast<const unsigned char *>(worker->in.data());
+  size_t length = static_cast<size_t>(header[0]) << 24 |
+                  static_cast<size_t>(header[1]) << 16 |
+                  static_cast<size_t>(header[2]) << 8 |
+                  static_cast<size_t>(header[3]);
+  if (worker->in.size() < 4 + length)
+    return;
+  if (worker->in.size() > 4 + length) {
+    worker_failed(worker);
     return;
   }
 
-  // Read the vars block
-  std::vector<unsigned char> vars_data(static_cast<size_t>(datasize));
-  if (datasize > 0 &&
-      !read_all(client_fd, &vars_data[0], static_cast<size_t>(datasize))) {
-    send_error_response(client_fd, 400, "Failed to read vars");
+  Connection *conn = worker->conn;
+  conn->out = worker->in.substr(4);
+  std::string().swap(worker->in);
+  ++worker->requests;
+  finish_request(conn);
+}
+
+// The worker died or broke the protocol: it is replaced, and its request, if
+// any, answered with 500
+void UwsgiServer::worker_failed(Worker *worker) {
+  if (worker->requests == 0)
+    _respawn_ms = now_ms() + 1000;
+  Connection *conn = worker->conn;
+  if (conn == NULL) {
+    retire_worker(worker, true);
     return;
   }
+  end_script(conn, true);
+  send_error_response(conn, 500, "Internal Server Error");
+}
 
-  // Parse key/value pairs from vars block
-  std::map<std::string, std::string> vars;
-  if (!parse_uwsgi_vars(vars_data, vars)) {
-    send_error_response(client_fd, 400, "Failed to parse vars");
+// Closes the worker's socket, which makes it exit; a worker that fails or
+// doesn't exit within the timeout is killed
+void UwsgiServer::retire_worker(Worker *worker, bool kill_process) {
+  _idle.erase(std::remove(_idle.begin(), _idle.end(), worker), _idle.end());
+  _worker_fds.erase(worker->fd);
+  close_fd(worker->fd);
+  if (_children.count(worker->pid)) {
+    if (kill_process) {
+      kill(worker->pid, SIGKILL);
+      _children[worker->pid] = 0;
+    } else {
+      _children[worker->pid] = now_ms() + _timeout_sec * 1000;
+    }
+  }
+  delete worker;
+}
+
+// The script closed its stdout, or the worker sent its answer: the response
+// is complete. A script is reaped whenever it exits, or killed at its
+// deadline if it lingers.
+void UwsgiServer::finish_request(Connection *conn) {
+  end_script(conn, false);
+  if (conn->out.empty()) {
+    send_error_response(conn, 500, "Internal Server Error");
     return;
   }
+  conn->keep_alive = frame_response(conn->out);
+  conn->out_sent = 0;
+  conn->state = Connection::Writing;
+  conn->deadline_ms = now_ms() + KEEPALIVE_TIMEOUT_SEC * 1000;
+  watch(conn->fd, EPOLLOUT, EPOLL_CTL_MOD);
+  write_response(conn);
+}
 
-  // Read request body if CONTENT_LENGTH is provided.
-  // Validate that the value contains only digits and cap it at MAX_BODY_SIZE
-  // to prevent allocation-based DoS attacks.
-  std::string body;
-  std::map<std::string, std::string>::const_iterator cl_it =
-      vars.find("CONTENT_LENGTH");
-  if (cl_it != vars.end() && !cl_it->second.empty()) {
-    const std::string &cl_str = cl_it->second;
-    char *endptr = NULL;
-    long content_length = std::strtol(cl_str.c_str(), &endptr, 10);
-    if (endptr == cl_str.c_str() || *endptr != '\0' || content_length < 0) {
-      send_error_response(client_fd, 400, "Invalid Content-Length");
+void UwsgiServer::write_response(Connection *conn) {
+  while (conn->out_sent < conn->out.size()) {
+    ssize_t n = send(conn->fd, conn->out.data() + conn->out_sent,
+                     conn->out.size() - conn->out_sent, MSG_NOSIGNAL);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
       return;
-    }
-    if (content_length > MAX_BODY_SIZE) {
-      send_error_response(client_fd, 413, "Request Entity Too Large");
+    if (n <= 0) {
+      close_connection(conn);
       return;
     }
-    if (content_length > 0) {
-      std::vector<char> body_buf(static_cast<size_t>(content_length));
-      if (!read_all(client_fd, &body_buf[0],
-                    static_cast<size_t>(content_length))) {
-        send_error_response(client_fd, 400, "Failed to read body");
-        return;
-      }
-      body.assign(body_buf.begin(), body_buf.end());
+    conn->out_sent += static_cast<size_t>(n);
+    conn->deadline_ms = now_ms() + KEEPALIVE_TIMEOUT_SEC * 1000;
+  }
+  if (!conn->keep_alive) {
+    close_connection(conn);
+    return;
+  }
+  next_request(conn);
+}
+
+// Back to reading, starting with any request pipelined behind the last one
+void UwsgiServer::next_request(Connection *conn) {
+  conn->state = Connection::Reading;
+  conn->head_read = false;
+  conn->vars.clear();
+  conn->body_length = 0;
+  std::string().swap(conn->body);
+  std::string().swap(conn->out);
+  conn->out_sent = 0;
+  conn->relay = Connection::Buffered;
+  conn->deadline_ms = now_ms() + KEEPALIVE_TIMEOUT_SEC * 1000;
+  watch(conn->fd, EPOLLIN, EPOLL_CTL_MOD);
+  if (!conn->in.empty())
+    parse_request(conn);
+}
+
+// Closes the pipes of the script running for conn and frees its slot; the
+// script is killed if its response is no longer wanted. What is left of the
+// body is dropped before the next request.
+void UwsgiServer::end_script(Connection *conn, bool kill_child) {
+  conn->body_wait = false;
+  if (conn->stdin_fd >= 0) {
+    _pipes.erase(conn->stdin_fd);
+    close_fd(conn->stdin_fd);
+    conn->stdin_fd = -1;
+  }
+  if (conn->stdout_fd >= 0) {
+    _pipes.erase(conn->stdout_fd);
+    close_fd(conn->stdout_fd);
+    conn->stdout_fd = -1;
+  }
+  if (conn->pid > 0) {
+    if (kill_child && _children.count(conn->pid)) {
+      kill(conn->pid, SIGKILL);
+      _children[conn->pid] = 0;
+    }
+    conn->pid = -1;
+    --_running;
+  }
+  if (conn->worker != NULL) {
+    Worker *worker = conn->worker;
+    conn->worker = NULL;
+    worker->conn = NULL;
+    --_running;
+    if (kill_child ||
+        (_max_requests > 0 && worker->requests >= _max_requests)) {
+      retire_worker(worker, kill_child);
+    } else {
+      _idle.push_back(worker);
+      watch(worker->fd, EPOLLIN, EPOLL_CTL_MOD);
     }
   }
+}
 
-  // Execute the WSGI script and obtain its HTTP response
-  const std::string response = execute_wsgi(vars, body);
-  if (response.empty()) {
-    send_error_response(client_fd, 500, "Internal Server Error");
-    return;
+void UwsgiServer::close_connection(Connection *conn) {
+  if (conn->state == Connection::Running)
+    end_script(conn, true);
+  else if (conn->state == Connection::Waiting)
+    _waiting.erase(std::find(_waiting.begin(), _waiting.end(), conn));
+  _connections.erase(conn->fd);
+  close_fd(conn->fd);
+  delete conn;
+}
+
+// Reaps every script that exited, as told by SIGCHLD
+void UwsgiServer::reap_children() {
+  struct signalfd_siginfo info;
+  while (read(_signal_fd, &info, sizeof(info)) > 0) {
+  }
+  pid_t pid;
+  while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+    _children.erase(pid);
+}
+
+// Closes idle connections and callers that stopped reading, answers requests
+// whose script ran out of time with 504, and kills scripts that linger after
+// their response.
+void UwsgiServer::expire(long long now) {
+  std::vector<Connection *> expired;
+  for (std::map<int, Connection *>::iterator it = _connections.begin();
+       it != _connections.end(); ++it) {
+    if (it->second->state != Connection::Waiting &&
+        it->second->deadline_ms <= now)
+      expired.push_back(it->second);
+  }
+  for (size_t i = 0; i < expired.size(); ++i) {
+    Connection *conn = expired[i];
+    if (conn->state == Connection::Running &&
+        conn->relay == Connection::Buffered) {
+      end_script(conn, true);
+      send_error_response(conn, 504, "Gateway Timeout");
+    } else {
+      // Too late for a response
+      close_connection(conn);
+    }
   }
 
-  // Forward the response back to the caller
-  size_t sent = 0;
-  while (sent < response.size()) {
-    ssize_t n =
-        write(client_fd, response.c_str() + sent, response.size() - sent);
-    if (n <= 0)
-      break;
-    sent += static_cast<size_t>(n);
+  for (std::map<pid_t, long long>::iterator it = _children.begin();
+       it != _children.end(); ++it) {
+    if (it->second > 0 && it->second <= now) {
+      kill(it->first, SIGKILL);
+      it->second = 0;
+    }
   }
 }
+
+// Milliseconds until the next deadline, for epoll_wait()
+int UwsgiServer::wait_timeout(long long now) const {
+  long long next = -1;
+  for (std::map<int, Connection *>::const_iterator it = _connections.begin();
+       it != _connections.end(); ++it) {
+    if (it->second->state != Connection::Waiting &&
+        (next < 0 || it->second->deadline_ms < next))
+      next = it->second->deadline_ms;
+  }
+  for (std::map<pid_t, long long>::const_iterator it = _children.begin();
+       it != _children.end(); ++it) {
+    if (it->second > 0 && (next < 0 || it->second < next))
+      next = it->second;
+  }
+  if (static_cast<int>(_worker_fds.size()) < _workers &&
+      (next < 0 || _respawn_ms < next))
+    next = _respawn_ms;
+  if (next < 0)
+    return -1;
+  if (next <= now)
+    return 0;
+  return static_cast<int>(
+      std::min(next - now, static_cast<long long>(INT_MAX)));
+}
+
+bool UwsgiServer::parse_uwsgi_vars(const std::vector<unsigned char> &data,
+                                   std::map<std::string, std::string> &vars) {
+  size_t pos = 0;
+  while (pos < data.size()) {
+    // Need at least 4 bytes for key_len + val_len
+    if (pos + 2 > data.size())
+      return false;
+
+    unsigned short key_len = static_cast<unsigned short>(
+        static_cast<unsigned int>(data[pos]) |
+        (static_cast<unsigned int>(data[pos + 1]) << 8));
+    pos += 2;
+
+    if (pos + key_len > data.size())
+      return false;
+    std::string key(reinterpret_cast<const char *>(&data[pos]), key_len);
+    pos += key_len;
+
+    if (pos + 2 > data.size())
+      return false;
+    unsigned short val_len = static_cast<unsigned short>(
+        static_cast<unsigned int>(data[pos]) |
+        (static_cast<unsigned int>(data[pos + 1]) << 8));
+    pos += 2;
+
+    if (pos + val_len > data.size())
+      return false;
+    std::string val(reinterpret_cast<const char *>(&data[pos]), val_len);
+    pos += val_len;
+
+    vars[key] = val;
+  }
+  return true;
+}
+
+// Queues an error response on conn; the connection closes once it is sent
+void UwsgiServer::send_error_response(Connection *conn, int status,
+                                      const std::string &reason) {
+  std::ostringstream oss;
+  oss << "HTTP/1.1 " << status << " " << reason << "\r\n"
+      << "Content-Type: text/plain\r\n"
+      << "Content-Length: " << reason.size() << "\r\n"
+      << "Connection: close\r\n"
+      << "\r\n"
+      << reason;
+  conn->out = oss.str();
+  conn->out_sent = 0;
+  conn->keep_alive = false;
+  conn->state = Connection::Writing;
+  conn->deadline_ms = now_ms() + KEEPALIVE_TIMEOUT_SEC * 1000;
+  watch(conn->fd, EPOLLOUT, EPOLL_CTL_MOD);
+}
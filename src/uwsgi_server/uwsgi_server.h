@@ -1,19 +1,55 @@
 #ifndef UWSGI_SERVER_H
 #define UWSGI_SERVER_H
 
+#include <deque>
 #include <map>
+#include <signal.h>
 #include <string>
+#include <sys/types.h>
 #include <vector>
 
 /**
  * @class UwsgiServer
  * @brief A server that speaks the uwsgi binary protocol.
  *
- * Listens on a TCP port, accepts connections from a front-end proxy (e.g.
+ * Listens on a TCP port or a Unix domain socket (cheaper for a front-end on
+ * the same host), accepts connections from a front-end proxy (e.g.
  * nginx configured with uwsgi_pass), parses the uwsgi packet, executes the
  * configured Python WSGI script as a child process, and forwards the HTTP
  * response back to the caller.
  *
+ * Every process runs one epoll loop over the listening socket, its
+ * connections and the pipes of its children, all non-blocking, so that up
+ * to `concurrency` requests run at once; further complete requests wait for
+ * a slot. Children are reaped through a signalfd as they exit. With
+ * `processes` above 1 the listening socket is shared by that many forked
+ * copies of the loop, and the first process only restarts those that die.
+ *
+ * By default every request starts a fresh interpreter on the script. With
+ * `workers` set, each process instead keeps that many Python workers that
+ * load the script once and serve one request after the other, and the
+ * workers are the slots. A worker is replaced after `max_requests`, when it
+ * dies, or when its request times out or is abandoned.
+ *
+ * A script started per request begins as soon as the vars block is read, and
+ * the body is spliced from the socket to its stdin as it arrives: the socket
+ * is read only while the pipe has room, so an upload of any size holds no
+ * more than the pipe. A worker gets the body whole, up to MAX_BODY_SIZE.
+ * Whatever a script leaves unread is read and dropped, so that the caller is
+ * never stuck sending it.
+ *
+ * The output of a script started per request is held only until its
+ * header block is complete. A response that has a Content-Length is then
+ * passed on as it comes, straight from the script's stdout pipe to the
+ * socket with splice(), so a large response never sits in memory. One that
+ * has none is held up to RELAY_BUFFER bytes: if it ends within them it gets
+ * a Content-Length, otherwise it is passed on chunked.
+ *
+ * A connection carries any number of requests, one after the other: every
+ * response has a Content-Length or is chunked, so the caller can send the
+ * next request without closing. A connection idle for KEEPALIVE_TIMEOUT_SEC
+ * is closed.
+ *
  * uwsgi packet layout (all integers are little-endian):
  *   [modifier1 : 1 byte ] – 0 = Python/WSGI
  *   [datasize  : 2 bytes] – byte length of the vars block that follows
@@ -26,23 +62,145 @@
 class UwsgiServer {
 public:
   UwsgiServer(const std::string &script_path, int port);
+  // Listens on the Unix socket at socket_path instead, removed on exit
+  UwsgiServer(const std::string &script_path, const std::string &socket_path);
   ~UwsgiServer();
 
+  // Requests run at once by each process
+  void set_concurrency(int concurrency) { _concurrency = concurrency; }
+  // Processes sharing the listening socket
+  void set_processes(int processes) { _processes = processes; }
+  // Persistent Python workers per process, 0 to start one per request
+  void set_workers(int workers) { _workers = workers; }
+  // Requests a worker serves before it is replaced, 0 for no limit
+  void set_max_requests(int max_requests) { _max_requests = max_requests; }
+  // Seconds a request may run
+  void set_timeout(int timeout_sec) { _timeout_sec = timeout_sec; }
   void run();
 
 private:
+  struct Worker;
+
+  struct Connection {
+    enum State {
+      Reading, // the next request, up to its vars block (its body too for a
+               // worker)
+      Waiting, // read, for a free slot
+      Running, // the script answers
+      Writing, // the response goes out
+    };
+
+    // How the script's stdout is passed on
+    enum Relay {
+      Buffered, // read into out, until it ends or its framing is known
+      Raw,      // spliced as it is
+      Chunked,  // spliced as chunks of what the pipe holds
+    };
+
+    int fd;
+    State state;
+    std::string in; // request bytes not parsed yet
+    bool head_read; // header and vars block parsed
+    std::map<std::string, std::string> vars;
+    size_t body_length; // CONTENT_LENGTH
+    std::string body;      // for a worker
+    size_t body_left;      // of the body, not passed to the script yet
+    bool body_wait;        // for more of it on the socket, with EPOLLIN
+    pid_t pid;             // the running script, -1 if none
+    Worker *worker;        // or the worker serving the request
+    int stdin_fd;          // until the body is written, -1 once closed
+    bool stdin_watched;    // in the epoll set, for EPOLLOUT
+    int stdout_fd;         // until the script closes it, -1 once closed
+    bool stdout_watched;   // in the epoll set, for EPOLLIN
+    Relay relay;           // of stdout
+    size_t chunk_left;     // Chunked: bytes of the current chunk to splice
+    std::string out;       // the response
+    size_t out_sent;
+    bool keep_alive;       // read the next request once out is sent
+    long long deadline_ms; // idle (Reading) or script (Running) deadline
+
+    explicit Connection(int fd);
+  };
+
+  // A Python process that loaded the script and serves one request at a time
+  // over a socketpair, as length-framed messages
+  struct Worker {
+    pid_t pid;
+    int fd;
+    Connection *conn; // the request served, NULL while idle
+    int requests;     // served so far
+    std::string out;  // request frames not sent yet
+    size_t out_sent;
+    std::string in; // response frame so far
+
+    Worker(pid_t pid, int fd);
+  };
+
   std::string _script_path;
   int _port;
+  std::string _socket_path; // empty: TCP on _port
+  bool _socket_bound;       // _socket_path is ours to remove on exit
   int _server_fd;
+  int _concurrency;
+  int _processes;
+  int _workers;
+  int _max_requests;
+  int _timeout_sec;
+
+  // State of the event loop of this process
+  int _epoll_fd;
+  int _signal_fd; // SIGCHLD
+  sigset_t _child_mask; // signal mask the scripts start with
+  int _running;
+  bool _accepting; // the listening socket is watched
+  std::map<int, Connection *> _connections; // by client fd
+  std::map<int, Connection *> _pipes;       // by stdin or stdout fd
+  std::map<pid_t, long long> _children; // not reaped yet, kill deadline or 0
+  std::deque<Connection *> _waiting;
+  std::map<int, Worker *> _worker_fds; // live workers by socket
+  std::deque<Worker *> _idle;
+  long long _respawn_ms; // no worker is started before
 
   bool setup_socket();
-  void handle_connection(int client_fd);
-  bool read_all(int fd, void *buf, size_t len);
+  bool bind_socket();
+  void supervise();
+  pid_t start_worker();
+  void serve();
+
+  bool watch(int fd, unsigned int events, int op);
+  int free_slots() const;
+  void accept_clients();
+  void update_accepting();
+  void client_event(Connection *conn, unsigned int events);
+  void read_request(Connection *conn);
+  void parse_request(Connection *conn);
+  void start_request(Connection *conn);
+  bool spawn_wsgi(Connection *conn);
+  void pipe_event(int fd);
+  bool pass_body(Connection *conn);
+  void watch_client(Connection *conn);
+  bool start_relay(Connection *conn);
+  void relay_output(Connection *conn);
+  void relay_wait(Connection *conn, bool on_socket);
+  void start_workers(long long now_ms);
+  void send_to_worker(Connection *conn);
+  void worker_event(Worker *worker, unsigned int events);
+  void worker_failed(Worker *worker);
+  void retire_worker(Worker *worker, bool kill_process);
+  void finish_request(Connection *conn);
+  void write_response(Connection *conn);
+  void next_request(Connection *conn);
+  void end_script(Connection *conn, bool kill_child);
+  void close_connection(Connection *conn);
+  void close_fd(int fd);
+  void reap_children();
+  void expire(long long now_ms);
+  int wait_timeout(long long now_ms) const;
+
   bool parse_uwsgi_vars(const std::vector<unsigned char> &data,
                         std::map<std::string, std::string> &vars);
-  std::string execute_wsgi(const std::map<std::string, std::string> &vars,
-                           const std::string &body);
-  void send_error_response(int fd, int status, const std::string &reason);
+  void send_error_response(Connection *conn, int status,
+                           const std::string &reason);
 
   // Non-copyable
   UwsgiServer(const UwsgiServer &);
@@ -3,6 +3,25 @@
 
 #define BUFFER_SIZE 42
 #define NETWORK_BUFFER_SIZE 4096
+#define OUTPUT_HIGH_WATER (256 * 1024)
+#define OUTPUT_LOW_WATER (64 * 1024)
+// Exit status polling interval (ms) for children without a pidfd
+#define CGI_REAP_INTERVAL 10
+// Time (ms) a terminated child gets between SIGTERM and SIGKILL
+#define CHILD_KILL_GRACE 1000
+// Request body bytes buffered per connection on their way to CGI stdin
+#define UPLOAD_BUFFER_SIZE (64 * 1024)
+// Time (ms) a streamed request body keeps pushing back the script's or
+// backend's timeout
+#define UPLOAD_TIME_MAX 60000
+// Largest CGI response body kept by the micro-cache
+#define CGI_CACHE_MAX_ENTRY (1024 * 1024)
+// Longest sleep (ms) between two CgiPool::maintain() rounds
+#define CGI_POOL_INTERVAL 1000
+// Interval (ms) at which listeners paused out of file descriptors retry
+#define ACCEPT_RETRY_INTERVAL 100
+// Reads spent draining a connection refused with 503 before it is closed
+#define OVERLOAD_DRAIN_READS 2
 #define LONG_DOUBLE_DIGITS 37
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) > (b) ? (b) : (a))
@@ -32,16 +51,21 @@
 #include <fstream>
 #include <iostream>
 #include <netdb.h>
+#include <spawn.h>
 #include <sstream>
 #include <sys/select.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 void wrap_up(int) throw();
 extern volatile sig_atomic_t g_receivedSignal;
+void request_reload(int) throw();
+extern volatile sig_atomic_t g_reloadPlugins;
 
 #endif